@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "BroadcastRing.h"
+#include "Util.h"
+
+#define RING_SEQ_BUSY UINT64_MAX
+
+// shared futexes, the ring may be mapped by several processes
+static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, timespec const* timeout)
+{
+    return syscall(SYS_futex, (uint32_t*)word, op, value, timeout, NULL, 0);
+}
+
+BroadcastRing::BroadcastRing() { }
+
+BroadcastRing::~BroadcastRing()
+{
+    if (_chunkMemory)
+        munmap(_chunkMemory, _chunkMemorySize);
+
+    if (_memory)
+        munmap(_memory, _memorySize);
+
+    if (_fd >= 0)
+        close(_fd);
+}
+
+bool BroadcastRing::Initialize(size_t chunkCount, BufferArena* arena)
+{
+    return Map(chunkCount, -1, arena, false);
+}
+
+// sealed memfd of size, -1 on failure
+static int createMemfd(std::string const& name, size_t size, unsigned int flags)
+{
+    int fd = memfd_create(("iss_ring_" + name).c_str(), MFD_CLOEXEC | MFD_ALLOW_SEALING | flags);
+    if (fd < 0)
+        return -1;
+
+    // size is sealed, readers can trust it once they've checked it
+    if (ftruncate(fd, size) < 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool BroadcastRing::InitializeShared(size_t chunkCount, std::string const& name,
+    BufferArena* arena)
+{
+    // hugetlb pages if the host reserved some, like BufferArena::Map(), a
+    // hugetlb memfd is sized in whole huge pages, and fails to map without any
+    size_t size = RING_HEADER_SIZE + chunkCount * sizeof(RingChunk);
+    if (arena)
+    {
+        size_t hugeSize = (size + ARENA_HUGE_PAGE_SIZE - 1) / ARENA_HUGE_PAGE_SIZE *
+            ARENA_HUGE_PAGE_SIZE;
+        _fd = createMemfd(name, hugeSize, MFD_HUGETLB);
+        if (_fd >= 0 && Map(chunkCount, _fd, arena, true))
+            return true;
+
+        if (_fd >= 0)
+            close(_fd);
+    }
+
+    _fd = createMemfd(name, size, 0);
+    if (_fd < 0)
+    {
+        LOG_ERROR("Failed to create shared broadcast ring");
+        return false;
+    }
+
+    return Map(chunkCount, _fd, arena, false);
+}
+
+bool BroadcastRing::Map(size_t chunkCount, int fd, BufferArena* arena, bool isHuge)
+{
+    _memorySize = RING_HEADER_SIZE + chunkCount * sizeof(RingChunk);
+    if (arena && fd < 0)
+        _memory = arena->Map(_memorySize);
+    else
+    {
+        if (isHuge)
+            _memorySize = (_memorySize + ARENA_HUGE_PAGE_SIZE - 1) / ARENA_HUGE_PAGE_SIZE *
+                ARENA_HUGE_PAGE_SIZE;
+        _memory = mmap(NULL, _memorySize, PROT_READ | PROT_WRITE,
+            fd < 0 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED, fd, 0);
+        if (_memory == MAP_FAILED)
+            _memory = nullptr;
+        else if (arena)
+        {
+            arena->Advise(_memory, _memorySize);
+            arena->Account(_memorySize, isHuge);
+        }
+    }
+
+    // a hugetlb one is retried with regular pages
+    if (!_memory)
+    {
+        if (!isHuge)
+            LOG_ERROR("Failed to allocate %zu bytes for broadcast ring", _memorySize);
+        return false;
+    }
+
+    // fresh mappings are zero filled, only the cursors need setting up
+    _header = (RingHeader*)_memory;
+    _header->writeSeq.store(0);
+    _header->writePos.store(0);
+    _header->chunkCount = chunkCount;
+
+    _chunks = (RingChunk*)((char*)_memory + RING_HEADER_SIZE);
+    _chunkCount = chunkCount;
+    for (size_t i = 0; i < chunkCount; ++i)
+        _chunks[i].seq.store(RING_SEQ_BUSY);
+
+    // published last, attaching readers check it
+    std::atomic_thread_fence(std::memory_order_release);
+    _header->magic = RING_MAGIC;
+    return true;
+}
+
+bool BroadcastRing::Attach(int fd)
+{
+    _fd = fd;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < RING_HEADER_SIZE)
+    {
+        LOG_ERROR("Shared broadcast ring is too small");
+        return false;
+    }
+
+    // header is written to by readers too, they register as futex waiters,
+    // unless they were only given a read only fd
+    // read only rings are mapped in one go, as hugetlb memfds need, their
+    // offsets have to be huge page aligned
+    _isReadOnly = (fcntl(fd, F_GETFL) & O_ACCMODE) == O_RDONLY;
+    _memorySize = _isReadOnly ? st.st_size : RING_HEADER_SIZE;
+    _memory = mmap(NULL, _memorySize, _isReadOnly ? PROT_READ : PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (_memory == MAP_FAILED)
+    {
+        _memory = nullptr;
+        LOG_ERROR("Failed to map shared broadcast ring");
+        return false;
+    }
+
+    _header = (RingHeader*)_memory;
+    _chunkCount = _header->chunkCount;
+    _chunkMemorySize = _chunkCount * sizeof(RingChunk);
+    if (_header->magic != RING_MAGIC || _chunkCount == 0 ||
+        (size_t)st.st_size < RING_HEADER_SIZE + _chunkMemorySize)
+    {
+        LOG_ERROR("Invalid shared broadcast ring");
+        return false;
+    }
+
+    if (_isReadOnly)
+    {
+        _chunks = (RingChunk*)((char*)_memory + RING_HEADER_SIZE);
+        return true;
+    }
+
+    _chunkMemory = mmap(NULL, _chunkMemorySize, PROT_READ, MAP_SHARED, fd, RING_HEADER_SIZE);
+    if (_chunkMemory == MAP_FAILED)
+    {
+        _chunkMemory = nullptr;
+        LOG_ERROR("Failed to map shared broadcast ring");
+        return false;
+    }
+
+    _chunks = (RingChunk*)_chunkMemory;
+    return true;
+}
+
+int BroadcastRing::OpenReadOnly() const
+{
+    if (_fd < 0)
+        return -1;
+
+    // a file description of its own, mmap() refuses it PROT_WRITE
+    std::string path = "/proc/self/fd/" + std::to_string(_fd);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        LOG_ERROR("Failed to open shared broadcast ring read only");
+        return -1;
+    }
+
+    _hasReadOnlyReaders = true;
+    return fd;
+}
+
+bool BroadcastRing::Adopt(int fd)
+{
+    _fd = fd;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < RING_HEADER_SIZE)
+    {
+        LOG_ERROR("Shared broadcast ring is too small");
+        return false;
+    }
+
+    _memorySize = st.st_size;
+    _memory = mmap(NULL, _memorySize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (_memory == MAP_FAILED)
+    {
+        _memory = nullptr;
+        LOG_ERROR("Failed to map shared broadcast ring");
+        return false;
+    }
+
+    _header = (RingHeader*)_memory;
+    _chunkCount = _header->chunkCount;
+    if (_header->magic != RING_MAGIC || _chunkCount == 0 ||
+        _memorySize < RING_HEADER_SIZE + _chunkCount * sizeof(RingChunk))
+    {
+        LOG_ERROR("Invalid shared broadcast ring");
+        return false;
+    }
+
+    _chunks = (RingChunk*)((char*)_memory + RING_HEADER_SIZE);
+    return true;
+}
+
+RingChunk* BroadcastRing::BeginWrite()
+{
+    uint64_t seq = _header->writeSeq.load(std::memory_order_relaxed);
+    RingChunk* chunk = &_chunks[seq % _chunkCount];
+
+    // invalidate chunk before touching data, readers copying it will notice
+    chunk->seq.store(RING_SEQ_BUSY, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return chunk;
+}
+
+void BroadcastRing::CommitWrite(uint32_t size, uint32_t flags, int64_t pcr)
+{
+    uint64_t seq = _header->writeSeq.load(std::memory_order_relaxed);
+    uint64_t pos = _header->writePos.load(std::memory_order_relaxed);
+    RingChunk* chunk = &_chunks[seq % _chunkCount];
+
+    chunk->size = size;
+    chunk->flags = flags;
+    chunk->pos = pos;
+    chunk->pcr = pcr;
+    chunk->seq.store(seq, std::memory_order_release);
+    _header->writePos.store(pos + size, std::memory_order_relaxed);
+    _header->writeSeq.store(seq + 1, std::memory_order_release);
+
+    // costs a syscall only when someone is actually asleep, or might be
+    _header->notify.fetch_add(1, std::memory_order_seq_cst);
+    if (_hasReadOnlyReaders || _header->waiters.load(std::memory_order_seq_cst) > 0)
+        futex(&_header->notify, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+uint64_t BroadcastRing::GetWriteSeq() const
+{
+    return _header->writeSeq.load(std::memory_order_acquire);
+}
+
+bool BroadcastRing::IsOverrun(uint64_t seq) const
+{
+    // the chunk being written next is also unsafe to read
+    return GetWriteSeq() - seq >= _chunkCount;
+}
+
+uint64_t BroadcastRing::GetBytesSince(uint64_t seq) const
+{
+    if (seq >= GetWriteSeq())
+        return 0;
+
+    // chunk may be reused under us, the estimate is off for a chunk then
+    uint64_t writePos = _header->writePos.load(std::memory_order_relaxed);
+    uint64_t pos = GetChunk(seq)->pos;
+    return writePos > pos ? writePos - pos : 0;
+}
+
+RingChunk const* BroadcastRing::GetChunk(uint64_t seq) const
+{
+    return &_chunks[seq % _chunkCount];
+}
+
+bool BroadcastRing::Read(uint64_t seq, char* buffer, uint32_t& size, uint32_t& flags,
+    uint64_t* pos) const
+{
+    RingChunk const* chunk = GetChunk(seq);
+    if (chunk->seq.load(std::memory_order_acquire) != seq)
+        return false;
+
+    size = chunk->size;
+    flags = chunk->flags;
+    if (pos)
+        *pos = chunk->pos;
+    if (size > RING_CHUNK_SIZE)
+        return false;
+
+    memcpy(buffer, chunk->data, size);
+
+    // seqlock validation, chunk must not have been reused during the copy
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return chunk->seq.load(std::memory_order_relaxed) == seq;
+}
+
+uint64_t BroadcastRing::FindKeyframe(uint64_t seq) const
+{
+    uint64_t writeSeq = GetWriteSeq();
+    if (writeSeq == 0)
+        return UINT64_MAX;
+
+    seq = std::min(seq, writeSeq - 1);
+    for (; !IsOverrun(seq); --seq)
+    {
+        RingChunk const* chunk = GetChunk(seq);
+        if (chunk->seq.load(std::memory_order_acquire) != seq)
+            return UINT64_MAX;
+
+        uint32_t flags = chunk->flags;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (chunk->seq.load(std::memory_order_relaxed) != seq)
+            return UINT64_MAX;
+
+        if (flags & RING_FLAG_KEYFRAME)
+            return seq;
+
+        if (seq == 0)
+            break;
+    }
+
+    return UINT64_MAX;
+}
+
+bool BroadcastRing::WaitForData(uint64_t seq, int timeoutMs) const
+{
+    uint32_t notify = _header->notify.load(std::memory_order_seq_cst);
+    if (GetWriteSeq() > seq)
+        return true;
+
+    // writer bumps notify after writeSeq, so a write in between fails the wait right away
+    timespec timeout;
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+    if (!_isReadOnly)
+        _header->waiters.fetch_add(1, std::memory_order_seq_cst);
+    futex(&_header->notify, FUTEX_WAIT, notify, &timeout);
+    if (!_isReadOnly)
+        _header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+    return GetWriteSeq() > seq;
+}
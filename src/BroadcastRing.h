@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "BufferArena.h"
+
+// 22 TS packets, same chunk size ffmpeg data has always been relayed in
+// chunks can be shorter, see FailoverSource::Read()
+#define RING_CHUNK_SIZE 4136
+// header gets a page of its own, so other processes can map chunks read only
+#define RING_HEADER_SIZE 4096
+#define RING_MAGIC 0x32474E5253534949ULL // "IISSRNG2"
+
+// chunk flags
+#define RING_FLAG_KEYFRAME 0x1 // chunk starts with a video keyframe
+
+struct RingChunk
+{
+    // sequence number of the data currently in the chunk
+    // set to RING_SEQ_BUSY while the producer is writing it
+    std::atomic<uint64_t> seq;
+    uint32_t size;
+    uint32_t flags;
+    // stream offset of the first byte, i.e bytes written before it
+    uint64_t pos;
+    // first PCR in the chunk (27MHz), -1 if it has none
+    int64_t pcr;
+    char data[RING_CHUNK_SIZE];
+};
+
+struct RingHeader
+{
+    uint64_t magic;
+    std::atomic<uint64_t> writeSeq;
+    // bytes written so far
+    std::atomic<uint64_t> writePos;
+    uint64_t chunkCount;
+    // futex word bumped on each write, and how many readers sleep on it
+    std::atomic<uint32_t> notify;
+    std::atomic<uint32_t> waiters;
+};
+
+// Single producer broadcast buffer of fixed size chunks
+// The streamer main loop is the only producer, consumers (fan-out, DVR, ...)
+// each keep their own sequence cursor, so a slow consumer never blocks the
+// producer, it just gets overrun and has to skip ahead.
+// Consumers in other threads must use Read(), which validates the chunk
+// wasn't overwritten while being copied.
+// The ring can also live in a memfd, to be mapped by other processes on the
+// host (see SourceBus), which read it in place and can sleep on a futex
+// until new data is written.
+class BroadcastRing
+{
+public:
+    BroadcastRing();
+    ~BroadcastRing();
+
+    // storage comes from arena if given, i.e huge pages on the right NUMA node
+    bool Initialize(size_t chunkCount, BufferArena* arena = nullptr);
+    // memfd backed, fd can be handed to other processes
+    bool InitializeShared(size_t chunkCount, std::string const& name,
+        BufferArena* arena = nullptr);
+    // maps a ring shared by another process, takes fd ownership
+    // chunks are mapped read only, it's consumer side only, and so is the
+    // header if fd is read only, see OpenReadOnly()
+    bool Attach(int fd);
+    // producer side of a ring another process wrote until now, e.g on hot
+    // restart, contents and cursors are kept as they are, takes fd ownership
+    bool Adopt(int fd);
+    int GetFd() const { return _fd; }
+    // read only fd of a shared ring, for consumers in other processes, -1 if it
+    // can't be opened; they can't register as futex waiters, so from then on
+    // every write wakes the futex
+    int OpenReadOnly() const;
+
+    // producer side
+    RingChunk* BeginWrite();
+    void CommitWrite(uint32_t size, uint32_t flags, int64_t pcr = -1);
+
+    // consumer side
+    uint64_t GetWriteSeq() const;
+    size_t GetChunkCount() const { return _chunkCount; }
+    bool IsOverrun(uint64_t seq) const;
+    // bytes written from chunk seq on, 0 if it's not written yet
+    uint64_t GetBytesSince(uint64_t seq) const;
+    RingChunk const* GetChunk(uint64_t seq) const;
+    // pos, if given, gets the chunk's stream offset
+    bool Read(uint64_t seq, char* buffer, uint32_t& size, uint32_t& flags,
+        uint64_t* pos = nullptr) const;
+    // newest chunk flagged RING_FLAG_KEYFRAME at or before seq
+    // UINT64_MAX if there's none left in the ring
+    uint64_t FindKeyframe(uint64_t seq) const;
+    // sleeps until there's a chunk past seq or timeout expires, true if there is
+    bool WaitForData(uint64_t seq, int timeoutMs) const;
+    // chunks are contiguous, e.g to be registered as io_uring fixed buffers
+    void const* GetChunkMemory() const { return _chunks; }
+    size_t GetChunkMemorySize() const { return _chunkCount * sizeof(RingChunk); }
+
+private:
+    // isHuge: fd is a hugetlb memfd, mapped in whole huge pages
+    bool Map(size_t chunkCount, int fd, BufferArena* arena, bool isHuge);
+
+private:
+    int _fd = -1;
+    bool _isReadOnly = false;
+    mutable bool _hasReadOnlyReaders = false;
+    void* _memory = nullptr;
+    size_t _memorySize = 0;
+    // attached rings map chunks separately from the header
+    void* _chunkMemory = nullptr;
+    size_t _chunkMemorySize = 0;
+    RingHeader* _header = nullptr;
+    RingChunk* _chunks = nullptr;
+    size_t _chunkCount = 0;
+};
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <linux/perf_event.h>
+
+#include "BufferArena.h"
+#include "Util.h"
+
+static size_t roundUp(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+BufferArena::~BufferArena()
+{
+    if (_perfFd >= 0)
+        close(_perfFd);
+}
+
+bool BufferArena::Initialize(std::string const& node)
+{
+    // binding is pointless on single node hosts
+    if (access("/sys/devices/system/node/node1", F_OK) == 0)
+        _node = FindNode(node);
+
+    if (_node >= 0)
+        LOG_INFO("Stream buffers bound to NUMA node %d", _node);
+
+    // counts threads started from here on too
+    OpenPerfCounter();
+    return true;
+}
+
+int BufferArena::FindNode(std::string const& node)
+{
+    if (node == "auto")
+    {
+        unsigned cpu = 0;
+        unsigned nodeId = 0;
+        if (syscall(SYS_getcpu, &cpu, &nodeId, NULL) < 0)
+            return -1;
+
+        return nodeId;
+    }
+
+    if (!node.empty() && isdigit(node[0]))
+        return atoi(node.c_str());
+
+    // NIC, as sysfs knows it, -1 if it's not attached to any node in particular
+    std::ifstream file("/sys/class/net/" + node + "/device/numa_node");
+    int nodeId = -1;
+    if (!(file >> nodeId))
+        LOG_ERROR("Can't find NUMA node of %s", node.c_str());
+
+    return nodeId;
+}
+
+void* BufferArena::Map(size_t& size)
+{
+    // hugetlb pages are only there if the host reserved some
+    size_t hugeSize = roundUp(size, ARENA_HUGE_PAGE_SIZE);
+    void* memory = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED)
+    {
+        // bound before first touch, pages are placed when faulted in
+        Bind(memory, hugeSize);
+        size = hugeSize;
+        _hugeBytes += hugeSize;
+        ++_mapCount;
+        return memory;
+    }
+
+    // otherwise regular pages, aligned so the kernel can back them with
+    // transparent huge pages
+    size_t mapSize = hugeSize + ARENA_HUGE_PAGE_SIZE;
+    char* map = (char*)mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        return nullptr;
+
+    char* aligned = (char*)roundUp((size_t)map, ARENA_HUGE_PAGE_SIZE);
+    if (aligned > map)
+        munmap(map, aligned - map);
+    if (aligned + hugeSize < map + mapSize)
+        munmap(aligned + hugeSize, map + mapSize - (aligned + hugeSize));
+
+    Advise(aligned, hugeSize);
+    size = hugeSize;
+    _regularBytes += hugeSize;
+    ++_mapCount;
+    return aligned;
+}
+
+void BufferArena::Advise(void* memory, size_t size)
+{
+    // only a hint, e.g THP may be disabled for shared memory
+    madvise(memory, size, MADV_HUGEPAGE);
+    Bind(memory, size);
+}
+
+void BufferArena::Bind(void* memory, size_t size)
+{
+    if (_node < 0 || !_canBind)
+        return;
+
+    unsigned long nodeMask[16];
+    memset(nodeMask, 0, sizeof(nodeMask));
+    if (_node >= (int)(sizeof(nodeMask) * 8))
+        return;
+
+    nodeMask[_node / (sizeof(long) * 8)] |= 1UL << (_node % (sizeof(long) * 8));
+    if (syscall(SYS_mbind, memory, size, MPOL_PREFERRED, nodeMask,
+                sizeof(nodeMask) * 8, 0) < 0)
+    {
+        // e.g filtered out by container seccomp profiles, no point retrying
+        LOG_INFO("Can't bind stream buffers to NUMA node %d: %s", _node, strerror(errno));
+        _canBind = false;
+    }
+}
+
+void BufferArena::OpenPerfCounter()
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.inherit = 1;
+    // user space only, allowed at the default perf_event_paranoid level
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    _perfFd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (_perfFd < 0)
+        LOG_INFO("dTLB miss counter unavailable: %s", strerror(errno));
+}
+
+int64_t BufferArena::GetDtlbMisses() const
+{
+    uint64_t value = 0;
+    if (_perfFd < 0 || read(_perfFd, &value, sizeof(value)) != sizeof(value))
+        return -1;
+
+    return value;
+}
+
+ArenaPool::~ArenaPool()
+{
+    if (_memory)
+        munmap(_memory, _mapSize);
+}
+
+bool ArenaPool::Initialize(BufferArena& arena, size_t blockSize, size_t blockCount)
+{
+    _mapSize = blockSize * blockCount;
+    _memory = (char*)arena.Map(_mapSize);
+    if (!_memory)
+    {
+        LOG_ERROR("Failed to map %zu buffer blocks", blockCount);
+        return false;
+    }
+
+    _arena = &arena;
+    _blockSize = blockSize;
+    _blockCount = blockCount;
+
+    // all blocks start out free, in order
+    _next.reset(new std::atomic<uint32_t>[blockCount]);
+    for (size_t i = 0; i < blockCount; ++i)
+        _next[i].store(i + 1 < blockCount ? i + 2 : 0);
+
+    _head.store(blockCount > 0 ? 1 : 0);
+    return true;
+}
+
+void* ArenaPool::Allocate()
+{
+    uint64_t head = _head.load(std::memory_order_acquire);
+    while (true)
+    {
+        uint32_t first = (uint32_t)head;
+        if (first == 0)
+        {
+            ++_arena->_poolExhausted;
+            return nullptr;
+        }
+
+        uint64_t tag = (head >> 32) + 1;
+        uint32_t next = _next[first - 1].load(std::memory_order_relaxed);
+        if (_head.compare_exchange_weak(head, tag << 32 | next,
+                                        std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            ++_arena->_poolAllocations;
+            return _memory + (first - 1) * _blockSize;
+        }
+    }
+}
+
+void ArenaPool::Free(void* block)
+{
+    uint32_t index = GetIndex(block);
+    uint64_t head = _head.load(std::memory_order_relaxed);
+    while (true)
+    {
+        _next[index].store((uint32_t)head, std::memory_order_relaxed);
+
+        uint64_t tag = (head >> 32) + 1;
+        if (_head.compare_exchange_weak(head, tag << 32 | (index + 1),
+                                        std::memory_order_release, std::memory_order_relaxed))
+            return;
+    }
+}
+
+size_t ArenaPool::GetIndex(void const* block) const
+{
+    return ((char const*)block - _memory) / _blockSize;
+}
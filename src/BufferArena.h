@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <memory>
+
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Memory for stream buffers (broadcast ring, DVR window, recording blocks)
+// Mappings come from 2MB huge pages when the host has some reserved
+// (vm.nr_hugepages), transparent huge pages otherwise, so a host holding
+// gigabytes of buffers doesn't spend its TLB on them. They're also bound to
+// a NUMA node: the one of a given NIC, a given node, or the one Streamer
+// started on (e.g as placed by numactl).
+// Binding is only a preference, memory still comes from other nodes when
+// the preferred one is full. dTLB misses of the whole process are counted
+// through perf where it's allowed, to see what huge pages buy.
+class BufferArena
+{
+public:
+    BufferArena() : _hugeBytes(0), _regularBytes(0), _mapCount(0),
+        _poolAllocations(0), _poolExhausted(0) { }
+    ~BufferArena();
+
+    // node is a NUMA node number, a network interface name whose node is
+    // used, or "auto" for the node we're running on
+    bool Initialize(std::string const& node);
+    int GetNode() const { return _node; }
+
+    // private anonymous mapping, size is rounded up to what was mapped
+    // caller munmaps it as usual
+    void* Map(size_t& size);
+    // for mappings made elsewhere, e.g shared memfds and files
+    // asks for transparent huge pages and binds them to our node
+    void Advise(void* memory, size_t size);
+    // counts such mappings in the stats
+    void Account(size_t size, bool isHuge) { (isHuge ? _hugeBytes : _regularBytes) += size; ++_mapCount; }
+
+    // stats
+    uint64_t GetHugeBytes() const { return _hugeBytes; }
+    uint64_t GetRegularBytes() const { return _regularBytes; }
+    uint64_t GetMapCount() const { return _mapCount; }
+    uint64_t GetPoolAllocations() const { return _poolAllocations; }
+    uint64_t GetPoolExhausted() const { return _poolExhausted; }
+    // -1 if perf counters aren't available
+    int64_t GetDtlbMisses() const;
+
+private:
+    friend class ArenaPool;
+
+    static int FindNode(std::string const& node);
+    void Bind(void* memory, size_t size);
+    void OpenPerfCounter();
+
+private:
+    int _node = -1;
+    bool _canBind = true;
+    int _perfFd = -1;
+
+    std::atomic<uint64_t> _hugeBytes;
+    std::atomic<uint64_t> _regularBytes;
+    std::atomic<uint64_t> _mapCount;
+    std::atomic<uint64_t> _poolAllocations;
+    std::atomic<uint64_t> _poolExhausted;
+};
+
+// Fixed size blocks out of one arena mapping, recycled through a lock-free
+// freelist, so blocks can be taken and given back from any thread
+// (e.g an I/O completion) without locking.
+class ArenaPool
+{
+public:
+    ArenaPool() : _head(0) { }
+    ~ArenaPool();
+
+    // blocks are page aligned if blockSize is a multiple of the page size
+    bool Initialize(BufferArena& arena, size_t blockSize, size_t blockCount);
+
+    // nullptr if all blocks are taken
+    void* Allocate();
+    void Free(void* block);
+
+    // blocks are numbered, e.g to keep descriptors alongside
+    size_t GetIndex(void const* block) const;
+    size_t GetBlockCount() const { return _blockCount; }
+
+private:
+    BufferArena* _arena = nullptr;
+    char* _memory = nullptr;
+    size_t _mapSize = 0;
+    size_t _blockSize = 0;
+    size_t _blockCount = 0;
+
+    // freelist links, index + 1 of the next free block, 0 ends the list
+    std::unique_ptr<std::atomic<uint32_t>[]> _next;
+    // tag << 32 | index + 1 of first free block, tag is bumped on each
+    // change so a stale compare and swap can't succeed (ABA)
+    std::atomic<uint64_t> _head;
+};
@@ -16,7 +16,20 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
+// for zapping
+#include <set>
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <netinet/tcp.h>
+
 #include "Client.h"
+#include "ClientTable.h"
+#include "HealthAnalyzer.h"
+#include "SourceBus.h"
+#include "TSParser.h"
 #include "Util.h"
 
 #include <IceStorm/IceStorm.h>
@@ -24,6 +37,13 @@
 
 #define BUFFER_SIZE 4136
 //256
+#define ZAP_RECENT_COUNT 2  // streams zapped from kept on standby
+#define ZAP_TIMEOUT 5000    // ms a zap waits for data
+#define JOIN_TIMEOUT 5000   // ms a join waits for a keyframe
+#define JOIN_ATTEMPT_DELAY 250  // ms before racing the next replica
+#define JOIN_PEEK_SIZE 65536
+#define STANDBY_TIMEOUT 500  // ms standby connections get to be made
+#define UDP_LOSS_INTERVAL 5000  // ms between UDP loss reports
 
 using namespace StreamingService;
 
@@ -93,6 +113,7 @@ int CLIClient::run(int argc, char* argv[])
 
     // run command loop
     RunCommands();
+    StopZapping();
 
     topic->unsubscribe(subscriber);
     return 0;
@@ -107,8 +128,8 @@ void CLIClient::StreamAdded(StreamEntry const& entry)
         LOG_INFO("[INFO] Stream added: '%s'", name.c_str());
         _streams[name] = entry;
     }
-    else
-        LOG_ERROR("stream %s already exists", name.c_str());
+    else // replica came or went
+        itr->second = entry;
 }
 
 void CLIClient::StreamRemoved(StreamEntry const& entry)
@@ -154,6 +175,12 @@ void CLIClient::RunCommands()
             LOG_INFO(" --detail           - shows stream endpoint/keywords");
             LOG_INFO("search $keywords    - list for streams with matching keywords");
             LOG_INFO("play $stream_name   - play stream with matching name");
+            LOG_INFO("                    - streams on this host are played from shared memory");
+            LOG_INFO("timeshift $seconds $stream_name");
+            LOG_INFO("                    - play stream $seconds behind live, needs a DVR window");
+            LOG_INFO("zap $stream_name    - switch to stream in zapping mode, one player for all");
+            LOG_INFO("next/prev           - zap to next/previous stream in the list");
+            LOG_INFO("stats               - print join/zap times and replicas picked");
             LOG_INFO("exit/quit           - quits the cli");
         }
         else if (command == "list")
@@ -173,6 +200,12 @@ void CLIClient::RunCommands()
                 if (inDetail)
                 {
                     LOG_INFO("EndPoint: %s", entry.endpoint.c_str());
+                    for (std::string const& replica : entry.replicas)
+                        LOG_INFO("Replica EndPoint: %s", replica.c_str());
+                    if (!entry.dvrEndpoint.empty())
+                        LOG_INFO("DVR EndPoint: %s", entry.dvrEndpoint.c_str());
+                    if (!entry.localEndpoint.empty())
+                        LOG_INFO("Local EndPoint: %s", entry.localEndpoint.c_str());
                     for (std::string const& entryKeyword : entry.keyword)
                         LOG_INFO("Keyword: %s", entryKeyword.c_str());
                 }
@@ -216,7 +249,11 @@ void CLIClient::RunCommands()
             std::getline(iss, streamName);
 
             auto itr = _streams.find(streamName);
-            if (itr != _streams.end())
+            if (itr != _streams.end() && PlayLocal(itr->second))
+            {
+                LOG_INFO("Playing '%s' from shared memory", streamName.c_str());
+            }
+            else if (itr != _streams.end())
             {
                 StreamEntry const& entryToPlay = itr->second;
                 { // Check if the transport is udp
@@ -262,18 +299,25 @@ void CLIClient::RunCommands()
                     }
                 }
                 }
+                // TCP is raced across replicas, ffplay reads the winner from its stdin
+                int joinFd = isTcp ? Join(entryToPlay) : -1;
                 // launch ffplay instance
-                if (fork() == 0)
+                if ((!isTcp || joinFd >= 0) && fork() == 0)
                 {
                     if (isTcp)
                     {
+                        dup2(joinFd, STDIN_FILENO);
+                        close(joinFd);
+
                         // but redirect ffplay output to /dev/null
                         int fd = open("/dev/null", O_WRONLY);
                         dup2(fd, STDOUT_FILENO);
                         dup2(fd, STDERR_FILENO);
                         close(fd);
 
-                        execlp("ffplay", "ffplay", entryToPlay.endpoint.c_str(), NULL);
+                        execlp("ffplay", "ffplay", "-window_title", streamName.c_str(),
+                               "pipe:0", NULL);
+                        _exit(1);
                     }
                     else // udp
                     {
@@ -314,23 +358,99 @@ void CLIClient::RunCommands()
                         }
                         LOG_INFO("Connected to ffplay, fd = %d\n", newFD);
 
+                        // loss is measured here, where it happens, from continuity gaps
+                        HealthAnalyzer health;
+                        uint64_t loggedErrors = 0;
+                        long lastLogMs = getMSTime();
+
                         bzero(buf,BUFFER_SIZE);
                         while (1)
                         {
                             ssize_t n = recvfrom(udpSocket, buf, BUFFER_SIZE, 0, (struct sockaddr *)&udpAddr, (socklen_t*)&len);
                             if (n <= 0)
                                 break;
-                            write (newFD, buf, n);
+                            // ffplay only gets synced, whole packets, not stray datagrams
+                            size_t synced = tsCountSynced((uint8_t const*)buf, n / TS_PACKET_SIZE);
+                            if (synced > 0)
+                            {
+                                health.Analyze((uint8_t const*)buf, synced * TS_PACKET_SIZE, getMSTime());
+                                write (newFD, buf, synced * TS_PACKET_SIZE);
+                            }
                             bzero(buf,BUFFER_SIZE);
+
+                            // only worth a log line if something was lost
+                            HealthStats const& stats = health.GetStats();
+                            long nowMs = getMSTime();
+                            if (nowMs - lastLogMs >= UDP_LOSS_INTERVAL && stats.ccErrors != loggedErrors)
+                            {
+                                LOG_INFO("UDP '%s': %lu packets, %lu lost (%.2f%%) in %lu continuity errors",
+                                    streamName.c_str(), (unsigned long)stats.packets,
+                                    (unsigned long)stats.lostPackets,
+                                    100.0 * stats.lostPackets / (stats.packets + stats.lostPackets),
+                                    (unsigned long)stats.ccErrors);
+                                loggedErrors = stats.ccErrors;
+                                lastLogMs = nowMs;
+                            }
                         }
                     }
                 }
+
+                if (joinFd >= 0)
+                    close(joinFd);
             }
             else
             {
                 LOG_INFO("Stream '%s' not found", streamName.c_str());
             }
         }
+        else if (command == "timeshift")
+        {
+            std::string seconds;
+            std::getline(iss, seconds, ' ');
+            std::string streamName;
+            std::getline(iss, streamName);
+
+            auto itr = _streams.find(streamName);
+            if (itr == _streams.end())
+                LOG_INFO("Stream '%s' not found", streamName.c_str());
+            else if (itr->second.dvrEndpoint.empty())
+                LOG_INFO("Stream '%s' has no DVR window", streamName.c_str());
+            else
+            {
+                std::string url = itr->second.dvrEndpoint +
+                    "?timeshift=" + std::to_string(atol(seconds.c_str()));
+
+                // launch ffplay instance, DVR endpoint is plain HTTP
+                if (fork() == 0)
+                {
+                    // but redirect ffplay output to /dev/null
+                    int fd = open("/dev/null", O_WRONLY);
+                    dup2(fd, STDOUT_FILENO);
+                    dup2(fd, STDERR_FILENO);
+                    close(fd);
+
+                    execlp("ffplay", "ffplay", url.c_str(), NULL);
+                }
+            }
+        }
+        else if (command == "zap")
+        {
+            std::string streamName;
+            std::getline(iss, streamName);
+            Zap(streamName);
+        }
+        else if (command == "next" || command == "prev")
+        {
+            std::string streamName = GetNeighbor(_zapStream, command == "next" ? 1 : -1);
+            if (streamName.empty())
+                LOG_INFO("No stream to zap to");
+            else
+                Zap(streamName);
+        }
+        else if (command == "stats")
+        {
+            PrintStats();
+        }
         else if (command == "quit" || command == "exit")
         {
             LOG_INFO("Exiting...");
@@ -344,3 +464,503 @@ void CLIClient::RunCommands()
         }
     }
 }
+
+bool CLIClient::PlayLocal(StreamEntry const& entry)
+{
+    std::string const prefix = "shm://";
+    if (entry.localEndpoint.compare(0, prefix.size(), prefix) != 0)
+        return false;
+
+    // only works if the streamer is on this host, regular endpoint is used otherwise
+    BroadcastRing ring;
+    SourceBus bus;
+    if (!bus.Subscribe(ring, entry.localEndpoint.substr(prefix.size())))
+    {
+        LOG_INFO("Stream isn't on this host, using %s", entry.endpoint.c_str());
+        return false;
+    }
+
+    int fds[2];
+    if (pipe(fds) < 0)
+        return false;
+
+    // ring mapping and bus connection are inherited, they're ours to close here
+    if (fork() == 0)
+    {
+        // follow the ring, ffplay reads it from a pipe on its stdin
+        if (fork() == 0)
+        {
+            close(fds[1]);
+            dup2(fds[0], STDIN_FILENO);
+            close(fds[0]);
+
+            // but redirect ffplay output to /dev/null
+            int fd = open("/dev/null", O_WRONLY);
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+
+            execlp("ffplay", "ffplay", "pipe:0", NULL);
+            _exit(1);
+        }
+
+        close(fds[0]);
+
+        // ends with the stream, or when ffplay is closed
+        // copied out first, a chunk overwritten half way through is dropped
+        // rather than piped to ffplay torn
+        bool exitFlag = false;
+        char buffer[RING_CHUNK_SIZE];
+        while (bus.Next(exitFlag))
+        {
+            uint32_t size = 0;
+            if (bus.Read(buffer, size) && write(fds[1], buffer, size) < 0)
+                break;
+
+            bus.Release();
+        }
+
+        _exit(0);
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+    return true;
+}
+
+// address of a "tcp://host:port" endpoint, null if it isn't one, caller frees it
+static addrinfo* resolve(std::string const& endpoint)
+{
+    std::string const prefix = "tcp://";
+    size_t colon = endpoint.rfind(':');
+    if (endpoint.compare(0, prefix.size(), prefix) != 0 || colon < prefix.size())
+        return nullptr;
+
+    std::string host = endpoint.substr(prefix.size(), colon - prefix.size());
+    std::string port = endpoint.substr(colon + 1);
+    port = port.substr(0, port.find('/'));
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addrs = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs) != 0)
+        return nullptr;
+
+    return addrs;
+}
+
+static bool sendControl(int fd, char control)
+{
+    return send(fd, &control, 1, MSG_NOSIGNAL) == 1;
+}
+
+// connect started, non-blocking, -1 if it couldn't be
+// close on exec, only ffplay reading it from stdin (dup2 clears that) gets it
+static int connectAsync(std::string const& endpoint)
+{
+    addrinfo* addrs = resolve(endpoint);
+    if (!addrs)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, addrs->ai_addr, addrs->ai_addrlen) < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(addrs);
+
+    // control bytes go out as soon as they're written
+    int setVal = 1;
+    if (fd >= 0)
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &setVal, sizeof(setVal));
+
+    return fd;
+}
+
+// Happy eyeballs across the stream's replicas, best first as the Portal ranks
+// them: a connection is started every JOIN_ATTEMPT_DELAY ms, or as soon as the
+// last one failed, so a dead or slow replica costs a fraction of a second
+// rather than a timeout. The first one to deliver a keyframe wins, what came
+// before it is dropped and the rest are closed.
+// Received data is only peeked at until then, in whole packets, so the winner
+// is left positioned at the keyframe for ffplay to read.
+int CLIClient::Join(StreamEntry const& entry)
+{
+    std::vector<std::string> endpoints(1, entry.endpoint);
+    endpoints.insert(endpoints.end(), entry.replicas.begin(), entry.replicas.end());
+
+    // attempts in flight, replicas[i] is what pfds[i] connects to
+    std::vector<pollfd> pfds;
+    std::vector<size_t> replicas;
+    size_t next = 0;
+    int winner = -1;
+    size_t winnerReplica = 0;
+    std::vector<uint8_t> buf(JOIN_PEEK_SIZE);
+
+    long startMs = getMSTime();
+    long nextAttemptMs = startMs;
+    while (winner < 0)
+    {
+        long nowMs = getMSTime();
+        if (nowMs - startMs >= JOIN_TIMEOUT)
+            break;
+
+        if (next < endpoints.size() && (nowMs >= nextAttemptMs || pfds.empty()))
+        {
+            int fd = connectAsync(endpoints[next]);
+            if (fd >= 0)
+            {
+                pollfd pfd;
+                pfd.fd = fd;
+                pfd.events = POLLOUT;
+                pfd.revents = 0;
+                pfds.push_back(pfd);
+                replicas.push_back(next);
+            }
+
+            ++next;
+            nextAttemptMs = nowMs + JOIN_ATTEMPT_DELAY;
+            continue;
+        }
+
+        // every replica failed
+        if (pfds.empty())
+            break;
+
+        long timeout = JOIN_TIMEOUT - (nowMs - startMs);
+        if (next < endpoints.size())
+            timeout = std::min(timeout, nextAttemptMs - nowMs);
+        if (poll(pfds.data(), pfds.size(), timeout) < 0 && errno != EINTR)
+            break;
+
+        for (size_t i = 0; i < pfds.size() && winner < 0;)
+        {
+            bool isFailed = false;
+            if (pfds[i].revents == 0)
+                ;
+            else if (pfds[i].events == POLLOUT)
+            {
+                int error = 0;
+                socklen_t len = sizeof(error);
+                getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                isFailed = error != 0;
+
+                // no wake up until there's a whole packet to look at
+                int lowat = TS_PACKET_SIZE;
+                setsockopt(pfds[i].fd, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+                pfds[i].events = POLLIN;
+            }
+            else
+            {
+                ssize_t n = recv(pfds[i].fd, buf.data(), buf.size(), MSG_PEEK);
+                size_t size = n > 0 ? n / TS_PACKET_SIZE * TS_PACKET_SIZE : 0;
+                int offset = tsFindKeyframeStart(buf.data(), size);
+
+                // nothing before a keyframe can be played, it's dropped as it comes
+                ssize_t skip = offset >= 0 ? offset : size;
+                // closed with less than a packet left
+                bool isClosed = n <= 0 || (size == 0 && (pfds[i].revents & POLLHUP));
+                if (isClosed || (skip > 0 && recv(pfds[i].fd, buf.data(), skip, 0) != skip))
+                    isFailed = true;
+                else if (offset >= 0)
+                {
+                    winner = pfds[i].fd;
+                    winnerReplica = replicas[i];
+                    pfds.erase(pfds.begin() + i);
+                    replicas.erase(replicas.begin() + i);
+                    break;
+                }
+            }
+
+            if (isFailed)
+            {
+                close(pfds[i].fd);
+                pfds.erase(pfds.begin() + i);
+                replicas.erase(replicas.begin() + i);
+                // next replica's turn right away
+                nextAttemptMs = nowMs;
+            }
+            else
+                ++i;
+        }
+    }
+
+    for (pollfd const& pfd : pfds)
+        close(pfd.fd);
+
+    if (winner < 0)
+    {
+        LOG_INFO("No replica of '%s' delivered a keyframe", entry.streamName.c_str());
+        return -1;
+    }
+
+    // ffplay reads it as a regular blocking fd
+    int lowat = 1;
+    setsockopt(winner, SOL_SOCKET, SO_RCVLOWAT, &lowat, sizeof(lowat));
+    fcntl(winner, F_SETFL, fcntl(winner, F_GETFL) & ~O_NONBLOCK);
+
+    long joinMs = getMSTime() - startMs;
+    std::string const& endpoint = endpoints[winnerReplica];
+    ++_joinCount;
+    _joinTotalMs += joinMs;
+    ++_joinWins[endpoint];
+    LOG_INFO("Joined '%s' via %s (replica %zu of %zu) in %ld ms (%ld ms on average over %ld joins)",
+        entry.streamName.c_str(), endpoint.c_str(), winnerReplica + 1, endpoints.size(), joinMs,
+        _joinTotalMs / _joinCount, _joinCount);
+
+    return winner;
+}
+
+void CLIClient::PrintStats() const
+{
+    LOG_INFO("%ld joins, %ld ms on average", _joinCount,
+        _joinCount > 0 ? _joinTotalMs / _joinCount : 0);
+    for (auto const& itr : _joinWins)
+        LOG_INFO("- %s won %ld", itr.first.c_str(), itr.second);
+    LOG_INFO("%ld zaps, %ld ms on average", _zapCount,
+        _zapCount > 0 ? _zapTotalMs / _zapCount : 0);
+}
+
+bool CLIClient::Zap(std::string const& streamName)
+{
+    auto itr = _streams.find(streamName);
+    if (itr == _streams.end())
+    {
+        LOG_INFO("Stream '%s' not found", streamName.c_str());
+        return false;
+    }
+
+    if (streamName == _zapStream)
+        return true;
+
+    long startMs = getMSTime();
+
+    // a standby connection is already there, and the streamer starts it from
+    // its newest keyframe, no connect and no waiting for the next one
+    int fd = -1;
+    bool isWarm = false;
+    auto standby = _standbyFds.find(streamName);
+    if (standby != _standbyFds.end())
+    {
+        fd = standby->second;
+        _standbyFds.erase(standby);
+
+        // whatever came before it went standby is stale
+        char buf[BUFFER_SIZE];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+            ;
+
+        isWarm = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+            sendControl(fd, CLIENT_CONTROL_ACTIVATE);
+        if (!isWarm)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    if (isWarm)
+    {
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, ZAP_TIMEOUT) <= 0)
+        {
+            LOG_INFO("No data from '%s'", streamName.c_str());
+            close(fd);
+            return false;
+        }
+    }
+    // new viewers start from the newest keyframe too, just a connect later,
+    // to whichever replica is quickest
+    else if ((fd = Join(itr->second)) < 0)
+    {
+        LOG_INFO("Can't zap to '%s', only TCP streams can be", streamName.c_str());
+        return false;
+    }
+
+    long zapMs = getMSTime() - startMs;
+
+    // previous stream played until now, its connection goes standby
+    if (_ffplayPid > 0)
+    {
+        kill(_ffplayPid, SIGTERM);
+        waitpid(_ffplayPid, NULL, 0);
+    }
+
+    if (_zapFd >= 0)
+    {
+        if (sendControl(_zapFd, CLIENT_CONTROL_STANDBY))
+            _standbyFds[_zapStream] = _zapFd;
+        else
+            close(_zapFd);
+    }
+
+    _ffplayPid = fork();
+    if (_ffplayPid == 0)
+    {
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+        for (auto const& itr : _standbyFds)
+            close(itr.second);
+
+        // but redirect ffplay output to /dev/null
+        int nullFd = open("/dev/null", O_WRONLY);
+        dup2(nullFd, STDOUT_FILENO);
+        dup2(nullFd, STDERR_FILENO);
+        close(nullFd);
+
+        // data starts at a keyframe, so there's little to probe
+        execlp("ffplay", "ffplay", "-fflags", "nobuffer", "-probesize", "32768",
+               "-window_title", streamName.c_str(), "pipe:0", NULL);
+        _exit(1);
+    }
+
+    if (!_zapStream.empty())
+    {
+        _recentZaps.push_front(_zapStream);
+        if (_recentZaps.size() > ZAP_RECENT_COUNT)
+            _recentZaps.pop_back();
+    }
+
+    _zapStream = streamName;
+    _zapFd = fd;
+    ++_zapCount;
+    _zapTotalMs += zapMs;
+    LOG_INFO("Zapped to '%s' in %ld ms, %s (%ld ms on average over %ld zaps)",
+        streamName.c_str(), zapMs, isWarm ? "from standby" : "cold",
+        _zapTotalMs / _zapCount, _zapCount);
+
+    UpdateStandbys();
+    return true;
+}
+
+void CLIClient::UpdateStandbys()
+{
+    std::set<std::string> wanted(_recentZaps.begin(), _recentZaps.end());
+    wanted.insert(GetNeighbor(_zapStream, 1));
+    wanted.insert(GetNeighbor(_zapStream, -1));
+    wanted.erase("");
+    wanted.erase(_zapStream);
+
+    for (auto itr = _standbyFds.begin(); itr != _standbyFds.end();)
+    {
+        if (wanted.count(itr->first) == 0 || _streams.count(itr->first) == 0)
+        {
+            close(itr->second);
+            itr = _standbyFds.erase(itr);
+        }
+        else
+            ++itr;
+    }
+
+    // all connected at once, a slow or dead streamer doesn't hold up the zap
+    std::vector<pollfd> pfds;
+    std::vector<std::string> names;
+    for (std::string const& streamName : wanted)
+    {
+        auto itr = _streams.find(streamName);
+        if (itr == _streams.end() || _standbyFds.count(streamName) > 0)
+            continue;
+
+        int fd = connectAsync(itr->second.endpoint);
+        if (fd < 0)
+            continue;
+
+        pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        pfds.push_back(pfd);
+        names.push_back(streamName);
+    }
+
+    long startMs = getMSTime();
+    while (!pfds.empty())
+    {
+        long timeout = STANDBY_TIMEOUT - (getMSTime() - startMs);
+        if (timeout <= 0 || (poll(pfds.data(), pfds.size(), timeout) < 0 && errno != EINTR))
+            break;
+
+        for (size_t i = 0; i < pfds.size();)
+        {
+            if (pfds[i].revents == 0)
+            {
+                ++i;
+                continue;
+            }
+
+            int fd = pfds[i].fd;
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+
+            // ffplay reads it as a regular blocking fd once activated
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+            // streamer stops sending as soon as it reads this
+            if (error == 0 && sendControl(fd, CLIENT_CONTROL_STANDBY))
+                _standbyFds[names[i]] = fd;
+            else
+                close(fd);
+
+            pfds.erase(pfds.begin() + i);
+            names.erase(names.begin() + i);
+        }
+    }
+
+    // tried again on the next zap
+    for (pollfd const& pfd : pfds)
+        close(pfd.fd);
+}
+
+void CLIClient::StopZapping()
+{
+    if (_ffplayPid > 0)
+    {
+        kill(_ffplayPid, SIGTERM);
+        waitpid(_ffplayPid, NULL, 0);
+        _ffplayPid = -1;
+    }
+
+    if (_zapFd >= 0)
+        close(_zapFd);
+    _zapFd = -1;
+    _zapStream.clear();
+
+    for (auto const& itr : _standbyFds)
+        close(itr.second);
+    _standbyFds.clear();
+}
+
+std::string CLIClient::GetNeighbor(std::string const& streamName, int direction) const
+{
+    if (_streams.empty())
+        return "";
+
+    // wraps around, same order as list
+    auto itr = _streams.find(streamName);
+    if (itr == _streams.end())
+        return _streams.begin()->first;
+
+    if (direction > 0)
+    {
+        ++itr;
+        if (itr == _streams.end())
+            itr = _streams.begin();
+    }
+    else
+    {
+        if (itr == _streams.begin())
+            itr = _streams.end();
+        --itr;
+    }
+
+    return itr->first == streamName ? "" : itr->first;
+}
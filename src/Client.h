@@ -1,5 +1,8 @@
 #include <string>
 #include <map>
+#include <deque>
+#include <vector>
+#include <sys/types.h>
 
 #include <Ice/Ice.h>
 #include "PortalInterface.h"
@@ -20,9 +23,36 @@ public:
 
 private:
     void RunCommands();
+    bool PlayLocal(StreamEntry const& entry);
+    // connection to the stream, raced across its replicas, positioned at a
+    // keyframe, -1 if none delivered one
+    int Join(StreamEntry const& entry);
+    void PrintStats() const;
+
+    // zapping mode, one ffplay at a time, reading straight from the connection
+    // to the stream being watched, with standby connections kept to the streams
+    // next to it in the list and the ones watched last
+    bool Zap(std::string const& streamName);
+    void UpdateStandbys();
+    void StopZapping();
+    // next (direction 1) or previous (-1) stream in the list, empty if none
+    std::string GetNeighbor(std::string const& streamName, int direction) const;
 
 private:
     std::map<std::string, StreamEntry> _streams;
+
+    std::string _zapStream;
+    int _zapFd = -1;
+    pid_t _ffplayPid = -1;
+    std::map<std::string, int> _standbyFds;
+    std::deque<std::string> _recentZaps;
+    long _zapCount = 0;
+    long _zapTotalMs = 0;
+
+    long _joinCount = 0;
+    long _joinTotalMs = 0;
+    // joins won, by endpoint
+    std::map<std::string, long> _joinWins;
 };
 
 class StreamNotifier : public StreamNotifierInterface
@@ -0,0 +1,81 @@
+#include <stdint.h>
+
+#include "ClientTable.h"
+
+size_t ClientTable::Add(int fd, sockaddr_in const& addr, uint64_t seq, long nowMs,
+                        uint8_t rendition)
+{
+    size_t index = _fds.size();
+    _fds.push_back(fd);
+    _addrs.push_back(addr);
+    _seqs.push_back(seq);
+    _offsets.push_back(0);
+    _renditions.push_back(rendition);
+    _flags.push_back(0);
+    _sentBytes.push_back(0);
+    _joinedMs.push_back(nowMs);
+    _tcpInfos.push_back(ClientTcpInfo());
+    _switchedMs.push_back(nowMs);
+
+    if (fd < 0)
+        _addrIndex[GetKey(addr)] = index;
+
+    return index;
+}
+
+void ClientTable::Remove(size_t index)
+{
+    if (_fds[index] < 0)
+        _addrIndex.erase(GetKey(_addrs[index]));
+
+    // last client takes the removed one's place
+    size_t last = _fds.size() - 1;
+    if (index != last)
+    {
+        _fds[index] = _fds[last];
+        _addrs[index] = _addrs[last];
+        _seqs[index] = _seqs[last];
+        _offsets[index] = _offsets[last];
+        _renditions[index] = _renditions[last];
+        _flags[index] = _flags[last];
+        _sentBytes[index] = _sentBytes[last];
+        _joinedMs[index] = _joinedMs[last];
+        _tcpInfos[index] = _tcpInfos[last];
+        _switchedMs[index] = _switchedMs[last];
+
+        if (_fds[index] < 0)
+            _addrIndex[GetKey(_addrs[index])] = index;
+    }
+
+    _fds.pop_back();
+    _addrs.pop_back();
+    _seqs.pop_back();
+    _offsets.pop_back();
+    _renditions.pop_back();
+    _flags.pop_back();
+    _sentBytes.pop_back();
+    _joinedMs.pop_back();
+    _tcpInfos.pop_back();
+    _switchedMs.pop_back();
+}
+
+void ClientTable::Clear()
+{
+    _fds.clear();
+    _addrs.clear();
+    _seqs.clear();
+    _offsets.clear();
+    _renditions.clear();
+    _flags.clear();
+    _sentBytes.clear();
+    _joinedMs.clear();
+    _tcpInfos.clear();
+    _switchedMs.clear();
+    _addrIndex.clear();
+}
+
+size_t ClientTable::Find(sockaddr_in const& addr) const
+{
+    auto itr = _addrIndex.find(GetKey(addr));
+    return itr != _addrIndex.end() ? itr->second : SIZE_MAX;
+}
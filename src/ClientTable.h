@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <netinet/in.h>
+
+// client flags
+#define CLIENT_FLAG_ZAPPING 0x1 // sends control bytes
+#define CLIENT_FLAG_STANDBY 0x2 // gets nothing until activated
+#define CLIENT_FLAG_SWITCHED 0x4 // next chunk is its new rendition's first
+
+// control bytes zapping clients send, standby connections are kept to streams
+// they may zap to, and activated to start from the newest keyframe
+#define CLIENT_CONTROL_STANDBY 'S'
+#define CLIENT_CONTROL_ACTIVATE 'A'
+
+// kernel side of a TCP client, sampled from TCP_INFO
+struct ClientTcpInfo
+{
+    uint32_t rttUs = 0;
+    uint32_t cwnd = 0;        // segments
+    // queued in the socket, not sent yet or sent and not acked
+    uint32_t queuedBytes = 0;
+    // bytes/s client can take, 0 if unknown
+    uint64_t throughput = 0;
+    // sent bytes as of the sample
+    uint64_t sentBytes = 0;
+    long sampledMs = 0;
+};
+
+// Viewers of the regular backend, TCP (by fd) or UDP (by address)
+// Kept as a structure of arrays, so fanning a chunk out walks contiguous
+// memory, and a client is removed by moving the last one into its place,
+// which means indexes change on Remove() and loops removing as they go must
+// not advance past a removed index.
+// UDP clients can also be looked up by address in constant time.
+class ClientTable
+{
+public:
+    ClientTable() { }
+
+    // seq is the next chunk the client gets
+    size_t Add(int fd, sockaddr_in const& addr, uint64_t seq, long nowMs, uint8_t rendition = 0);
+    void Remove(size_t index);
+    void Clear();
+
+    // SIZE_MAX if not found
+    size_t Find(sockaddr_in const& addr) const;
+
+    size_t Size() const { return _fds.size(); }
+    bool Empty() const { return _fds.empty(); }
+
+    int GetFd(size_t index) const { return _fds[index]; }
+    sockaddr_in const& GetAddr(size_t index) const { return _addrs[index]; }
+    uint64_t GetSeq(size_t index) const { return _seqs[index]; }
+    // seq is into this rendition's ring, see RenditionSet
+    uint8_t GetRendition(size_t index) const { return _renditions[index]; }
+    long GetSwitchedMs(size_t index) const { return _switchedMs[index]; }
+    // bytes of chunk seq already sent, TCP writes can be short
+    uint32_t GetOffset(size_t index) const { return _offsets[index]; }
+    // chunks behind writeSeq
+    uint64_t GetBacklog(size_t index, uint64_t writeSeq) const { return writeSeq - _seqs[index]; }
+    uint64_t GetSentBytes(size_t index) const { return _sentBytes[index]; }
+    long GetJoinedMs(size_t index) const { return _joinedMs[index]; }
+    uint8_t GetFlags(size_t index) const { return _flags[index]; }
+    void SetFlags(size_t index, uint8_t flags) { _flags[index] = flags; }
+    // client is part way through its current chunk, e.g taken over on hot restart
+    void SetOffset(size_t index, uint32_t offset) { _offsets[index] = offset; }
+    ClientTcpInfo& GetTcpInfo(size_t index) { return _tcpInfos[index]; }
+
+    // bytes more of current chunk, chunkSize long, went out to client
+    void OnSent(size_t index, uint32_t bytes, uint32_t chunkSize)
+    {
+        _sentBytes[index] += bytes;
+        _offsets[index] += bytes;
+        if (_offsets[index] >= chunkSize)
+        {
+            ++_seqs[index];
+            _offsets[index] = 0;
+        }
+    }
+
+    // client drops what's left in between, e.g to get back to live
+    void SkipTo(size_t index, uint64_t seq)
+    {
+        _seqs[index] = seq;
+        _offsets[index] = 0;
+    }
+
+    // client continues from seq of another rendition, another encode with its
+    // own clock and continuity counters, which its first chunk flags
+    void SwitchTo(size_t index, uint8_t rendition, uint64_t seq, long nowMs)
+    {
+        SkipTo(index, seq);
+        _renditions[index] = rendition;
+        _flags[index] |= CLIENT_FLAG_SWITCHED;
+        _switchedMs[index] = nowMs;
+    }
+
+private:
+    static uint64_t GetKey(sockaddr_in const& addr)
+    {
+        return (uint64_t)addr.sin_addr.s_addr << 16 | addr.sin_port;
+    }
+
+private:
+    std::vector<int> _fds;              // -1 for UDP clients
+    std::vector<sockaddr_in> _addrs;
+    std::vector<uint64_t> _seqs;
+    std::vector<uint32_t> _offsets;
+    std::vector<uint8_t> _renditions;
+    std::vector<uint8_t> _flags;
+    std::vector<uint64_t> _sentBytes;
+    std::vector<long> _joinedMs;
+    // cold, only looked at when sampling
+    std::vector<ClientTcpInfo> _tcpInfos;
+    std::vector<long> _switchedMs;
+
+    // UDP address to index
+    std::unordered_map<uint64_t, size_t> _addrIndex;
+};
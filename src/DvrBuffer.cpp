@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "DvrBuffer.h"
+#include "Http.h"
+#include "Util.h"
+
+#define DVR_LISTEN_BACKLOG 10
+#define DVR_MAX_SEND_SIZE (64 * 1024)
+
+DvrBuffer::DvrBuffer(BroadcastRing const& ring) : RingConsumer(ring, "DVR") { }
+
+DvrBuffer::~DvrBuffer()
+{
+    Stop();
+
+    for (DvrClient& client : _clients)
+        close(client.fd);
+
+    if (_listenSocketFd >= 0)
+        close(_listenSocketFd);
+
+    if (_map)
+        munmap(_map, _fileSize);
+
+    if (_fileFd >= 0)
+    {
+        close(_fileFd);
+        // window contents are useless once the stream is gone
+        unlink(_filePath.c_str());
+    }
+}
+
+bool DvrBuffer::Initialize(std::string const& filePath, size_t fileSize, int listenPort,
+    BufferArena& arena)
+{
+    // keep chunks whole, simplifies wrap around handling
+    _fileSize = fileSize - fileSize % RING_CHUNK_SIZE;
+    _filePath = filePath;
+
+    _fileFd = open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fileFd < 0)
+    {
+        LOG_ERROR("Failed to open DVR file %s", filePath.c_str());
+        return false;
+    }
+
+    // preallocate, so appending never has to extend the file
+    if (posix_fallocate(_fileFd, 0, _fileSize) != 0)
+    {
+        LOG_ERROR("Failed to allocate %zu bytes for DVR file", _fileSize);
+        return false;
+    }
+
+    void* map = mmap(NULL, _fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fileFd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map DVR file");
+        return false;
+    }
+
+    // file backed, huge pages only if the filesystem does them (e.g tmpfs)
+    arena.Advise(map, _fileSize);
+    _map = (char*)map;
+
+    _listenSocketFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listenSocketFd < 0)
+    {
+        LOG_ERROR("Failed to initialize DVR listen socket");
+        return false;
+    }
+
+    int setVal = 1;
+    setsockopt(_listenSocketFd, SOL_SOCKET, SO_REUSEADDR, &setVal, sizeof(int));
+
+    sockaddr_in addr;
+    bzero((char*)&addr, sizeof(addr));
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(listenPort);
+
+    if (bind(_listenSocketFd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        LOG_ERROR("Failed to bind DVR listen socket");
+        return false;
+    }
+
+    if (listen(_listenSocketFd, DVR_LISTEN_BACKLOG) < 0)
+    {
+        LOG_ERROR("Failed to open DVR listen socket");
+        return false;
+    }
+
+    LOG_INFO("DVR window of %zu bytes at %s", _fileSize, filePath.c_str());
+    return true;
+}
+
+void DvrBuffer::Tick()
+{
+    AcceptClients();
+
+    _clients.remove_if([this](DvrClient& client)
+                       {
+                           bool keep = client.streaming ?
+                               ServeClient(client) : HandleRequest(client);
+                           if (!keep)
+                           {
+                               LOG_INFO("Removing DVR client fd %d", client.fd);
+                               close(client.fd);
+                           }
+
+                           return !keep;
+                       });
+}
+
+void DvrBuffer::Consume(char const* data, uint32_t size, uint32_t flags)
+{
+    long now = getMSTime();
+
+    // chunks are cut before video keyframes, flagged ones start with one
+    if (flags & RING_FLAG_KEYFRAME)
+        _keyframeIndex.push_back({ now, _writePos });
+
+    _chunkIndex.push_back({ now, _writePos });
+
+    size_t offset = _writePos % _fileSize;
+    size_t first = std::min((size_t)size, _fileSize - offset);
+    memcpy(_map + offset, data, first);
+    if (first < size)
+        memcpy(_map, data + first, size - first);
+
+    _writePos += size;
+    TrimIndex();
+}
+
+void DvrBuffer::TrimIndex()
+{
+    uint64_t oldestPos = GetOldestPos();
+    while (!_chunkIndex.empty() && _chunkIndex.front().pos < oldestPos)
+        _chunkIndex.pop_front();
+
+    while (!_keyframeIndex.empty() && _keyframeIndex.front().pos < oldestPos)
+        _keyframeIndex.pop_front();
+}
+
+uint64_t DvrBuffer::GetOldestPos() const
+{
+    return _writePos > _fileSize ? _writePos - _fileSize : 0;
+}
+
+void DvrBuffer::AcceptClients()
+{
+    while (true)
+    {
+        int clientSocket = accept4(_listenSocketFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket < 0)
+            break;
+
+        DvrClient client;
+        client.fd = clientSocket;
+        _clients.push_back(client);
+        LOG_INFO("Accepted new DVR client, fd %d", clientSocket);
+    }
+}
+
+bool DvrBuffer::HandleRequest(DvrClient& client)
+{
+    char buffer[HTTP_MAX_REQUEST_SIZE];
+    ssize_t n = read(client.fd, buffer, sizeof(buffer));
+    if (n == 0 || (n < 0 && errno != EAGAIN))
+        return false;
+
+    if (n > 0)
+        client.request.append(buffer, n);
+
+    HttpRequest request;
+    int parsed = httpParseRequest(client.request, request);
+    if (parsed == 0)
+        return true; // wait for full header
+
+    // e.g "GET /?timeshift=30 HTTP/1.1"
+    long timeshift = atol(request.query["timeshift"].c_str());
+
+    std::string response;
+    if (parsed < 0 || request.method != "GET")
+        response = httpResponse(400);
+    else if (!SeekToKeyframe(client, getMSTime() - timeshift * 1e3))
+        response = httpResponse(503);
+
+    if (!response.empty())
+    {
+        write(client.fd, response.data(), response.size());
+        return false;
+    }
+
+    response = httpResponse(200,
+        "Content-Type: video/mp2t\r\n"
+        "Cache-Control: no-cache\r\n");
+    if (write(client.fd, response.data(), response.size()) < 0)
+        return false;
+
+    LOG_INFO("DVR client fd %d playing %ld ms behind live", client.fd, client.delayMs);
+    client.streaming = true;
+    return true;
+}
+
+bool DvrBuffer::SeekToKeyframe(DvrClient& client, long timeMs)
+{
+    if (_keyframeIndex.empty())
+        return false;
+
+    // first keyframe at or after requested time, or closest one to live
+    auto itr = std::lower_bound(_keyframeIndex.begin(), _keyframeIndex.end(), timeMs,
+                                [](DvrIndexEntry const& entry, long time)
+                                {
+                                    return entry.timeMs < time;
+                                });
+    if (itr == _keyframeIndex.end())
+        --itr;
+
+    client.pos = itr->pos;
+    client.delayMs = getMSTime() - itr->timeMs;
+    client.blockedSinceMs = 0;
+    return true;
+}
+
+bool DvrBuffer::ServeClient(DvrClient& client)
+{
+    long now = getMSTime();
+
+    // data was overwritten while client was paused for too long
+    if (client.pos < GetOldestPos())
+    {
+        LOG_INFO("DVR client fd %d fell out of window, skipping ahead", client.fd);
+        if (!SeekToKeyframe(client, 0))
+            return true;
+    }
+
+    // send everything that arrived before (now - delay), pacing playback at live rate
+    auto itr = std::upper_bound(_chunkIndex.begin(), _chunkIndex.end(), now - client.delayMs,
+                                [](long time, DvrIndexEntry const& entry)
+                                {
+                                    return time < entry.timeMs;
+                                });
+    uint64_t endPos = (itr == _chunkIndex.end()) ? _writePos : itr->pos;
+
+    while (client.pos < endPos)
+    {
+        size_t offset = client.pos % _fileSize;
+        size_t size = std::min((size_t)(endPos - client.pos), _fileSize - offset);
+        size = std::min(size, (size_t)DVR_MAX_SEND_SIZE);
+
+        ssize_t n = write(client.fd, _map + offset, size);
+        if (n < 0)
+        {
+            if (errno != EAGAIN)
+                return false;
+
+            // client isn't reading, it's paused or its link is slow
+            // either way it's now playing further behind live
+            if (client.blockedSinceMs == 0)
+                client.blockedSinceMs = now;
+            return true;
+        }
+
+        if (client.blockedSinceMs != 0)
+        {
+            client.delayMs += now - client.blockedSinceMs;
+            client.blockedSinceMs = 0;
+        }
+
+        client.pos += n;
+    }
+
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <list>
+
+#include "RingConsumer.h"
+#include "BufferArena.h"
+
+// time index entry, maps chunk arrival time to its position in the DVR window
+struct DvrIndexEntry
+{
+    long timeMs;
+    uint64_t pos;
+};
+
+struct DvrClient
+{
+    int fd = -1;
+    std::string request;        // HTTP request received so far
+    bool streaming = false;     // request handled, sending data
+    uint64_t pos = 0;           // next byte to send, as a logical window position
+    long delayMs = 0;           // how far behind live client is playing
+    long blockedSinceMs = 0;    // time client stopped taking data (e.g paused)
+};
+
+// Timeshift/DVR window
+// Copies everything the streamer relays into a preallocated ring file, which
+// is memory mapped, and keeps a time index of chunks and keyframes.
+// All of it runs on its own thread as a consumer of the broadcast ring, so
+// disk writes never stall live viewers.
+// Clients connect through HTTP and pick how far behind live they want to
+// play, e.g "GET /?timeshift=30" starts 30 seconds behind live.
+class DvrBuffer : public RingConsumer
+{
+public:
+    DvrBuffer(BroadcastRing const& ring);
+    ~DvrBuffer();
+
+    bool Initialize(std::string const& filePath, size_t fileSize, int listenPort,
+        BufferArena& arena);
+
+protected:
+    // RingConsumer overrides
+    void Consume(char const* data, uint32_t size, uint32_t flags) override;
+    void Tick() override;
+
+private:
+    void AcceptClients();
+    bool HandleRequest(DvrClient& client);
+    bool ServeClient(DvrClient& client);
+    uint64_t GetOldestPos() const;
+    bool SeekToKeyframe(DvrClient& client, long timeMs);
+    void TrimIndex();
+
+private:
+    // ring file
+    std::string _filePath;
+    int _fileFd = -1;
+    char* _map = nullptr;
+    size_t _fileSize = 0;
+    uint64_t _writePos = 0; // logical position, wraps around the file
+
+    std::deque<DvrIndexEntry> _chunkIndex;
+    std::deque<DvrIndexEntry> _keyframeIndex;
+
+    int _listenSocketFd = -1;
+    std::list<DvrClient> _clients;
+};
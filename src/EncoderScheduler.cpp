@@ -0,0 +1,367 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "EncoderScheduler.h"
+#include "Util.h"
+
+// fastest first, level is an index in here
+static char const* const presets[] = {
+    "ultrafast", "superfast", "veryfast", "faster", "fast", "medium", "slow"
+};
+static int const presetCount = sizeof(presets) / sizeof(presets[0]);
+
+// below this for SCHEDULER_BEHIND_TIME, stream isn't keeping up
+#define SCHEDULER_BEHIND_SPEED 0.97
+#define SCHEDULER_BEHIND_TIME (10 * 1000)
+// at least this fast, with CPU use well under the thread cap and the host
+// not too busy, for SCHEDULER_HEADROOM_TIME, stream can afford a better preset
+#define SCHEDULER_HEADROOM_SPEED 0.99
+#define SCHEDULER_HEADROOM_CPU 0.5  // of thread cap
+#define SCHEDULER_HEADROOM_HOST 0.7 // of host capacity
+#define SCHEDULER_HEADROOM_TIME (60 * 1000)
+// thread cap off by this long, encodes came or went for good
+#define SCHEDULER_RECAP_TIME (30 * 1000)
+// encodes not measured yet are assumed to take this many cores
+#define SCHEDULER_DEFAULT_COST 1.0
+
+EncoderScheduler::~EncoderScheduler()
+{
+    Release();
+
+    if (_table)
+        munmap(_table, sizeof(EncoderTable));
+
+    if (_tableFd >= 0)
+        close(_tableFd);
+}
+
+bool EncoderScheduler::Initialize(std::string const& streamName, int capacity, int maxThreads,
+    std::string const& preset)
+{
+    _streamName = streamName;
+    _capacity = capacity > 0 ? capacity : sysconf(_SC_NPROCESSORS_ONLN);
+    _maxThreads = std::max(maxThreads, 1);
+
+    _maxLevel = std::find(presets, presets + presetCount, preset) - presets;
+    if (_maxLevel == presetCount)
+    {
+        LOG_ERROR("Unknown x264 preset '%s'", preset.c_str());
+        return false;
+    }
+
+    _level = _maxLevel;
+
+    // every streamer on the host maps the same table
+    mode_t mask = umask(0);
+    _tableFd = open(SCHEDULER_TABLE_PATH, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    umask(mask);
+    if (_tableFd < 0)
+    {
+        LOG_ERROR("Failed to open encoder table %s", SCHEDULER_TABLE_PATH);
+        return false;
+    }
+
+    Lock();
+    struct stat st;
+    if (fstat(_tableFd, &st) == 0 && st.st_size < (off_t)sizeof(EncoderTable))
+        ftruncate(_tableFd, sizeof(EncoderTable));
+
+    void* map = mmap(NULL, sizeof(EncoderTable), PROT_READ | PROT_WRITE, MAP_SHARED, _tableFd, 0);
+    if (map == MAP_FAILED)
+    {
+        Unlock();
+        LOG_ERROR("Failed to map encoder table");
+        return false;
+    }
+
+    _table = (EncoderTable*)map;
+    if (_table->magic != SCHEDULER_TABLE_MAGIC || _table->version != SCHEDULER_TABLE_VERSION)
+    {
+        memset((void*)_table, 0, sizeof(EncoderTable));
+        _table->version = SCHEDULER_TABLE_VERSION;
+        _table->slotCount = SCHEDULER_SLOT_COUNT;
+        _table->magic = SCHEDULER_TABLE_MAGIC;
+    }
+
+    Unlock();
+    return true;
+}
+
+bool EncoderScheduler::Admit(int waitSeconds, bool const& exitFlag)
+{
+    long deadline = getMSTime() + waitSeconds * 1000L;
+    bool logged = false;
+    while (!TryAdmit(false))
+    {
+        if (exitFlag || getMSTime() >= deadline)
+        {
+            LOG_ERROR("Host is at encoder capacity (%d cores), refusing stream", _capacity);
+            return false;
+        }
+
+        if (!logged)
+        {
+            LOG_INFO("Host is at encoder capacity (%d cores), queueing stream...", _capacity);
+            logged = true;
+        }
+
+        usleep(500 * 1e3);
+    }
+
+    LOG_INFO("Encoder admitted, %d threads, preset %s", _threads, presets[_level]);
+    return true;
+}
+
+bool EncoderScheduler::Claim()
+{
+    if (!TryAdmit(true))
+    {
+        LOG_ERROR("No free encoder slot on host, refusing stream");
+        return false;
+    }
+
+    LOG_INFO("Encoder taken over, %d threads, preset %s", _threads, presets[_level]);
+    return true;
+}
+
+bool EncoderScheduler::TryAdmit(bool isForced)
+{
+    Lock();
+
+    double load = 0;
+    double measured = 0;
+    int measuredCount = 0;
+    int liveCount = 0;
+    EncoderSlot* freeSlot = nullptr;
+
+    for (EncoderSlot& slot : _table->slots)
+    {
+        pid_t pid = slot.pid;
+
+        // owner died without releasing its slot
+        if (pid != 0 && kill(pid, 0) < 0 && errno == ESRCH)
+        {
+            slot.pid = 0;
+            pid = 0;
+        }
+
+        if (pid == 0)
+        {
+            if (!freeSlot)
+                freeSlot = &slot;
+            continue;
+        }
+
+        ++liveCount;
+        if (slot.cpuMilli > 0)
+        {
+            measured += slot.cpuMilli / 1000.0;
+            ++measuredCount;
+        }
+        else
+            load += SCHEDULER_DEFAULT_COST;
+    }
+
+    // a new encode is expected to cost what the others do on average
+    double cost = measuredCount ? measured / measuredCount : SCHEDULER_DEFAULT_COST;
+    load += measured;
+    if (!freeSlot || (!isForced && load + cost > _capacity))
+    {
+        Unlock();
+        return false;
+    }
+
+    // cores shared out evenly, one thread each at the very least
+    _threads = std::max(1, std::min(_maxThreads, _capacity / (liveCount + 1)));
+
+    strncpy(freeSlot->streamName, _streamName.c_str(), SCHEDULER_NAME_SIZE - 1);
+    freeSlot->streamName[SCHEDULER_NAME_SIZE - 1] = 0;
+    freeSlot->threads = _threads;
+    freeSlot->presetLevel = _level;
+    freeSlot->speedMilli = 0;
+    freeSlot->cpuMilli = 0;
+    freeSlot->pid = getpid();
+    _slot = freeSlot;
+
+    Unlock();
+    return true;
+}
+
+void EncoderScheduler::Release()
+{
+    if (!_slot)
+        return;
+
+    _slot->pid = 0;
+    _slot = nullptr;
+}
+
+std::string EncoderScheduler::GetEncoderOptions() const
+{
+    return std::string("-preset ") + presets[_level] + " -threads " + std::to_string(_threads);
+}
+
+int EncoderScheduler::GetThreadCap() const
+{
+    // dead owners' slots are only reclaimed on admission, they don't count here
+    int liveCount = 0;
+    for (EncoderSlot const& slot : _table->slots)
+    {
+        pid_t pid = slot.pid;
+        if (pid != 0 && !(kill(pid, 0) < 0 && errno == ESRCH))
+            ++liveCount;
+    }
+
+    return std::max(1, std::min(_maxThreads, _capacity / std::max(liveCount, 1)));
+}
+
+void EncoderScheduler::Sample(pid_t encoderPid, double speed)
+{
+    if (!_slot)
+        return;
+
+    _speed = speed;
+    SampleCpu(encoderPid);
+
+    _slot->speedMilli = (int32_t)(speed * 1000);
+    _slot->cpuMilli = (int32_t)(_cpu * 1000);
+}
+
+bool EncoderScheduler::Update(pid_t encoderPid, double speed)
+{
+    if (!_slot)
+        return false;
+
+    long now = getMSTime();
+    Sample(encoderPid, speed);
+
+    // admission capped us for the encodes running then, they come and go
+    int threads = GetThreadCap();
+    if (threads == _threads)
+        _recapSinceMs = 0;
+    else if (_recapSinceMs == 0)
+        _recapSinceMs = now;
+    else if (now - _recapSinceMs >= SCHEDULER_RECAP_TIME &&
+             now - _lastChangeMs >= SCHEDULER_RECAP_TIME)
+    {
+        LOG_INFO("Encodes on the host changed, capping encoder at %d threads", threads);
+        _threads = threads;
+        _slot->threads = _threads;
+        _lastChangeMs = now;
+        _recapSinceMs = 0;
+        _behindSinceMs = 0;
+        _headroomSinceMs = 0;
+        return true;
+    }
+
+    // falling behind, go faster
+    if (speed < SCHEDULER_BEHIND_SPEED)
+    {
+        _headroomSinceMs = 0;
+        if (_behindSinceMs == 0)
+            _behindSinceMs = now;
+
+        if (now - _behindSinceMs < SCHEDULER_BEHIND_TIME || now - _lastChangeMs < SCHEDULER_BEHIND_TIME)
+            return false;
+
+        if (_level == 0)
+        {
+            LOG_ERROR("Encoder can't keep up (%.2fx) even with preset %s", speed, presets[0]);
+            _behindSinceMs = now;
+            return false;
+        }
+
+        --_level;
+        LOG_INFO("Encoder behind realtime (%.2fx), switching to preset %s", speed, presets[_level]);
+    }
+    else
+    {
+        _behindSinceMs = 0;
+        if (_level >= _maxLevel || speed < SCHEDULER_HEADROOM_SPEED ||
+            _cpu > _threads * SCHEDULER_HEADROOM_CPU)
+        {
+            _headroomSinceMs = 0;
+            return false;
+        }
+
+        // host wide load too, a better preset costs more CPU
+        double load = 0;
+        for (EncoderSlot& slot : _table->slots)
+        {
+            if (slot.pid != 0)
+                load += slot.cpuMilli / 1000.0;
+        }
+
+        if (load > _capacity * SCHEDULER_HEADROOM_HOST)
+        {
+            _headroomSinceMs = 0;
+            return false;
+        }
+
+        if (_headroomSinceMs == 0)
+            _headroomSinceMs = now;
+
+        if (now - _headroomSinceMs < SCHEDULER_HEADROOM_TIME || now - _lastChangeMs < SCHEDULER_HEADROOM_TIME)
+            return false;
+
+        ++_level;
+        LOG_INFO("Encoder has headroom, switching to preset %s", presets[_level]);
+    }
+
+    _slot->presetLevel = _level;
+    _lastChangeMs = now;
+    _behindSinceMs = 0;
+    _headroomSinceMs = 0;
+    return true;
+}
+
+void EncoderScheduler::SampleCpu(pid_t encoderPid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)encoderPid);
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return;
+
+    // utime and stime are fields 14 and 15, after the parenthesized command name
+    char buffer[1024];
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[n] = 0;
+
+    char const* p = strrchr(buffer, ')');
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                     &utime, &stime) != 2)
+        return;
+
+    long ticks = utime + stime;
+    long now = getMSTime();
+    if (encoderPid == _sampledPid && now > _sampledMs)
+        _cpu = (ticks - _sampledTicks) / (double)sysconf(_SC_CLK_TCK) / ((now - _sampledMs) / 1e3);
+
+    _sampledPid = encoderPid;
+    _sampledTicks = ticks;
+    _sampledMs = now;
+}
+
+void EncoderScheduler::Lock()
+{
+    while (flock(_tableFd, LOCK_EX) < 0 && errno == EINTR)
+        ;
+}
+
+void EncoderScheduler::Unlock()
+{
+    flock(_tableFd, LOCK_UN);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <sys/types.h>
+
+// host wide table, shared by all streamers on the host
+#define SCHEDULER_TABLE_PATH "/dev/shm/iss_encoders"
+#define SCHEDULER_TABLE_MAGIC 0x5345444F434E4549ULL // "IENCODES"
+#define SCHEDULER_TABLE_VERSION 1
+#define SCHEDULER_SLOT_COUNT 256
+#define SCHEDULER_NAME_SIZE 64
+
+// one per admitted encode, values in thousandths so they fit plain atomics
+struct EncoderSlot
+{
+    std::atomic<int32_t> pid;           // owning streamer, 0 if free
+    std::atomic<int32_t> threads;       // encoder thread cap
+    std::atomic<int32_t> presetLevel;   // index into preset ladder
+    std::atomic<int32_t> speedMilli;    // realtime factor
+    std::atomic<int32_t> cpuMilli;      // measured encoder CPU use, in cores
+    char streamName[SCHEDULER_NAME_SIZE];
+};
+
+struct EncoderTable
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    EncoderSlot slots[SCHEDULER_SLOT_COUNT];
+};
+
+// Cross-stream encoder scheduler
+// Streamers on a host register their encodes in a shared memory table, which
+// makes up the host capacity model: each encode accounts for its measured CPU
+// use (or an estimate until it's measured), and new streams are only admitted
+// while the total fits the host's cores, otherwise they wait or are refused.
+// Encoder threads are capped so encodes share the cores instead of all
+// oversubscribing them, capped again as encodes come and go, and the x264
+// preset moves along a ladder to keep the stream realtime: faster when it falls
+// behind, back up to the configured preset when there's headroom again. Any
+// change restarts the encoder, so only encoders that resume where they were
+// are adapted, the others keep what they were admitted with.
+// Slots of streamers that died are reclaimed by whoever scans the table next.
+class EncoderScheduler
+{
+public:
+    EncoderScheduler() { }
+    ~EncoderScheduler();
+
+    // capacity is in cores, 0 for all online cores
+    bool Initialize(std::string const& streamName, int capacity, int maxThreads,
+        std::string const& preset);
+
+    // takes a slot, waiting up to waitSeconds for capacity if the host is full
+    bool Admit(int waitSeconds, bool const& exitFlag);
+    // takes a slot whatever the load, for a stream taken over on hot restart,
+    // whose old streamer releases its own as it exits
+    bool Claim();
+    void Release();
+
+    // e.g "-preset veryfast -threads 2"
+    std::string GetEncoderOptions() const;
+
+    // fed with encoder progress, returns true if encoder options changed and
+    // the encoder has to be restarted to apply them
+    bool Update(pid_t encoderPid, double speed);
+    // same, for the host capacity model only, options never change
+    void Sample(pid_t encoderPid, double speed);
+
+    double GetSpeed() const { return _speed; }
+    double GetCpu() const { return _cpu; }
+    int GetThreads() const { return _threads; }
+    int GetPresetLevel() const { return _level; }
+
+private:
+    // any free slot does if isForced
+    bool TryAdmit(bool isForced);
+    // cores shared out evenly between live encodes, ours included
+    int GetThreadCap() const;
+    void SampleCpu(pid_t encoderPid);
+    void Lock();
+    void Unlock();
+
+private:
+    int _tableFd = -1;
+    EncoderTable* _table = nullptr;
+    EncoderSlot* _slot = nullptr;
+
+    std::string _streamName;
+    int _capacity = 0;
+    int _maxThreads = 0;
+    int _threads = 1;
+    int _level = 0;
+    int _maxLevel = 0;
+
+    double _speed = 0;
+    double _cpu = 0;
+    long _behindSinceMs = 0;
+    long _headroomSinceMs = 0;
+    long _recapSinceMs = 0;
+    long _lastChangeMs = 0;
+
+    // encoder CPU time, sampled from /proc
+    pid_t _sampledPid = 0;
+    long _sampledTicks = 0;
+    long _sampledMs = 0;
+};
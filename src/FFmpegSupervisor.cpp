@@ -0,0 +1,664 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <algorithm>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "FFmpegSupervisor.h"
+#include "Util.h"
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#define SUPERVISOR_EVENT_EXIT 0
+#define SUPERVISOR_EVENT_STDERR 1
+
+#define SUPERVISOR_MAX_LINE 4096
+
+FFmpegSupervisor::~FFmpegSupervisor()
+{
+    Stop();
+
+    if (_epollFd >= 0)
+        close(_epollFd);
+}
+
+bool FFmpegSupervisor::Initialize()
+{
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (_epollFd < 0)
+    {
+        LOG_ERROR("Failed to create supervisor epoll set");
+        return false;
+    }
+
+    return true;
+}
+
+int FFmpegSupervisor::Spawn(std::string const& name, std::vector<std::string> const& args,
+    bool withOutput)
+{
+    _processes.push_back(SupervisedProcess());
+    int index = _processes.size() - 1;
+    SupervisedProcess& process = _processes.back();
+    process.name = name;
+    process.args = args;
+
+    if ((withOutput && !CreateOutput(process)) || !Launch(process, index))
+        return -1;
+
+    ++_runningCount;
+    return index;
+}
+
+int FFmpegSupervisor::SpawnPooled(std::string const& name, std::vector<std::string> const& args,
+    std::string const& inputList)
+{
+    _processes.push_back(SupervisedProcess());
+    int index = _processes.size() - 1;
+    SupervisedProcess& process = _processes.back();
+    process.name = name;
+    process.args = args;
+    process.inputList = inputList;
+
+    if (!LaunchPooled(process, index))
+        return -1;
+
+    ++_runningCount;
+    return index;
+}
+
+void FFmpegSupervisor::SetPool(std::vector<std::string> const& args, int count)
+{
+    _poolArgs = args;
+    for (int i = 0; i < count; ++i)
+    {
+        _processes.push_back(SupervisedProcess());
+        SupervisedProcess& worker = _processes.back();
+        worker.name = "Pool worker";
+        worker.parked = true;
+        if (!Launch(worker, _processes.size() - 1))
+            worker.restartAtMs = getMSTime() + worker.backoffMs;
+    }
+}
+
+bool FFmpegSupervisor::CreateOutput(SupervisedProcess& process)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+    {
+        LOG_ERROR("Failed to create output socket for %s", process.name.c_str());
+        return false;
+    }
+
+    process.outputFd = fds[0];
+    process.childOutputFd = fds[1];
+    return true;
+}
+
+bool FFmpegSupervisor::LaunchPooled(SupervisedProcess& process, int index)
+{
+    for (size_t i = 0; i < _processes.size(); ++i)
+    {
+        SupervisedProcess& worker = _processes[i];
+        if (!worker.parked || worker.pid <= 0 || worker.restartRequested)
+            continue;
+
+        Adopt(process, index, worker);
+        LOG_INFO("Started %s from pool, pid %d", process.name.c_str(), (int)process.pid);
+        FeedInput(process);
+
+        // park a replacement while this one gets going
+        if (!Launch(worker, i))
+            worker.restartAtMs = getMSTime() + worker.backoffMs;
+        return true;
+    }
+
+    // pool is empty (or disabled), same worker setup started from scratch
+    return Launch(process, index);
+}
+
+void FFmpegSupervisor::Adopt(SupervisedProcess& process, int index, SupervisedProcess& worker)
+{
+    if (process.outputFd < 0)
+    {
+        process.outputFd = worker.outputFd;
+        process.childOutputFd = worker.childOutputFd;
+    }
+    else
+    {
+        // restart, swapped in underneath the reader, which keeps its fd number
+        dup3(worker.outputFd, process.outputFd, O_CLOEXEC);
+        close(worker.outputFd);
+        if (process.childOutputFd >= 0)
+            close(process.childOutputFd);
+        process.childOutputFd = worker.childOutputFd;
+    }
+
+    process.pid = worker.pid;
+    process.pidFd = worker.pidFd;
+    process.stderrFd = worker.stderrFd;
+    process.stdinFd = worker.stdinFd;
+    process.startMs = getMSTime();
+    process.ended = false;
+
+    worker.pid = 0;
+    worker.pidFd = -1;
+    worker.stderrFd = -1;
+    worker.stdinFd = -1;
+    worker.outputFd = -1;
+    worker.childOutputFd = -1;
+
+    // events now belong to the adopting process
+    Watch(process.stderrFd, index, SUPERVISOR_EVENT_STDERR);
+    if (process.pidFd >= 0)
+        Watch(process.pidFd, index, SUPERVISOR_EVENT_EXIT);
+}
+
+void FFmpegSupervisor::FeedInput(SupervisedProcess& process)
+{
+    // list is small, a single blocking send does it, closing marks its end
+    ssize_t n = send(process.stdinFd, process.inputList.data(), process.inputList.size(),
+        MSG_NOSIGNAL);
+    close(process.stdinFd);
+    process.stdinFd = -1;
+
+    if (n != (ssize_t)process.inputList.size())
+    {
+        LOG_ERROR("Failed to hand input to %s", process.name.c_str());
+        kill(process.pid, SIGKILL); // exit handling takes it from there
+    }
+}
+
+bool FFmpegSupervisor::Launch(SupervisedProcess& process, int index)
+{
+    // pool workers and pooled processes run the pool profile, input comes on stdin
+    // a concat list can't be seeked into, resumed ones read their input directly
+    bool pooled = process.parked || (!process.inputList.empty() && process.resumeUs == 0);
+    if (pooled && process.outputFd < 0 && !CreateOutput(process))
+        return false;
+
+    int stdinFds[2] = { -1, -1 };
+    if (pooled && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, stdinFds) < 0)
+    {
+        LOG_ERROR("Failed to create input socket for %s", process.name.c_str());
+        return false;
+    }
+
+    int stderrPipe[2];
+    if (pipe2(stderrPipe, O_CLOEXEC | O_NONBLOCK) < 0)
+    {
+        LOG_ERROR("Failed to create stderr pipe for %s", process.name.c_str());
+        if (pooled)
+        {
+            close(stdinFds[0]);
+            close(stdinFds[1]);
+        }
+        return false;
+    }
+
+    // built before fork, only async signal safe calls in the child
+    std::vector<char*> argv;
+    for (std::string const& arg : pooled ? _poolArgs : process.args)
+        argv.push_back((char*)arg.c_str());
+    char resumeArg[32];
+    if (process.resumeUs > 0)
+    {
+        snprintf(resumeArg, sizeof(resumeArg), "%.3f", process.resumeUs / 1e6);
+        argv.push_back(resumeArg);
+    }
+    argv.push_back(nullptr);
+
+    bool isOrphanable = _isOrphanable;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // don't outlive the streamer
+        if (!isOrphanable)
+            prctl(PR_SET_PDEATHSIG, SIGTERM);
+
+        dup2(stderrPipe[1], STDERR_FILENO);
+        if (stdinFds[1] >= 0)
+            dup2(stdinFds[1], STDIN_FILENO);
+        if (process.childOutputFd == SUPERVISOR_OUTPUT_FD)
+            fcntl(SUPERVISOR_OUTPUT_FD, F_SETFD, 0); // dup2 wouldn't clear close on exec
+        else if (process.childOutputFd >= 0)
+            dup2(process.childOutputFd, SUPERVISOR_OUTPUT_FD);
+#ifdef SYS_close_range
+        // our fds are all close on exec, this catches any a library left open,
+        // an encoder must not hold viewers or ports after we've let go of them
+        syscall(SYS_close_range, SUPERVISOR_OUTPUT_FD + 1, ~0U, 0);
+#endif
+
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+
+    close(stderrPipe[1]);
+    if (stdinFds[1] >= 0)
+        close(stdinFds[1]);
+
+    if (pid < 0)
+    {
+        LOG_ERROR("Failed to fork %s", process.name.c_str());
+        close(stderrPipe[0]);
+        if (stdinFds[0] >= 0)
+            close(stdinFds[0]);
+        return false;
+    }
+
+    process.pid = pid;
+    process.startMs = getMSTime();
+    process.ended = false;
+    process.outTimeUs = 0;
+    process.stderrFd = stderrPipe[0];
+    Watch(process.stderrFd, index, SUPERVISOR_EVENT_STDERR);
+
+    // without pidfds (pre 5.3 kernels) exits are picked up by polling waitpid
+    process.pidFd = syscall(SYS_pidfd_open, pid, 0);
+    if (process.pidFd >= 0)
+    {
+        fcntl(process.pidFd, F_SETFD, FD_CLOEXEC);
+        Watch(process.pidFd, index, SUPERVISOR_EVENT_EXIT);
+    }
+
+    if (process.resumeUs > 0)
+        LOG_INFO("Started %s at %s s, pid %d", process.name.c_str(), resumeArg, (int)pid);
+    else
+        LOG_INFO("Started %s, pid %d", process.name.c_str(), (int)pid);
+
+    process.stdinFd = stdinFds[0];
+    if (!process.parked && pooled)
+        FeedInput(process);
+
+    return true;
+}
+
+bool FFmpegSupervisor::WaitReady(int index, bool const& exitFlag)
+{
+    SupervisedProcess& process = _processes[index];
+    long startMs = getMSTime();
+
+    while (!exitFlag)
+    {
+        // output and child events at once, no sleeping in between
+        pollfd fds[2];
+        fds[0].fd = process.outputFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = _epollFd;
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, 100) < 0 && errno != EINTR)
+            return false;
+
+        if (fds[0].revents & POLLIN)
+        {
+            LOG_INFO("%s ready after %ld ms", process.name.c_str(), getMSTime() - startMs);
+            return true;
+        }
+
+        Process(0);
+
+        // failing at startup is a configuration problem, no point in restarting
+        if (process.finished || process.restartAtMs != 0)
+        {
+            LOG_ERROR("%s exited before producing any output", process.name.c_str());
+            return false;
+        }
+    }
+
+    return false;
+}
+
+void FFmpegSupervisor::Start()
+{
+    _running = true;
+    _thread = std::thread(&FFmpegSupervisor::Run, this);
+}
+
+void FFmpegSupervisor::Stop()
+{
+    _running = false;
+    if (_thread.joinable())
+        _thread.join();
+
+    for (SupervisedProcess& process : _processes)
+    {
+        if (process.pid > 0)
+        {
+            LOG_INFO("Sending SIGTERM to %s...", process.name.c_str());
+            kill(process.pid, SIGTERM);
+
+            LOG_INFO("Waiting on %s to exit...", process.name.c_str());
+            waitpid(process.pid, NULL, 0);
+            process.pid = 0;
+        }
+
+        Unwatch(process.pidFd);
+        Unwatch(process.stderrFd);
+        if (process.childOutputFd >= 0)
+            close(process.childOutputFd);
+        process.childOutputFd = -1;
+        if (process.stdinFd >= 0)
+            close(process.stdinFd);
+        process.stdinFd = -1;
+
+        // everyone else's output fd belongs to its reader
+        if (process.parked && process.outputFd >= 0)
+            close(process.outputFd);
+        if (process.parked)
+            process.outputFd = -1;
+    }
+}
+
+void FFmpegSupervisor::Pause()
+{
+    _running = false;
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void FFmpegSupervisor::Release(int index)
+{
+    SupervisedProcess& process = _processes[index];
+    if (process.pid > 0)
+        LOG_INFO("Released %s, pid %d", process.name.c_str(), (int)process.pid);
+
+    // fds are closed, the streamer taking over has its own copies
+    Unwatch(process.pidFd);
+    Unwatch(process.stderrFd);
+    if (process.childOutputFd >= 0)
+        close(process.childOutputFd);
+    process.childOutputFd = -1;
+    process.pid = 0;
+    process.restartAtMs = 0;
+    if (!process.finished)
+        --_runningCount;
+    process.finished = true;
+}
+
+int FFmpegSupervisor::Inherit(std::string const& name, std::vector<std::string> const& args,
+    std::string const& inputList, pid_t pid, int stderrFd, int childOutputFd, int outputFd,
+    int64_t resumeUs)
+{
+    _processes.push_back(SupervisedProcess());
+    int index = _processes.size() - 1;
+    SupervisedProcess& process = _processes.back();
+    process.name = name;
+    process.args = args;
+    process.inputList = inputList;
+    process.childOutputFd = childOutputFd;
+    process.outputFd = outputFd;
+    process.startMs = getMSTime();
+    process.resumeUs = resumeUs;
+
+    // finished already, output only has what's left to read
+    if (pid < 0)
+    {
+        process.finished = true;
+        return index;
+    }
+
+    ++_runningCount;
+    if (stderrFd >= 0)
+    {
+        process.stderrFd = stderrFd;
+        Watch(process.stderrFd, index, SUPERVISOR_EVENT_STDERR);
+    }
+
+    // was waiting to be restarted
+    if (pid == 0)
+    {
+        process.restartAtMs = process.startMs;
+        return index;
+    }
+
+    process.pid = pid;
+    process.inherited = true;
+    process.pidFd = syscall(SYS_pidfd_open, pid, 0);
+    if (process.pidFd >= 0)
+    {
+        fcntl(process.pidFd, F_SETFD, FD_CLOEXEC);
+        Watch(process.pidFd, index, SUPERVISOR_EVENT_EXIT);
+    }
+
+    LOG_INFO("Took over %s, pid %d", name.c_str(), (int)pid);
+    return index;
+}
+
+void FFmpegSupervisor::Run()
+{
+    while (_running)
+        Process(100);
+}
+
+void FFmpegSupervisor::Process(int timeoutMs)
+{
+    long now = getMSTime();
+    for (size_t i = 0; i < _processes.size(); ++i)
+    {
+        SupervisedProcess& process = _processes[i];
+
+        if (process.restartAtMs != 0 && now >= process.restartAtMs)
+        {
+            process.restartAtMs = 0;
+            bool launched = process.inputList.empty() || process.resumeUs > 0 ?
+                Launch(process, i) : LaunchPooled(process, i);
+            if (!launched)
+                process.restartAtMs = now + process.backoffMs;
+        }
+
+        if (process.restartAtMs != 0)
+            timeoutMs = std::min(timeoutMs, (int)(process.restartAtMs - now));
+
+        // no pidfd, fall back to checking on the child every cycle
+        if (process.pid > 0 && process.pidFd < 0)
+            HandleExit(process);
+    }
+
+    epoll_event events[8];
+    int count = epoll_wait(_epollFd, events, 8, std::max(timeoutMs, 0));
+    for (int i = 0; i < count; ++i)
+    {
+        SupervisedProcess& process = _processes[events[i].data.u64 >> 1];
+        if ((events[i].data.u64 & 1) == SUPERVISOR_EVENT_STDERR)
+            ReadStderr(process);
+        else
+            HandleExit(process);
+    }
+}
+
+void FFmpegSupervisor::HandleExit(SupervisedProcess& process)
+{
+    int status = 0;
+    if (process.pid <= 0)
+        return;
+
+    if (process.inherited)
+    {
+        // without a pidfd, it's polled, and gone once it's been reaped
+        if (process.pidFd < 0 && kill(process.pid, 0) == 0)
+            return;
+
+        status = process.ended ? 0 : W_EXITCODE(1, 0);
+        process.inherited = false;
+        LOG_INFO("%s we took over exited, %s", process.name.c_str(),
+            process.ended ? "after it finished" : "before it finished");
+    }
+    else if (waitpid(process.pid, &status, WNOHANG) != process.pid)
+        return;
+
+    // last words are usually the interesting ones
+    ReadStderr(process);
+    Unwatch(process.pidFd);
+    Unwatch(process.stderrFd);
+    process.pid = 0;
+
+    if (process.stdinFd >= 0)
+        close(process.stdinFd);
+    process.stdinFd = -1;
+
+    long now = getMSTime();
+    // whatever restarts it next carries on from there, rather than from 0:00
+    if (process.isResumable)
+        process.resumeUs += process.outTimeUs;
+    process.outTimeUs = 0;
+
+    if (process.restartRequested)
+    {
+        LOG_INFO("%s restarting with new settings", process.name.c_str());
+        process.restartRequested = false;
+        process.restartAtMs = now;
+        return;
+    }
+
+    // parked workers are always replaced, they aren't meant to exit at all
+    if (!process.parked && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        // reader gets EOF once it drained everything
+        LOG_INFO("%s finished", process.name.c_str());
+        if (process.childOutputFd >= 0)
+            close(process.childOutputFd);
+        process.childOutputFd = -1;
+        process.finished = true;
+        --_runningCount;
+        return;
+    }
+
+    if (now - process.startMs >= SUPERVISOR_STABLE_TIME)
+        process.backoffMs = SUPERVISOR_MIN_BACKOFF;
+
+    if (WIFSIGNALED(status))
+        LOG_ERROR("%s killed by signal %d, restarting in %ld ms", process.name.c_str(),
+            WTERMSIG(status), process.backoffMs);
+    else
+        LOG_ERROR("%s exited with status %d, restarting in %ld ms", process.name.c_str(),
+            WEXITSTATUS(status), process.backoffMs);
+
+    process.restartAtMs = now + process.backoffMs;
+    process.backoffMs = std::min(process.backoffMs * 2, (long)SUPERVISOR_MAX_BACKOFF);
+}
+
+void FFmpegSupervisor::ReadStderr(SupervisedProcess& process)
+{
+    while (process.stderrFd >= 0)
+    {
+        char buffer[SUPERVISOR_MAX_LINE];
+        ssize_t n = read(process.stderrFd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+        {
+            if (n == 0)
+                Unwatch(process.stderrFd);
+            break;
+        }
+
+        // ffmpeg ends progress lines with \r, treat it as a line end too
+        for (ssize_t i = 0; i < n; ++i)
+        {
+            char c = buffer[i];
+            if (c != '\n' && c != '\r' && process.stderrLine.size() < SUPERVISOR_MAX_LINE)
+            {
+                process.stderrLine += c;
+                continue;
+            }
+
+            if (!process.stderrLine.empty() && !HandleProgress(process, process.stderrLine))
+                LOG_INFO("%s: %s", process.name.c_str(), process.stderrLine.c_str());
+            process.stderrLine.clear();
+        }
+    }
+}
+
+bool FFmpegSupervisor::HandleProgress(SupervisedProcess& process, std::string const& line)
+{
+    // progress comes as key=value lines, with no spaces, unlike log lines
+    size_t separator = line.find('=');
+    if (separator == std::string::npos || separator == 0 ||
+        line.find(' ') != std::string::npos)
+        return false;
+
+    // last progress report of a run that ends well, i.e exits with status 0
+    if (line.compare(0, separator, "progress") == 0)
+        process.ended = line.compare(separator + 1, std::string::npos, "end") == 0;
+
+    // microseconds, N/A until there's output, out_time_ms is the same in
+    // ffmpeg versions without out_time_us
+    if (line.compare(0, separator, "out_time_us") == 0 ||
+        line.compare(0, separator, "out_time_ms") == 0)
+    {
+        char* end = nullptr;
+        long long outTimeUs = strtoll(line.c_str() + separator + 1, &end, 10);
+        if (end && *end == 0 && outTimeUs >= 0)
+            process.outTimeUs = outTimeUs;
+    }
+
+    if (line.compare(0, separator, "speed") == 0 && _progressHandler)
+    {
+        // e.g "speed=1.01x", "speed=N/A" until there's something to measure
+        char* end = nullptr;
+        double speed = strtod(line.c_str() + separator + 1, &end);
+        if (end && *end == 'x')
+            _progressHandler(&process - &_processes[0], process.pid, speed);
+    }
+
+    return true;
+}
+
+void FFmpegSupervisor::Reconfigure(int index, std::vector<std::string> const& args,
+    std::vector<std::string> const& poolArgs)
+{
+    // pooled ones read their input directly when resumed, with args
+    SupervisedProcess& process = _processes[index];
+    process.args = args;
+    if (!process.inputList.empty())
+    {
+        // parked workers run the old args, they're replaced as well
+        _poolArgs = poolArgs;
+        for (SupervisedProcess& worker : _processes)
+        {
+            if (!worker.parked || worker.pid <= 0)
+                continue;
+
+            worker.restartRequested = true;
+            kill(worker.pid, SIGTERM);
+        }
+    }
+
+    if (process.pid > 0)
+    {
+        process.restartRequested = true;
+        kill(process.pid, SIGTERM);
+    }
+}
+
+void FFmpegSupervisor::Watch(int fd, int index, int type)
+{
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = ((uint64_t)index << 1) | type;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) < 0 && errno == EEXIST)
+        epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void FFmpegSupervisor::Unwatch(int& fd)
+{
+    if (fd < 0)
+        return;
+
+    epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    fd = -1;
+}
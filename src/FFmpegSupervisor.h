@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <sys/types.h>
+
+// fd children write their TS output to, i.e ffmpeg output "pipe:3"
+#define SUPERVISOR_OUTPUT_FD 3
+// restart backoff, doubles with each crash in a row
+#define SUPERVISOR_MIN_BACKOFF 500 // ms
+#define SUPERVISOR_MAX_BACKOFF (30 * 1000)
+// a child running at least this long counts as healthy again, backoff resets
+#define SUPERVISOR_STABLE_TIME (30 * 1000)
+
+struct SupervisedProcess
+{
+    std::string name;
+    std::vector<std::string> args;
+    pid_t pid = 0;
+    int pidFd = -1;
+    int stderrFd = -1;
+    std::string stderrLine;     // partial stderr line
+    int childOutputFd = -1;     // child end of output socket, outlives restarts
+    int outputFd = -1;          // reader end of output socket
+    // pooled processes get their input as a concat list written to stdin
+    std::string inputList;
+    int stdinFd = -1;
+    bool parked = false;        // pre-warmed pool worker, waiting for input
+    bool restartRequested = false;
+    // another streamer process started it, see FFmpegSupervisor::Inherit()
+    bool inherited = false;
+    bool ended = false;         // reported progress=end, i.e it's finishing cleanly
+    // input can be seeked into, restarts carry on from where the last run got
+    // rather than from the start, see FFmpegSupervisor::SetResumable()
+    bool isResumable = false;
+    int64_t outTimeUs = 0;      // output time this run reported, out_time_us
+    int64_t resumeUs = 0;       // where in the input this run started
+    long startMs = 0;
+    long restartAtMs = 0;       // pending restart, 0 if none
+    long backoffMs = SUPERVISOR_MIN_BACKOFF;
+    bool finished = false;
+};
+
+// Supervises ffmpeg instances
+// Children are tracked through pidfds in an epoll set, so exits are noticed
+// right away, and their stderr is collected into the log as it comes.
+// TS output goes through a socketpair inherited as SUPERVISOR_OUTPUT_FD rather
+// than a TCP port that has to be polled until ffmpeg listens: the stream is
+// ready the moment its first bytes are.
+// The child end of the socketpair is kept open across restarts, so when a
+// child crashes and gets restarted (with backoff) the reader only sees a
+// stall. A clean exit (e.g end of file) is final, the reader then gets EOF.
+class FFmpegSupervisor
+{
+public:
+    FFmpegSupervisor() : _running(false), _runningCount(0) { }
+    ~FFmpegSupervisor();
+
+    bool Initialize();
+
+    // starts a child, returns its index, -1 on failure
+    // withOutput children get an output socket, which belongs to the reader
+    int Spawn(std::string const& name, std::vector<std::string> const& args, bool withOutput);
+    // same, but started from the pool if possible, input is a concat list
+    // args read the same input directly, for restarts that resume
+    int SpawnPooled(std::string const& name, std::vector<std::string> const& args,
+        std::string const& inputList);
+    int GetOutputFd(int index) const { return _processes[index].outputFd; }
+
+    // children are killed when the thread that started them exits, unless they
+    // are meant to outlive us, i.e to be handed over on hot restart; those exit
+    // once their output is closed, should we crash, only before Start()
+    void SetOrphanable(bool isOrphanable) { _isOrphanable = isOrphanable; }
+
+    // a crashed or reconfigured child is restarted at the output time it last
+    // reported, passed as one more arg (the script's $7, an -ss input option),
+    // rather than from the start of its input; only for inputs where that's a
+    // time ffmpeg can seek to, i.e a single file read once, only before Start()
+    void SetResumable(int index) { _processes[index].isResumable = true; }
+
+    // keeps count workers parked, args should read a concat list from pipe:0
+    // and write to pipe:3, only before Start()
+    void SetPool(std::vector<std::string> const& args, int count);
+
+    // blocks until child output is readable, false if child exits first
+    // only meant for startup, before Start()
+    bool WaitReady(int index, bool const& exitFlag);
+
+    // supervises on its own thread from then on, no more Spawn() calls
+    void Start();
+    // stops supervising, terminates and reaps all children
+    void Stop();
+    // stops supervising, children keep running, Start() picks up from there
+    void Pause();
+
+    // hot restart: a running child is handed over to the streamer taking over
+    // from us, which inherits it, we release it so Stop() leaves it running
+    // only while paused
+    SupervisedProcess const& GetProcess(int index) const { return _processes[index]; }
+    void Release(int index);
+    // returns its index, only before Start(), pid is 0 if it was waiting to be
+    // restarted and -1 if it finished, resumeUs is where its run started
+    // it's not our child, so there's no exit status to wait for: it's gone once
+    // its pidfd says so, and finished if it reported the end of its progress
+    // first, crashed otherwise, and is restarted as ours then
+    int Inherit(std::string const& name, std::vector<std::string> const& args,
+        std::string const& inputList, pid_t pid, int stderrFd, int childOutputFd,
+        int outputFd, int64_t resumeUs);
+
+    bool IsAllFinished() const { return _runningCount == 0; }
+
+    // called from supervisor thread with the realtime factor children report
+    // through "-progress pipe:2" (ffmpeg's speed=...x)
+    typedef std::function<void(int index, pid_t pid, double speed)> ProgressHandler;
+    void SetProgressHandler(ProgressHandler const& handler) { _progressHandler = handler; }
+
+    // restarts child with new args, pooled ones get new pool args, resumable
+    // ones carry on from where they were
+    // only from supervisor thread, i.e the progress handler
+    void Reconfigure(int index, std::vector<std::string> const& args,
+        std::vector<std::string> const& poolArgs);
+
+private:
+    void Run();
+    void Process(int timeoutMs);
+    bool Launch(SupervisedProcess& process, int index);
+    bool LaunchPooled(SupervisedProcess& process, int index);
+    void Adopt(SupervisedProcess& process, int index, SupervisedProcess& worker);
+    void FeedInput(SupervisedProcess& process);
+    bool CreateOutput(SupervisedProcess& process);
+    void HandleExit(SupervisedProcess& process);
+    void ReadStderr(SupervisedProcess& process);
+    bool HandleProgress(SupervisedProcess& process, std::string const& line);
+    void Watch(int fd, int index, int type);
+    void Unwatch(int& fd);
+
+private:
+    int _epollFd = -1;
+    std::vector<SupervisedProcess> _processes;
+    std::vector<std::string> _poolArgs;
+    ProgressHandler _progressHandler;
+    bool _isOrphanable = false;
+
+    std::thread _thread;
+    std::atomic<bool> _running;
+    std::atomic<int> _runningCount;
+};
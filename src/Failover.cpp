@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <algorithm>
+
+#include "Failover.h"
+#include "TSParser.h"
+#include "Util.h"
+
+#define FAILOVER_POLL_TIMEOUT 100 // ms, how often exit flag and stalls are checked
+
+// collects PMT PIDs out of a PAT starting in this packet
+static bool parsePat(uint8_t const* pkt, std::vector<uint16_t>& pmtPids)
+{
+    size_t offset = tsGetPayloadOffset(pkt);
+    if (offset >= TS_PACKET_SIZE)
+        return false;
+
+    // skip pointer field
+    offset += 1 + pkt[offset];
+    if (offset + 8 > TS_PACKET_SIZE || pkt[offset] != 0x00)
+        return false;
+
+    uint8_t const* section = pkt + offset;
+    size_t sectionLength = ((section[1] & 0x0F) << 8) | section[2];
+    // program loop runs from after the header up to the CRC
+    size_t end = std::min((size_t)3 + sectionLength - 4, TS_PACKET_SIZE - offset);
+    for (size_t i = 8; i + 4 <= end; i += 4)
+    {
+        uint16_t program = (section[i] << 8) | section[i + 1];
+        uint16_t pid = ((section[i + 2] & 0x1F) << 8) | section[i + 3];
+        if (program != 0) // 0 points to the network PID
+            pmtPids.push_back(pid);
+    }
+
+    return true;
+}
+
+void FailoverSource::Initialize(IngestSource* primary, IngestSource* standby, long stallTimeoutMs)
+{
+    _sources[0] = primary;
+    _sources[1] = standby;
+    _alive[0] = primary != nullptr;
+    _alive[1] = standby != nullptr;
+    _active = 0;
+    _stallTimeoutMs = stallTimeoutMs;
+    _startMs = getMSTime();
+
+    memset(_outCC, -1, sizeof(_outCC));
+    memset(_ccDelta, 0, sizeof(_ccDelta));
+    memset(_ccResync, 0, sizeof(_ccResync));
+}
+
+bool FailoverSource::Read(char* buffer, size_t maxSize, size_t& size, long deadlineMs,
+                          bool const& exitFlag, long wakeMs)
+{
+    while (true)
+    {
+        if (exitFlag)
+            return false;
+
+        // full, or cut before a keyframe
+        size = GetChunkSize(maxSize);
+        if (size == maxSize || size < _out.size())
+            break;
+
+        long now = getMSTime();
+        if (size > 0 && _firstMs == 0)
+            _firstMs = now;
+
+        int timeout = FAILOVER_POLL_TIMEOUT;
+        if (size > 0)
+        {
+            if (now - _firstMs >= deadlineMs)
+                break;
+
+            timeout = std::min(timeout, (int)(deadlineMs - (now - _firstMs)));
+        }
+
+        // partial chunk stays in _out, its deadline still counts from _firstMs
+        if (wakeMs > 0)
+        {
+            if (now >= wakeMs)
+            {
+                size = 0;
+                return true;
+            }
+
+            timeout = std::min(timeout, (int)(wakeMs - now));
+        }
+
+        if (!_alive[0] && !_alive[1])
+        {
+            // last partial chunk still goes out
+            if (size > 0)
+                break;
+
+            LOG_INFO("All sources ended");
+            return false;
+        }
+
+        Receive(timeout);
+        PullActive();
+        PullStandby();
+        CheckFailover();
+    }
+
+    memcpy(buffer, _out.data(), size);
+    _out.erase(_out.begin(), _out.begin() + size);
+    _firstMs = 0;
+    return true;
+}
+
+void FailoverSource::Save(FailoverState& state, std::vector<uint8_t>& ready,
+                          std::vector<uint8_t>& raw)
+{
+    state.active = _active;
+    memcpy(state.outCC, _outCC, sizeof(_outCC));
+    memcpy(state.ccDelta, _ccDelta, sizeof(_ccDelta));
+    memcpy(state.ccResync, _ccResync, sizeof(_ccResync));
+
+    ready.swap(_out);
+    _out.clear();
+    if (_sources[_active])
+        _sources[_active]->TakeBuffered(raw);
+}
+
+void FailoverSource::Restore(FailoverState const& state, std::vector<uint8_t> const& ready,
+                             std::vector<uint8_t> const& raw)
+{
+    if (state.active < 0 || state.active > 1 || !_sources[state.active])
+    {
+        LOG_ERROR("No source %d to carry on from, starting over", state.active);
+        return;
+    }
+
+    _active = state.active;
+    memcpy(_outCC, state.outCC, sizeof(_outCC));
+    memcpy(_ccDelta, state.ccDelta, sizeof(_ccDelta));
+    memcpy(_ccResync, state.ccResync, sizeof(_ccResync));
+
+    _out.insert(_out.begin(), ready.begin(), ready.end());
+    _sources[_active]->Preload(raw);
+}
+
+size_t FailoverSource::GetChunkSize(size_t maxSize) const
+{
+    size_t size = std::min(maxSize, _out.size());
+    if (size <= TS_PACKET_SIZE)
+        return size;
+
+    // a keyframe at the start doesn't cut anything, audio frames never do
+    int offset = tsFindKeyframeStart(&_out[TS_PACKET_SIZE], size - TS_PACKET_SIZE);
+    return offset >= 0 ? offset + TS_PACKET_SIZE : size;
+}
+
+void FailoverSource::Receive(int timeoutMs)
+{
+    pollfd fds[2];
+    int indexes[2];
+    int count = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        if (!_alive[i] || _sources[i]->GetPollFd() < 0)
+            continue;
+
+        fds[count].fd = _sources[i]->GetPollFd();
+        fds[count].events = POLLIN;
+        fds[count].revents = 0;
+        indexes[count] = i;
+        ++count;
+    }
+
+    if (poll(fds, count, timeoutMs) <= 0)
+        return;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (fds[i].revents == 0)
+            continue;
+
+        int index = indexes[i];
+        if (!_sources[index]->Receive())
+        {
+            LOG_ERROR("Source %s is gone", _sources[index]->GetName().c_str());
+            _alive[index] = false;
+        }
+    }
+}
+
+void FailoverSource::PullActive()
+{
+    IngestSource* source = _sources[_active];
+    size_t size = source ? source->GetReadySize() : 0;
+    if (size == 0)
+        return;
+
+    if (_activeStalled)
+    {
+        LOG_INFO("Source %s resumed", source->GetName().c_str());
+        memset(_ccResync, 1, sizeof(_ccResync));
+        _activeStalled = false;
+    }
+
+    size_t offset = _out.size();
+    _out.resize(offset + size);
+    source->Take((char*)&_out[offset], size);
+
+    for (; offset < _out.size(); offset += TS_PACKET_SIZE)
+        FixContinuity(&_out[offset]);
+}
+
+void FailoverSource::PullStandby()
+{
+    IngestSource* source = _sources[1 - _active];
+    size_t size = source ? source->GetReadySize() : 0;
+    if (size == 0)
+        return;
+
+    _scratch.resize(size);
+    source->Take((char*)_scratch.data(), size);
+
+    for (size_t offset = 0; offset < size; offset += TS_PACKET_SIZE)
+    {
+        uint8_t const* pkt = &_scratch[offset];
+        TrackTables(pkt);
+
+        // only the latest GOP is kept, a splice starts with its keyframe
+        if (tsIsKeyframeStart(pkt))
+        {
+            _gop.clear();
+            _gopHasKeyframe = true;
+        }
+
+        if (_gopHasKeyframe)
+            _gop.insert(_gop.end(), pkt, pkt + TS_PACKET_SIZE);
+    }
+
+    // no keyframes coming (e.g audio only), better no splice than an unbounded one
+    if (_gop.size() > FAILOVER_GOP_MAX_SIZE)
+    {
+        _gop.clear();
+        _gopHasKeyframe = false;
+    }
+}
+
+void FailoverSource::CheckFailover()
+{
+    long now = getMSTime();
+    IngestSource* active = _sources[_active];
+    bool dead = !_alive[_active];
+    long lastDataMs = std::max(active ? active->GetLastDataMs() : 0, _startMs);
+    if (!dead && now - lastDataMs <= _stallTimeoutMs)
+        return;
+
+    if (!dead && !_activeStalled)
+    {
+        LOG_INFO("Source %s stalled", active->GetName().c_str());
+        _activeStalled = true;
+    }
+
+    // a standby is only worth switching to if it's producing data right now
+    int standbyIndex = 1 - _active;
+    IngestSource* standby = _sources[standbyIndex];
+    if (!standby || !_alive[standbyIndex] || !_gopHasKeyframe ||
+        now - standby->GetLastDataMs() > _stallTimeoutMs)
+        return;
+
+    Switch(dead ? "ended" : "stalled");
+}
+
+void FailoverSource::Switch(char const* reason)
+{
+    LOG_INFO("Source %s %s, switching to %s", _sources[_active]->GetName().c_str(),
+        reason, _sources[1 - _active]->GetName().c_str());
+
+    _active = 1 - _active;
+    _activeStalled = false;
+
+    // new source counters are offset to continue from the old ones
+    memset(_ccResync, 1, sizeof(_ccResync));
+
+    // splice: tables first so the GOP can be decoded on its own, then the GOP
+    size_t offset = _out.size();
+    _out.insert(_out.end(), _pat.begin(), _pat.end());
+    for (auto& pmt : _pmts)
+        _out.insert(_out.end(), pmt.second.begin(), pmt.second.end());
+    _out.insert(_out.end(), _gop.begin(), _gop.end());
+
+    for (; offset < _out.size(); offset += TS_PACKET_SIZE)
+        FixContinuity(&_out[offset]);
+
+    // old active source becomes the standby, its tables and GOP are tracked from scratch
+    _gop.clear();
+    _gopHasKeyframe = false;
+    _pat.clear();
+    _pmts.clear();
+}
+
+void FailoverSource::FixContinuity(uint8_t* pkt)
+{
+    uint16_t pid = tsGetPid(pkt);
+    if (pid == TS_NULL_PID)
+        return;
+
+    uint8_t cc = tsGetContinuityCounter(pkt);
+    if (_ccResync[pid])
+    {
+        _ccResync[pid] = false;
+        if (_outCC[pid] >= 0)
+        {
+            uint8_t expected = tsHasPayload(pkt) ? (_outCC[pid] + 1) & 0x0F : _outCC[pid];
+            _ccDelta[pid] = (expected - cc) & 0x0F;
+
+            // timestamps and PCR jump too, tell decoders if there's room for it
+            if (tsHasAdaptationField(pkt) && pkt[4] > 0)
+                pkt[5] |= 0x80;
+        }
+    }
+
+    cc = (cc + _ccDelta[pid]) & 0x0F;
+    pkt[3] = (pkt[3] & 0xF0) | cc;
+    _outCC[pid] = cc;
+}
+
+void FailoverSource::TrackTables(uint8_t const* pkt)
+{
+    if (!tsIsPayloadStart(pkt))
+        return;
+
+    uint16_t pid = tsGetPid(pkt);
+    if (pid == 0)
+    {
+        std::vector<uint16_t> pmtPids;
+        if (!parsePat(pkt, pmtPids))
+            return;
+
+        _pat.assign(pkt, pkt + TS_PACKET_SIZE);
+        for (uint16_t pmtPid : pmtPids)
+            _pmts[pmtPid]; // filled once the PMT comes by
+    }
+    else if (_pmts.count(pid))
+        _pmts[pid].assign(pkt, pkt + TS_PACKET_SIZE);
+}
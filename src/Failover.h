@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+#include "IngestSource.h"
+
+// cap on buffered standby data, a GOP of a few seconds fits comfortably
+#define FAILOVER_GOP_MAX_SIZE (8 * 1024 * 1024)
+
+// what output continuity depends on, carried over on hot restart
+struct FailoverState
+{
+    int32_t active;
+    int8_t outCC[TS_PID_COUNT];
+    uint8_t ccDelta[TS_PID_COUNT];
+    bool ccResync[TS_PID_COUNT];
+};
+
+// Source supervision with an optional hot-standby input
+// Both sources run all the time. Output comes from the active one while the
+// standby one is drained into a buffer holding its current GOP, i.e
+// everything since its last video keyframe, prefixed with its latest PAT/PMT.
+// When the active source stalls or dies, the standby buffer is spliced in
+// right at that keyframe, so the switch costs at most one GOP and the output
+// stays decodable. Continuity counters are rewritten to carry on over the
+// splice and discontinuity is flagged where possible, so connected viewers
+// just keep playing.
+// Roles are simply swapped, there's no automatic switch back, only another
+// failover if the new active source fails too.
+// An active source that resumes after a stall (restarted encoder, no standby)
+// gets the same continuity fix up as a switch.
+class FailoverSource
+{
+public:
+    FailoverSource() { }
+
+    // standby can be nullptr, source is then only supervised
+    void Initialize(IngestSource* primary, IngestSource* standby, long stallTimeoutMs);
+
+    // blocks until a chunk of whole packets is ready, at most maxSize bytes
+    // (a multiple of TS_PACKET_SIZE), cut short:
+    // - before a video keyframe, so keyframes always start a chunk
+    // - once deadlineMs passed since its first packet was ready
+    // - with whatever is left once all sources are gone
+    // returns false once there's nothing left to read or exitFlag is set
+    // with a wakeMs (getMSTime() based), returns with size 0 once it's passed
+    // and no chunk is ready yet, for the caller to get on with timed work
+    bool Read(char* buffer, size_t maxSize, size_t& size, long deadlineMs,
+              bool const& exitFlag, long wakeMs = 0);
+
+    // hot restart, takes out state and data not read yet: ready is what Read()
+    // returns next, raw what the active source has buffered
+    // Restore() puts it back, here or in the streamer taking over, so output
+    // carries on without a lost packet or a continuity error
+    // the standby GOP isn't carried over, it's collected again
+    void Save(FailoverState& state, std::vector<uint8_t>& ready, std::vector<uint8_t>& raw);
+    void Restore(FailoverState const& state, std::vector<uint8_t> const& ready,
+                 std::vector<uint8_t> const& raw);
+
+private:
+    // bytes of _out that make the next chunk, see Read()
+    size_t GetChunkSize(size_t maxSize) const;
+    void Receive(int timeoutMs);
+    void PullActive();
+    void PullStandby();
+    void CheckFailover();
+    void Switch(char const* reason);
+
+    void FixContinuity(uint8_t* pkt);
+    void TrackTables(uint8_t const* pkt);
+
+private:
+    IngestSource* _sources[2] = { nullptr, nullptr };
+    bool _alive[2] = { false, false };
+    int _active = 0;
+    // active source went quiet with nothing to switch to, e.g restarting
+    bool _activeStalled = false;
+    long _stallTimeoutMs = 0;
+    long _startMs = 0;
+
+    // packets ready for Read(), continuity already fixed up
+    std::vector<uint8_t> _out;
+    long _firstMs = 0; // when next chunk's first packet was ready
+    std::vector<uint8_t> _scratch;
+
+    // standby GOP, starting at a keyframe once _gopHasKeyframe is set
+    std::vector<uint8_t> _gop;
+    bool _gopHasKeyframe = false;
+    // standby program tables, single packet sections as ffmpeg writes them
+    std::vector<uint8_t> _pat;
+    std::map<uint16_t, std::vector<uint8_t> > _pmts;
+
+    // per PID output continuity state
+    int8_t _outCC[TS_PID_COUNT];
+    uint8_t _ccDelta[TS_PID_COUNT];
+    bool _ccResync[TS_PID_COUNT];
+};
@@ -0,0 +1,239 @@
+#include <string.h>
+#include <algorithm>
+
+#include "HealthAnalyzer.h"
+
+#define PCR_PER_MS 27000
+
+HealthAnalyzer::HealthAnalyzer()
+{
+    memset(_lastCC, -1, sizeof(_lastCC));
+    memset(_isPmt, 0, sizeof(_isPmt));
+}
+
+void HealthAnalyzer::Initialize(long byteRate, long nowMs)
+{
+    _byteRate = std::max(byteRate, 1L);
+    _intervalMs = nowMs;
+}
+
+void HealthAnalyzer::Analyze(uint8_t const* data, size_t size, long nowMs)
+{
+    _intervalBytes += size;
+
+    for (size_t offset = 0; offset + TS_PACKET_SIZE <= size; offset += TS_PACKET_SIZE)
+    {
+        uint8_t const* pkt = data + offset;
+        uint16_t pid = tsGetPid(pkt);
+        ++_stats.packets;
+        if (pid == TS_NULL_PID)
+            continue;
+
+        CheckContinuity(pkt, pid);
+
+        if (tsHasAdaptationField(pkt))
+        {
+            // muxers set random access on audio packets too
+            if (pid == _videoPid && tsIsRandomAccess(pkt))
+                _lastKeyframeMs = nowMs;
+
+            int64_t pcr = tsGetPcr(pkt);
+            if (pcr >= 0 && (_pcrPid < 0 || pid == _pcrPid))
+                CheckPcr(pkt, pid, pcr, nowMs);
+        }
+
+        if (!tsIsPayloadStart(pkt))
+            continue;
+
+        if (pid == 0)
+        {
+            CheckInterval(_lastPatPcr, _patInterval, _stats.patErrors);
+            ParsePat(pkt);
+        }
+        else if (_isPmt[pid])
+        {
+            CheckInterval(_lastPmtPcr, _pmtInterval, _stats.pmtErrors);
+            ParsePmt(pkt);
+        }
+    }
+}
+
+void HealthAnalyzer::Sample(long nowMs)
+{
+    // gaps still open count too, PSI that stopped coming is the worst kind
+    if (_pcr >= 0 && _lastPatPcr >= 0 && _pcr >= _lastPatPcr)
+        _patInterval = std::max(_patInterval, (long)((_pcr - _lastPatPcr) / PCR_PER_MS));
+    if (_pcr >= 0 && _lastPmtPcr >= 0 && _pcr >= _lastPmtPcr)
+        _pmtInterval = std::max(_pmtInterval, (long)((_pcr - _lastPmtPcr) / PCR_PER_MS));
+
+    long elapsed = nowMs - _intervalMs;
+    _stats.bitRate = elapsed > 0 ? _intervalBytes * 8 * 1000 / elapsed : 0;
+    _stats.keyframeAgeMs = _lastKeyframeMs >= 0 ? nowMs - _lastKeyframeMs : -1;
+    _stats.patIntervalMs = _patInterval;
+    _stats.pmtIntervalMs = _pmtInterval;
+    _stats.pcrIntervalMs = _pcrInterval;
+    _stats.pcrJitterMs = _basePcr >= 0 ? _maxOffset - _minOffset : -1;
+    _stats.intervalErrors = GetErrorCount() - _sampledErrors;
+
+    _sampledErrors = GetErrorCount();
+    _intervalMs = nowMs;
+    _intervalBytes = 0;
+    _patInterval = -1;
+    _pmtInterval = -1;
+    _pcrInterval = -1;
+    // jitter is measured from the first PCR of each interval
+    _basePcr = -1;
+}
+
+bool HealthAnalyzer::IsHealthy() const
+{
+    // declared rate is the video encoder's, audio and muxing come on top
+    long byteRate = _stats.bitRate / 8;
+    if (_stats.intervalErrors > 0 || byteRate < _byteRate / 2 || byteRate > _byteRate * 2)
+        return false;
+
+    if (_stats.patIntervalMs < 0 || _stats.patIntervalMs > HEALTH_PAT_INTERVAL ||
+        _stats.pmtIntervalMs < 0 || _stats.pmtIntervalMs > HEALTH_PAT_INTERVAL)
+        return false;
+
+    return _stats.keyframeAgeMs >= 0 && _stats.keyframeAgeMs <= HEALTH_KEYFRAME_AGE;
+}
+
+void HealthAnalyzer::CheckContinuity(uint8_t const* pkt, uint16_t pid)
+{
+    // same rules as ingest validation, but on what viewers get, e.g across failovers
+    int8_t cc = tsGetContinuityCounter(pkt);
+    int8_t last = _lastCC[pid];
+    if (last >= 0 && !tsIsDiscontinuity(pkt))
+    {
+        int8_t expected = tsHasPayload(pkt) ? (last + 1) & 0x0F : last;
+        if (cc != expected && !(tsHasPayload(pkt) && cc == last))
+        {
+            ++_stats.ccErrors;
+            _stats.lostPackets += (cc - expected) & 0x0F;
+        }
+    }
+
+    _lastCC[pid] = cc;
+}
+
+void HealthAnalyzer::CheckPcr(uint8_t const* pkt, uint16_t pid, int64_t pcr, long nowMs)
+{
+    _pcrPid = pid;
+
+    bool isJump = tsIsDiscontinuity(pkt);
+    if (_pcr >= 0 && !isJump)
+    {
+        int64_t delta = pcr - _pcr;
+        if (delta < 0 || delta > HEALTH_PCR_JUMP * PCR_PER_MS)
+        {
+            ++_stats.pcrDiscontinuities;
+            isJump = true;
+        }
+        else
+        {
+            long interval = delta / PCR_PER_MS;
+            _pcrInterval = std::max(_pcrInterval, interval);
+            if (interval > HEALTH_PCR_INTERVAL)
+                ++_stats.pcrErrors;
+        }
+    }
+
+    // stream time restarted, PSI gaps can't be measured across it
+    if (isJump)
+    {
+        _lastPatPcr = -1;
+        _lastPmtPcr = -1;
+    }
+
+    _pcr = pcr;
+    if (isJump || _basePcr < 0)
+    {
+        _basePcr = pcr;
+        _baseMs = nowMs;
+        _minOffset = 0;
+        _maxOffset = 0;
+        return;
+    }
+
+    long offset = (nowMs - _baseMs) - (long)((pcr - _basePcr) / PCR_PER_MS);
+    _minOffset = std::min(_minOffset, offset);
+    _maxOffset = std::max(_maxOffset, offset);
+}
+
+void HealthAnalyzer::ParsePat(uint8_t const* pkt)
+{
+    // only sections that fit in one packet, which a PAT always does in practice
+    size_t offset = tsGetPayloadOffset(pkt);
+    if (offset >= TS_PACKET_SIZE)
+        return;
+
+    offset += 1 + pkt[offset]; // pointer_field
+    if (offset + 8 > TS_PACKET_SIZE || pkt[offset] != 0x00)
+        return;
+
+    size_t sectionLength = ((pkt[offset + 1] & 0x0F) << 8) | pkt[offset + 2];
+    size_t end = std::min(offset + 3 + sectionLength - 4, (size_t)TS_PACKET_SIZE); // without CRC
+    for (size_t i = offset + 8; i + 4 <= end; i += 4)
+    {
+        uint16_t program = (pkt[i] << 8) | pkt[i + 1];
+        uint16_t pmtPid = ((pkt[i + 2] & 0x1F) << 8) | pkt[i + 3];
+        if (program != 0) // 0 is the NIT
+            _isPmt[pmtPid] = true;
+    }
+}
+
+void HealthAnalyzer::ParsePmt(uint8_t const* pkt)
+{
+    // same as the PAT, sections that fit in one packet
+    size_t offset = tsGetPayloadOffset(pkt);
+    if (offset >= TS_PACKET_SIZE)
+        return;
+
+    offset += 1 + pkt[offset]; // pointer_field
+    if (offset + 12 > TS_PACKET_SIZE || pkt[offset] != 0x02)
+        return;
+
+    size_t sectionLength = ((pkt[offset + 1] & 0x0F) << 8) | pkt[offset + 2];
+    size_t programInfoLength = ((pkt[offset + 10] & 0x0F) << 8) | pkt[offset + 11];
+    size_t end = std::min(offset + 3 + sectionLength - 4, (size_t)TS_PACKET_SIZE); // without CRC
+    for (size_t i = offset + 12 + programInfoLength; i + 5 <= end;)
+    {
+        uint8_t streamType = pkt[i];
+        uint16_t pid = ((pkt[i + 1] & 0x1F) << 8) | pkt[i + 2];
+        size_t infoLength = ((pkt[i + 3] & 0x0F) << 8) | pkt[i + 4];
+
+        // MPEG-1/2, MPEG-4 part 2, H.264, HEVC
+        if (streamType == 0x01 || streamType == 0x02 || streamType == 0x10 ||
+            streamType == 0x1B || streamType == 0x24)
+        {
+            _videoPid = pid;
+            return;
+        }
+
+        i += 5 + infoLength;
+    }
+}
+
+void HealthAnalyzer::CheckInterval(int64_t& lastPcr, long& maxInterval, uint64_t& errors)
+{
+    // no stream clock yet
+    if (_pcr < 0)
+        return;
+
+    if (lastPcr >= 0 && _pcr >= lastPcr)
+    {
+        long interval = (_pcr - lastPcr) / PCR_PER_MS;
+        maxInterval = std::max(maxInterval, interval);
+        if (interval > HEALTH_PAT_INTERVAL)
+            ++errors;
+    }
+
+    lastPcr = _pcr;
+}
+
+uint64_t HealthAnalyzer::GetErrorCount() const
+{
+    return _stats.ccErrors + _stats.patErrors + _stats.pmtErrors + _stats.pcrErrors +
+        _stats.pcrDiscontinuities;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "TSPacket.h"
+
+#define HEALTH_REPORT_INTERVAL 5000 // ms between heartbeats to the Portal
+// TR 101 290 limits, in stream time (ms)
+#define HEALTH_PAT_INTERVAL 500     // PAT/PMT repetition
+#define HEALTH_PCR_INTERVAL 40      // PCR repetition
+#define HEALTH_PCR_JUMP 100         // PCR discontinuity
+// a stream with no keyframe for this long shows viewers nothing new, ms
+#define HEALTH_KEYFRAME_AGE 10000
+
+struct HealthStats
+{
+    // totals
+    uint64_t packets = 0;
+    uint64_t ccErrors = 0;
+    uint64_t lostPackets = 0;       // estimated from continuity gaps, 15 at most each
+    uint64_t patErrors = 0;         // PAT gap over HEALTH_PAT_INTERVAL
+    uint64_t pmtErrors = 0;         // same, for any PMT
+    uint64_t pcrErrors = 0;         // PCR gap over HEALTH_PCR_INTERVAL
+    uint64_t pcrDiscontinuities = 0; // PCR jump not flagged as a discontinuity
+
+    // over the last interval, -1 if there was nothing to measure
+    uint64_t intervalErrors = 0;    // any of the above
+    long pcrJitterMs = -1;          // peak to peak of PCR against arrival time
+    long patIntervalMs = -1;        // longest gap, stream time
+    long pmtIntervalMs = -1;
+    long pcrIntervalMs = -1;
+    long bitRate = 0;               // bits/s
+    long keyframeAgeMs = -1;
+};
+
+// Inline stream health analysis, a TR 101 290 priority 1/2 subset
+// Looks at the relayed stream as viewers get it, one chunk at a time:
+// continuity counters per PID, PAT and PMT repetition (PMT PIDs are learnt
+// from the PAT), PCR repetition, discontinuities and jitter against arrival
+// time, measured bit rate and time since last keyframe on the video PID (learnt
+// from the PMT).
+// Only packet headers are looked at, and PSI only as far as finding PIDs, so
+// it costs a few branches per packet. Counters are totals, the rest is measured
+// over the interval last closed by Sample().
+class HealthAnalyzer
+{
+public:
+    HealthAnalyzer();
+
+    // byteRate is the declared bit rate, in bytes/s
+    void Initialize(long byteRate, long nowMs);
+
+    void Analyze(uint8_t const* data, size_t size, long nowMs);
+    // closes current interval
+    void Sample(long nowMs);
+
+    HealthStats const& GetStats() const { return _stats; }
+    // false if last interval had errors, or is out of limits
+    // PCR jitter is only informational, arrival time is as bursty as our source
+    bool IsHealthy() const;
+
+private:
+    void CheckContinuity(uint8_t const* pkt, uint16_t pid);
+    void CheckPcr(uint8_t const* pkt, uint16_t pid, int64_t pcr, long nowMs);
+    void ParsePat(uint8_t const* pkt);
+    void ParsePmt(uint8_t const* pkt);
+    // PAT/PMT repetition, lastPcr is when it was last seen
+    void CheckInterval(int64_t& lastPcr, long& maxInterval, uint64_t& errors);
+    uint64_t GetErrorCount() const;
+
+private:
+    long _byteRate = 1;
+
+    int8_t _lastCC[TS_PID_COUNT];
+    bool _isPmt[TS_PID_COUNT];
+    // first video stream of the PMT, keyframes are only looked for on it
+    int _videoPid = -1;
+
+    // stream clock, last PCR of the first PID carrying them, 27MHz
+    int _pcrPid = -1;
+    int64_t _pcr = -1;
+    int64_t _lastPatPcr = -1;
+    int64_t _lastPmtPcr = -1;
+    // PCR against arrival time, offsets from base, ms
+    int64_t _basePcr = -1;
+    long _baseMs = 0;
+    long _minOffset = 0;
+    long _maxOffset = 0;
+
+    // current interval
+    long _intervalMs = 0;
+    uint64_t _intervalBytes = 0;
+    long _patInterval = -1;
+    long _pmtInterval = -1;
+    long _pcrInterval = -1;
+    uint64_t _sampledErrors = 0;
+    long _lastKeyframeMs = -1;
+
+    HealthStats _stats;
+};
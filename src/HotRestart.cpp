@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <algorithm>
+
+#include "HotRestart.h"
+#include "Util.h"
+
+#define RESTART_FD_BATCH 200    // fds per message, SCM_RIGHTS takes at most 253
+#define RESTART_MAX_PAYLOAD (64 * 1024 * 1024)
+#define RESTART_READY 'R'
+#define RESTART_GO 'G'
+
+// blocking, up to the socket's timeout
+static bool sendAll(int fd, void const* data, size_t size)
+{
+    char const* p = (char const*)data;
+    while (size > 0)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool recvAll(int fd, void* data, size_t size)
+{
+    char* p = (char*)data;
+    while (size > 0)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+template <typename T>
+static void append(std::vector<uint8_t>& payload, std::vector<T> const& items)
+{
+    uint8_t const* data = (uint8_t const*)items.data();
+    payload.insert(payload.end(), data, data + items.size() * sizeof(T));
+}
+
+// false if payload is too short
+template <typename T>
+static bool extract(std::vector<uint8_t> const& payload, size_t& offset, std::vector<T>& items,
+    size_t count)
+{
+    if (count > (payload.size() - offset) / sizeof(T))
+        return false;
+
+    items.resize(count);
+    memcpy((void*)items.data(), payload.data() + offset, count * sizeof(T));
+    offset += count * sizeof(T);
+    return true;
+}
+
+RestartState::RestartState()
+{
+    memset(&header, 0, sizeof(header));
+    header.magic = RESTART_MAGIC;
+    header.version = RESTART_VERSION;
+    header.headerSize = sizeof(RestartHeader);
+    header.clientSize = sizeof(RestartClient);
+    header.failoverSize = sizeof(FailoverState);
+    header.restartSocketFd = -1;
+    header.listenSocketFd = -1;
+    header.ringFd = -1;
+    header.busSocketFd = -1;
+    for (int i = 0; i < 2; ++i)
+    {
+        header.sources[i].listenFd = -1;
+        header.sources[i].socketFd = -1;
+        header.encoders[i].pid = -1;
+        header.encoders[i].stderrFd = -1;
+        header.encoders[i].childOutputFd = -1;
+        header.encoders[i].resumeUs = 0;
+    }
+}
+
+int32_t RestartState::AddFd(int fd)
+{
+    if (fd < 0)
+        return -1;
+
+    fds.push_back(fd);
+    return fds.size() - 1;
+}
+
+int RestartState::TakeFd(int32_t index)
+{
+    if (index < 0 || (size_t)index >= fds.size())
+        return -1;
+
+    int fd = fds[index];
+    fds[index] = -1;
+    return fd;
+}
+
+void RestartState::CloseFds()
+{
+    for (int& fd : fds)
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+}
+
+HotRestart::~HotRestart()
+{
+    Close();
+}
+
+bool HotRestart::GetAddress(std::string const& name, sockaddr_un& addr, socklen_t& addrLen)
+{
+    // abstract namespace, same as SourceBus
+    std::string path = "iss_restart_" + name;
+    if (path.size() + 1 > sizeof(addr.sun_path))
+    {
+        LOG_ERROR("Hot restart name %s is too long", name.c_str());
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, path.c_str(), path.size());
+    addrLen = offsetof(sockaddr_un, sun_path) + 1 + path.size();
+    return true;
+}
+
+bool HotRestart::Listen(std::string const& name)
+{
+    sockaddr_un addr;
+    socklen_t addrLen = 0;
+    if (!GetAddress(name, addr, addrLen))
+        return false;
+
+    _listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (_listenFd < 0 || bind(_listenFd, (sockaddr*)&addr, addrLen) < 0 ||
+        listen(_listenFd, 1) < 0)
+    {
+        LOG_ERROR("Failed to open hot restart socket %s, is the stream already running?",
+            name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void HotRestart::ListenInherited(int socketFd)
+{
+    _listenFd = socketFd;
+}
+
+bool HotRestart::Accept()
+{
+    if (_listenFd < 0 || _peerFd >= 0)
+        return false;
+
+    _peerFd = accept4(_listenFd, NULL, NULL, SOCK_CLOEXEC);
+    if (_peerFd < 0)
+        return false;
+
+    // it's handed every viewer's socket, only one of ours gets to take over
+    if (!isPeerOurs(_peerFd))
+    {
+        LOG_ERROR("Refusing hot restart from a process of another user");
+        ClosePeer();
+        return false;
+    }
+
+    // a successor that hangs can't hold the stream for long
+    timeval timeout = { RESTART_TIMEOUT / 1000, (RESTART_TIMEOUT % 1000) * 1000 };
+    setsockopt(_peerFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(_peerFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return true;
+}
+
+bool HotRestart::HandOver(RestartState const& state)
+{
+    RestartHeader header = state.header;
+    header.subStreamCount = state.subStreamFds.size() / 2;
+    header.busSubscriberCount = state.busSubscriberFds.size();
+    header.clientCount = state.clients.size();
+    header.readySize = state.readyData.size();
+    header.rawSize = state.rawData.size();
+    header.fdCount = state.fds.size();
+
+    std::vector<uint8_t> payload((uint8_t const*)&header, (uint8_t const*)(&header + 1));
+    append(payload, state.subStreamFds);
+    append(payload, state.busSubscriberFds);
+    append(payload, state.clients);
+    append(payload, state.readyData);
+    append(payload, state.rawData);
+
+    // fds come last, so the payload can be read without picking them up
+    uint64_t size = payload.size();
+    char reply = 0;
+    bool isDone = sendAll(_peerFd, &size, sizeof(size)) &&
+        sendAll(_peerFd, payload.data(), payload.size()) && SendFds(state.fds) &&
+        recvAll(_peerFd, &reply, 1) && reply == RESTART_READY;
+
+    // no go, successor gives up on its own
+    char go = RESTART_GO;
+    if (isDone)
+        isDone = sendAll(_peerFd, &go, 1);
+
+    ClosePeer();
+    return isDone;
+}
+
+bool HotRestart::Connect(std::string const& name)
+{
+    sockaddr_un addr;
+    socklen_t addrLen = 0;
+    if (!GetAddress(name, addr, addrLen))
+        return false;
+
+    _peerFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (_peerFd < 0 || connect(_peerFd, (sockaddr*)&addr, addrLen) < 0)
+    {
+        ClosePeer();
+        return false;
+    }
+
+    // anyone can bind an abstract name first, we only take over from our own
+    if (!isPeerOurs(_peerFd))
+    {
+        LOG_ERROR("Hot restart socket %s belongs to another user", name.c_str());
+        ClosePeer();
+        return false;
+    }
+
+    timeval timeout = { RESTART_TIMEOUT / 1000, (RESTART_TIMEOUT % 1000) * 1000 };
+    setsockopt(_peerFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(_peerFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return true;
+}
+
+bool HotRestart::Receive(RestartState& state)
+{
+    uint64_t size = 0;
+    std::vector<uint8_t> payload;
+    size_t const layoutSize = offsetof(RestartHeader, streamName);
+    if (!recvAll(_peerFd, &size, sizeof(size)) || size < layoutSize ||
+        size > RESTART_MAX_PAYLOAD)
+    {
+        LOG_ERROR("Streamer we take over from sent nothing usable");
+        return false;
+    }
+
+    payload.resize(size);
+    if (!recvAll(_peerFd, payload.data(), size))
+    {
+        LOG_ERROR("Streamer we take over from went away");
+        return false;
+    }
+
+    // layout first, the rest is only read if it's the same as ours
+    RestartHeader& header = state.header;
+    RestartHeader const expected = state.header;
+    memcpy(&header, payload.data(), layoutSize);
+    if (header.magic != RESTART_MAGIC || header.version != expected.version ||
+        header.headerSize != expected.headerSize || header.clientSize != expected.clientSize ||
+        header.failoverSize != expected.failoverSize || size < sizeof(header))
+    {
+        LOG_ERROR("Streamer we take over from runs an incompatible version (%u, ours is %u)",
+            header.version, expected.version);
+        return false;
+    }
+
+    memcpy(&header, payload.data(), sizeof(header));
+    size_t offset = sizeof(header);
+    if (!extract(payload, offset, state.subStreamFds, header.subStreamCount * 2) ||
+        !extract(payload, offset, state.busSubscriberFds, header.busSubscriberCount) ||
+        !extract(payload, offset, state.clients, header.clientCount) ||
+        !extract(payload, offset, state.readyData, header.readySize) ||
+        !extract(payload, offset, state.rawData, header.rawSize))
+    {
+        LOG_ERROR("Streamer we take over from sent a truncated state");
+        return false;
+    }
+
+    header.streamName[RESTART_NAME_SIZE - 1] = 0;
+    return ReceiveFds(state.fds, header.fdCount);
+}
+
+bool HotRestart::TakeOver()
+{
+    char ready = RESTART_READY;
+    char reply = 0;
+    bool isDone = sendAll(_peerFd, &ready, 1) && recvAll(_peerFd, &reply, 1) &&
+        reply == RESTART_GO;
+
+    ClosePeer();
+    return isDone;
+}
+
+bool HotRestart::SendFds(std::vector<int> const& fds)
+{
+    for (size_t i = 0; i < fds.size(); i += RESTART_FD_BATCH)
+    {
+        size_t count = std::min(fds.size() - i, (size_t)RESTART_FD_BATCH);
+        char data = 0;
+        std::vector<char> control(CMSG_SPACE(count * sizeof(int)), 0);
+        iovec iov = { &data, sizeof(data) };
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fds[i], count * sizeof(int));
+
+        if (sendmsg(_peerFd, &msg, MSG_NOSIGNAL) < 0)
+        {
+            LOG_ERROR("Failed to hand over fds: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool HotRestart::ReceiveFds(std::vector<int>& fds, size_t count)
+{
+    fds.clear();
+    while (fds.size() < count)
+    {
+        size_t batch = std::min(count - fds.size(), (size_t)RESTART_FD_BATCH);
+        char data = 0;
+        std::vector<char> control(CMSG_SPACE(batch * sizeof(int)), 0);
+        iovec iov = { &data, sizeof(data) };
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        // encoders we start don't get viewers' sockets
+        if (recvmsg(_peerFd, &msg, MSG_CMSG_CLOEXEC) <= 0 || (msg.msg_flags & MSG_CTRUNC))
+        {
+            LOG_ERROR("Failed to take over fds, is the fd limit high enough?");
+            break;
+        }
+
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+            cmsg->cmsg_len != CMSG_LEN(batch * sizeof(int)))
+        {
+            LOG_ERROR("Streamer we take over from sent bad fds");
+            break;
+        }
+
+        size_t offset = fds.size();
+        fds.resize(offset + batch);
+        memcpy(&fds[offset], CMSG_DATA(cmsg), batch * sizeof(int));
+    }
+
+    return fds.size() == count;
+}
+
+void HotRestart::ClosePeer()
+{
+    if (_peerFd >= 0)
+        close(_peerFd);
+    _peerFd = -1;
+}
+
+void HotRestart::Close()
+{
+    ClosePeer();
+
+    if (_listenFd >= 0)
+        close(_listenFd);
+    _listenFd = -1;
+}
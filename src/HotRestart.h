@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "Failover.h"
+
+#define RESTART_MAGIC 0x3154535253534949ULL // "IISSRST1"
+// structs below are copied as they are, bump on any change to them
+#define RESTART_VERSION 2
+#define RESTART_TIMEOUT 5000    // ms either side waits on the other
+#define RESTART_NAME_SIZE 64
+
+// fds in the structs below are indexes into RestartState::fds, -1 if none
+
+struct RestartSource
+{
+    int32_t listenFd;
+    int32_t socketFd;
+};
+
+// encoder feeding a source
+struct RestartEncoder
+{
+    int32_t pid;            // 0 if waiting to be restarted, -1 if none or finished
+    int32_t stderrFd;
+    int32_t childOutputFd;
+    int64_t resumeUs;       // where in the input its run started
+};
+
+struct RestartClient
+{
+    int32_t fd;             // -1 for UDP clients
+    sockaddr_in addr;
+    uint64_t seq;
+    uint32_t offset;
+    uint8_t rendition;
+    uint8_t flags;
+};
+
+struct RestartHeader
+{
+    // both sides have to agree on these, before anything else is read
+    uint64_t magic;
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t clientSize;
+    uint32_t failoverSize;
+    char streamName[RESTART_NAME_SIZE];
+    // viewers' renditions are indexes, both sides must have the same ones
+    uint32_t renditionCount;
+    int32_t restartSocketFd;
+    int32_t listenSocketFd;
+    int32_t ringFd;         // -1 if ring is a bus subscriber's
+    int32_t busSocketFd;    // -1 if not publishing
+    RestartSource sources[2];   // primary, standby
+    RestartEncoder encoders[2];
+    FailoverState failover;
+    uint64_t udpSeq;
+
+    // sizes of what follows the header
+    uint32_t subStreamCount;
+    uint32_t busSubscriberCount;
+    uint32_t clientCount;
+    uint32_t readySize;
+    uint32_t rawSize;
+    uint32_t fdCount;
+};
+
+// Everything a streamer hands over on hot restart
+struct RestartState
+{
+    RestartState();
+
+    // index of fd in fds, -1 for -1
+    int32_t AddFd(int fd);
+    // fd at index, -1 for -1, it's the caller's from then on
+    int TakeFd(int32_t index);
+    // closes fds nobody took, receiving side only
+    void CloseFds();
+
+    RestartHeader header;
+    std::vector<int32_t> subStreamFds;      // listen socket and ring, per sub stream
+    std::vector<int32_t> busSubscriberFds;
+    std::vector<RestartClient> clients;
+    std::vector<uint8_t> readyData;         // see FailoverSource::Save()
+    std::vector<uint8_t> rawData;
+    std::vector<int> fds;
+};
+
+// Hot restart, a new streamer binary takes over a running stream
+// A streamer run with --hot_restart waits for a successor on an abstract unix
+// socket ("iss_restart_$name"). A new one run with the same options connects
+// to it, and is handed the listen sockets, broadcast rings, sources, running
+// encoders and viewers' connections, fds passed with SCM_RIGHTS, along with
+// viewers' cursors and whatever data was on its way through. Rings are memfds
+// the new streamer maps as they are, so cursors stay valid and viewers carry
+// on mid-chunk, and the stream stays announced to the Portal all along.
+// Handover is two-phase: the successor sets up what it was sent, says it's
+// ready, and only takes over once told to go, after which the old streamer
+// exits. Up to then the old one can carry on as if nothing happened, so a
+// successor that fails to start can't take the stream down with it.
+class HotRestart
+{
+public:
+    HotRestart() { }
+    ~HotRestart();
+
+    // running side
+    bool Listen(std::string const& name);
+    // same, on the socket the streamer we took over from listened on
+    void ListenInherited(int socketFd);
+    int GetListenFd() const { return _listenFd; }
+    // non blocking, true if a successor connected
+    bool Accept();
+    // true once the successor took over, we're done then
+    bool HandOver(RestartState const& state);
+
+    // successor side, false if nobody runs the stream
+    bool Connect(std::string const& name);
+    bool Receive(RestartState& state);
+    // true once the old streamer let go, stream is ours then
+    bool TakeOver();
+
+    void Close();
+
+private:
+    static bool GetAddress(std::string const& name, struct sockaddr_un& addr, socklen_t& addrLen);
+    bool SendFds(std::vector<int> const& fds);
+    bool ReceiveFds(std::vector<int>& fds, size_t count);
+    void ClosePeer();
+
+private:
+    int _listenFd = -1;
+    int _peerFd = -1;
+};
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <strings.h>
+#include <sstream>
+
+#include "Http.h"
+
+static void parseQuery(std::string const& query, std::map<std::string, std::string>& params)
+{
+    std::string param;
+    std::stringstream ss(query);
+    while (std::getline(ss, param, '&'))
+    {
+        size_t equals = param.find('=');
+        if (equals == std::string::npos)
+            params[param] = "";
+        else
+            params[param.substr(0, equals)] = param.substr(equals + 1);
+    }
+}
+
+static bool parseRange(std::string const& value, HttpRequest& request)
+{
+    // only single ranges are supported, e.g "bytes=100-", "bytes=100-200", "bytes=-100"
+    if (value.compare(0, 6, "bytes=") != 0 || value.find(',') != std::string::npos)
+        return false;
+
+    std::string range = value.substr(6);
+    size_t dash = range.find('-');
+    if (dash == std::string::npos)
+        return false;
+
+    request.hasRange = true;
+    if (dash == 0)
+    {
+        request.rangeSuffix = atoll(range.c_str() + 1);
+        return true;
+    }
+
+    request.rangeStart = strtoull(range.c_str(), NULL, 10);
+    if (dash + 1 < range.size())
+        request.rangeEnd = atoll(range.c_str() + dash + 1);
+
+    return request.rangeEnd < 0 || (uint64_t)request.rangeEnd >= request.rangeStart;
+}
+
+int httpParseRequest(std::string const& data, HttpRequest& request)
+{
+    size_t headerEnd = data.find("\r\n\r\n");
+    if (headerEnd == std::string::npos)
+        return data.size() < HTTP_MAX_REQUEST_SIZE ? 0 : -1;
+
+    std::stringstream ss(data.substr(0, headerEnd));
+    std::string line;
+
+    // request line: "GET /path?query HTTP/1.1"
+    std::getline(ss, line);
+    std::stringstream requestLine(line);
+    std::string target;
+    std::string version;
+    requestLine >> request.method >> target >> version;
+    if (request.method.empty() || target.empty() || version.compare(0, 5, "HTTP/") != 0)
+        return -1;
+
+    size_t queryStart = target.find('?');
+    request.path = target.substr(0, queryStart);
+    if (queryStart != std::string::npos)
+        parseQuery(target.substr(queryStart + 1), request.query);
+
+    while (std::getline(ss, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+
+        std::string name = line.substr(0, colon);
+        size_t valueStart = line.find_first_not_of(' ', colon + 1);
+        std::string value = valueStart == std::string::npos ? "" : line.substr(valueStart);
+
+        if (strcasecmp(name.c_str(), "Range") == 0 && !parseRange(value, request))
+            return -1;
+    }
+
+    return 1;
+}
+
+std::string httpResponse(int status, std::string const& extraHeaders)
+{
+    char const* reason = "OK";
+    switch (status)
+    {
+        case 200: reason = "OK"; break;
+        case 206: reason = "Partial Content"; break;
+        case 400: reason = "Bad Request"; break;
+        case 404: reason = "Not Found"; break;
+        case 405: reason = "Method Not Allowed"; break;
+        case 416: reason = "Range Not Satisfiable"; break;
+        case 503: reason = "Service Unavailable"; break;
+        default: break;
+    }
+
+    return "HTTP/1.1 " + std::to_string(status) + " " + reason + "\r\n" +
+        extraHeaders +
+        "Connection: close\r\n\r\n";
+}
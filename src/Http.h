@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <map>
+
+// Bare minimum HTTP/1.x request handling, enough for players like ffplay
+// to open, seek (Range) and timeshift streams
+
+#define HTTP_MAX_REQUEST_SIZE 4096
+
+struct HttpRequest
+{
+    std::string method;
+    std::string path; // without query string
+    std::map<std::string, std::string> query;
+
+    // "Range: bytes=start-end" header, end is inclusive
+    bool hasRange = false;
+    uint64_t rangeStart = 0;
+    int64_t rangeEnd = -1;      // -1 if open ended
+    int64_t rangeSuffix = -1;   // "bytes=-n" form, last n bytes
+};
+
+// returns 1 if a full request was parsed, 0 if more data is needed,
+// -1 if request is malformed
+int httpParseRequest(std::string const& data, HttpRequest& request);
+
+// status line plus headers, extraHeaders must be "\r\n" terminated lines
+std::string httpResponse(int status, std::string const& extraHeaders = "");
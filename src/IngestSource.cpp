@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <algorithm>
+
+#include "IngestSource.h"
+#include "TSParser.h"
+#include "Util.h"
+
+#define INGEST_STATS_INTERVAL (10 * 1000)
+
+IngestSource::~IngestSource()
+{
+    Close();
+}
+
+bool IngestSource::ParseUrl(std::string const& url, sockaddr_in& addr)
+{
+    // format: transport://host:port
+    size_t schemeEnd = url.find("://");
+    size_t portStart = url.rfind(':');
+    if (schemeEnd == std::string::npos || portStart <= schemeEnd)
+        return false;
+
+    std::string transport = url.substr(0, schemeEnd);
+    std::string host = url.substr(schemeEnd + 3, portStart - schemeEnd - 3);
+    int port = atoi(url.c_str() + portStart + 1);
+
+    if (transport == "tcp")
+        _isTcp = true;
+    else if (transport == "udp")
+        _isTcp = false;
+    else
+    {
+        LOG_ERROR("Unsupported ingest transport '%s'", transport.c_str());
+        return false;
+    }
+
+    bzero((char*)&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (!host.empty() && host != "0.0.0.0")
+    {
+        hostent* server = gethostbyname(host.c_str());
+        if (!server)
+        {
+            LOG_ERROR("Unknown ingest host %s", host.c_str());
+            return false;
+        }
+
+        bcopy((char*)server->h_addr, (char*)&addr.sin_addr.s_addr, server->h_length);
+    }
+
+    return port > 0;
+}
+
+bool IngestSource::Initialize(std::string const& url, std::string const& name)
+{
+    memset(_lastCC, -1, sizeof(_lastCC));
+    _name = name;
+
+    sockaddr_in addr;
+    if (!ParseUrl(url, addr))
+    {
+        LOG_ERROR("Invalid ingest url %s", url.c_str());
+        return false;
+    }
+
+    _listenSocketFd = socket(AF_INET, (_isTcp ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (_listenSocketFd < 0)
+    {
+        LOG_ERROR("Failed to initialize ingest socket");
+        return false;
+    }
+
+    int setVal = 1;
+    setsockopt(_listenSocketFd, SOL_SOCKET, SO_REUSEADDR, &setVal, sizeof(int));
+
+    bool isMulticast = !_isTcp && IN_MULTICAST(ntohl(addr.sin_addr.s_addr));
+    if (bind(_listenSocketFd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        LOG_ERROR("Failed to bind ingest socket");
+        return false;
+    }
+
+    if (_isTcp)
+    {
+        if (listen(_listenSocketFd, 1) < 0)
+        {
+            LOG_ERROR("Failed to open ingest socket");
+            return false;
+        }
+    }
+    else
+    {
+        // encoders send in bursts, give the kernel room to hold them
+        int bufferSize = 4 * 1024 * 1024;
+        setsockopt(_listenSocketFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(int));
+
+        if (isMulticast)
+        {
+            ip_mreq mreq;
+            mreq.imr_multiaddr = addr.sin_addr;
+            mreq.imr_interface.s_addr = INADDR_ANY;
+            if (setsockopt(_listenSocketFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+            {
+                LOG_ERROR("Failed to join multicast group");
+                return false;
+            }
+        }
+
+        _socketFd = _listenSocketFd;
+    }
+
+    _lastLogMs = getMSTime();
+    LOG_INFO("Waiting for %s on %s", name.c_str(), url.c_str());
+    return true;
+}
+
+bool IngestSource::InitializeConnected(int socketFd, std::string const& name)
+{
+    memset(_lastCC, -1, sizeof(_lastCC));
+    _name = name;
+    _isTcp = true;
+    _canReconnect = false;
+    _socketFd = socketFd;
+    _lastLogMs = getMSTime();
+    return true;
+}
+
+bool IngestSource::InitializeInherited(std::string const& url, std::string const& name,
+    int listenSocketFd, int socketFd)
+{
+    memset(_lastCC, -1, sizeof(_lastCC));
+    _name = name;
+
+    sockaddr_in addr;
+    if (!ParseUrl(url, addr))
+    {
+        LOG_ERROR("Invalid ingest url %s", url.c_str());
+        return false;
+    }
+
+    _listenSocketFd = listenSocketFd;
+    _socketFd = _isTcp ? socketFd : listenSocketFd;
+    if (!_isTcp && socketFd >= 0 && socketFd != listenSocketFd)
+        close(socketFd);
+
+    _lastLogMs = getMSTime();
+    LOG_INFO("Took over %s on %s", name.c_str(), url.c_str());
+    return true;
+}
+
+void IngestSource::Close()
+{
+    if (_socketFd >= 0 && _socketFd != _listenSocketFd)
+        close(_socketFd);
+
+    if (_listenSocketFd >= 0)
+        close(_listenSocketFd);
+
+    _socketFd = -1;
+    _listenSocketFd = -1;
+}
+
+void IngestSource::TakeBuffered(std::vector<uint8_t>& data)
+{
+    data.insert(data.end(), _buffer, _buffer + _size);
+    _size = 0;
+    _validSize = 0;
+}
+
+void IngestSource::Preload(std::vector<uint8_t> const& data)
+{
+    // validated again, it's only a few packets
+    size_t size = std::min(data.size(), sizeof(_buffer) - _size);
+    memcpy(_buffer + _size, data.data(), size);
+    _size += size;
+    Validate();
+}
+
+void IngestSource::Take(char* buffer, size_t size)
+{
+    memcpy(buffer, _buffer, size);
+    memmove(_buffer, _buffer + size, _size - size);
+    _size -= size;
+    _validSize -= size;
+
+    LogStats();
+}
+
+bool IngestSource::Receive()
+{
+    // wait for an encoder to connect
+    if (_socketFd < 0)
+    {
+        sockaddr_in encoderAddr;
+        socklen_t addrLen = sizeof(encoderAddr);
+        _socketFd = accept4(_listenSocketFd, (sockaddr*)&encoderAddr, &addrLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (_socketFd < 0)
+            return true;
+
+        LOG_INFO("%s connected from %s", _name.c_str(), inet_ntoa(encoderAddr.sin_addr));
+
+        // new connection, new packet alignment
+        _inSync = false;
+        _size = _validSize;
+        return true;
+    }
+
+    // owner hasn't taken anything yet, a zero sized recv would look like EOF
+    if (_size == sizeof(_buffer))
+        return true;
+
+    ssize_t n = recv(_socketFd, _buffer + _size, sizeof(_buffer) - _size, MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return true;
+
+    if (n <= 0 && _isTcp)
+    {
+        if (!_canReconnect)
+        {
+            LOG_INFO("%s closed", _name.c_str());
+            return false;
+        }
+
+        // keep the stream up, another encoder (or the same one) can reconnect
+        LOG_INFO("%s disconnected, waiting for a new one", _name.c_str());
+        close(_socketFd);
+        _socketFd = -1;
+        return true;
+    }
+
+    if (n > 0)
+    {
+        _size += n;
+        _lastDataMs = getMSTime();
+        Validate();
+    }
+
+    return true;
+}
+
+void IngestSource::Validate()
+{
+    // walk data after the validated region, moving good packets down into it
+    size_t offset = _validSize;
+    while (_size - offset >= TS_PACKET_SIZE)
+    {
+        uint8_t* pkt = _buffer + offset;
+
+        // in sync, runs of packets are checked at once
+        size_t count = _inSync ? tsCountSynced(pkt, (_size - offset) / TS_PACKET_SIZE) : 0;
+        if (count > 0)
+        {
+            for (size_t i = 0; i < count; ++i)
+                CheckContinuity(pkt + i * TS_PACKET_SIZE);
+
+            _stats.packets += count;
+            if (offset != _validSize)
+                memmove(_buffer + _validSize, pkt, count * TS_PACKET_SIZE);
+
+            _validSize += count * TS_PACKET_SIZE;
+            offset += count * TS_PACKET_SIZE;
+            continue;
+        }
+
+        // when out of sync, a sync byte only counts if the next packet has one too
+        bool synced = tsIsSynced(pkt);
+        if (synced && !_inSync && _size - offset >= 2 * TS_PACKET_SIZE)
+            synced = tsIsSynced(pkt + TS_PACKET_SIZE);
+        else if (synced && !_inSync)
+            break; // wait for more data to confirm
+
+        if (!synced)
+        {
+            if (_inSync)
+            {
+                ++_stats.syncLosses;
+                _inSync = false;
+            }
+
+            ++_stats.bytesDropped;
+            ++offset;
+            continue;
+        }
+
+        _inSync = true;
+        CheckContinuity(pkt);
+        ++_stats.packets;
+
+        if (offset != _validSize)
+            memmove(_buffer + _validSize, pkt, TS_PACKET_SIZE);
+
+        _validSize += TS_PACKET_SIZE;
+        offset += TS_PACKET_SIZE;
+    }
+
+    // keep leftover partial packet right after the valid region
+    if (offset != _validSize)
+        memmove(_buffer + _validSize, _buffer + offset, _size - offset);
+
+    _size = _validSize + (_size - offset);
+}
+
+void IngestSource::CheckContinuity(uint8_t const* pkt)
+{
+    if (tsHasTransportError(pkt))
+        ++_stats.transportErrors;
+
+    uint16_t pid = tsGetPid(pkt);
+    if (pid == TS_NULL_PID)
+        return;
+
+    // counter only increments on packets with payload, one duplicate is allowed
+    int8_t cc = tsGetContinuityCounter(pkt);
+    int8_t last = _lastCC[pid];
+    if (last >= 0 && !tsIsDiscontinuity(pkt))
+    {
+        int8_t expected = tsHasPayload(pkt) ? (last + 1) & 0x0F : last;
+        if (cc != expected && !(tsHasPayload(pkt) && cc == last))
+            ++_stats.ccErrors;
+    }
+
+    _lastCC[pid] = cc;
+}
+
+void IngestSource::LogStats()
+{
+    long now = getMSTime();
+    if (now - _lastLogMs < INGEST_STATS_INTERVAL)
+        return;
+
+    _lastLogMs = now;
+
+    // only worth a log line if something went wrong
+    if (_stats.syncLosses == _loggedStats.syncLosses &&
+        _stats.ccErrors == _loggedStats.ccErrors &&
+        _stats.transportErrors == _loggedStats.transportErrors)
+        return;
+
+    LOG_INFO("%s: %lu packets, %lu sync losses (%lu bytes dropped), "
+        "%lu continuity errors, %lu transport errors", _name.c_str(),
+        (unsigned long)_stats.packets, (unsigned long)_stats.syncLosses,
+        (unsigned long)_stats.bytesDropped, (unsigned long)_stats.ccErrors,
+        (unsigned long)_stats.transportErrors);
+    _loggedStats = _stats;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+#include "TSPacket.h"
+
+// room for a full chunk plus the largest UDP datagram
+#define INGEST_BUFFER_SIZE (128 * 1024)
+
+struct IngestStats
+{
+    uint64_t packets = 0;
+    uint64_t bytesDropped = 0;  // garbage skipped while looking for sync
+    uint64_t syncLosses = 0;
+    uint64_t ccErrors = 0;      // continuity counter jumps, i.e lost packets
+    uint64_t transportErrors = 0;
+};
+
+// Live ingest endpoint, remote encoders push MPEG-TS to the streamer
+// Accepts "tcp://host:port" (one encoder connection at a time, a new one can
+// take over when it drops) or "udp://host:port" (multicast groups joined
+// automatically). Data is relayed as is, no transcoding, but it's validated
+// on the way in: only whole, synced TS packets get through, and continuity
+// errors are counted per PID.
+// Can also wrap an already connected socket, e.g to a local ffmpeg instance,
+// which is considered dead once it closes.
+// Non blocking, owner polls GetPollFd() and calls Receive() when readable.
+class IngestSource
+{
+public:
+    IngestSource() { }
+    ~IngestSource();
+
+    bool Initialize(std::string const& url, std::string const& name);
+    bool InitializeConnected(int socketFd, std::string const& name);
+    // sockets of a source another streamer process had open, on hot restart
+    // socketFd is -1 if no encoder is connected, or the same as listenSocketFd for UDP
+    bool InitializeInherited(std::string const& url, std::string const& name,
+        int listenSocketFd, int socketFd);
+    void Close();
+
+    bool IsInitialized() const { return _listenSocketFd >= 0 || _socketFd >= 0; }
+    std::string const& GetName() const { return _name; }
+    int GetPollFd() const { return _socketFd >= 0 ? _socketFd : _listenSocketFd; }
+    int GetListenFd() const { return _listenSocketFd; }
+    int GetSocketFd() const { return _socketFd; }
+
+    // accepts/receives whatever is pending, false if source is gone for good
+    bool Receive();
+
+    // validated packets ready to be taken, always whole packets
+    size_t GetReadySize() const { return _validSize; }
+    void Take(char* buffer, size_t size);
+
+    long GetLastDataMs() const { return _lastDataMs; }
+
+    // hot restart, everything received and not taken yet, validated or not,
+    // moves to data, to be preloaded into the source that carries on
+    void TakeBuffered(std::vector<uint8_t>& data);
+    void Preload(std::vector<uint8_t> const& data);
+    IngestStats const& GetStats() const { return _stats; }
+
+private:
+    bool ParseUrl(std::string const& url, sockaddr_in& addr);
+    void Validate();
+    void CheckContinuity(uint8_t const* pkt);
+    void LogStats();
+
+private:
+    std::string _name;
+    bool _isTcp = true;
+    bool _canReconnect = true;
+    int _listenSocketFd = -1;
+    int _socketFd = -1; // connected encoder for tcp, same as listen socket for udp
+
+    // validated packets come first, followed by data not yet validated
+    uint8_t _buffer[INGEST_BUFFER_SIZE];
+    size_t _size = 0;
+    size_t _validSize = 0;
+    bool _inSync = false;
+
+    int8_t _lastCC[TS_PID_COUNT];
+    IngestStats _stats;
+    IngestStats _loggedStats;
+    long _lastLogMs = 0;
+    long _lastDataMs = 0;
+};
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <fstream>
+
+#include "Metrics.h"
+#include "Util.h"
+
+bool Metrics::Initialize(std::string const& filePath, std::string const& streamName)
+{
+    // label values escape \ and "
+    std::string escaped;
+    for (char c : streamName)
+    {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        escaped += c;
+    }
+
+    _filePath = filePath;
+    _streamLabel = "stream=\"" + escaped + "\"";
+
+    std::ofstream file(_filePath + ".tmp");
+    if (!file)
+    {
+        LOG_ERROR("Failed to open metrics file %s", _filePath.c_str());
+        _filePath.clear();
+        return false;
+    }
+
+    return true;
+}
+
+void Metrics::SetGauge(std::string const& name, double value, std::string const& help,
+    std::string const& extraLabels)
+{
+    Set(name, "gauge", value, help, extraLabels);
+}
+
+void Metrics::SetCounter(std::string const& name, double value, std::string const& help,
+    std::string const& extraLabels)
+{
+    Set(name, "counter", value, help, extraLabels);
+}
+
+void Metrics::Set(std::string const& name, std::string const& type, double value,
+    std::string const& help, std::string const& extraLabels)
+{
+    if (_filePath.empty())
+        return;
+
+    std::string labels = _streamLabel;
+    if (!extraLabels.empty())
+        labels += "," + extraLabels;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    Family& family = _families[name];
+    family.type = type;
+    family.help = help;
+    family.values[labels] = value;
+}
+
+void Metrics::Flush()
+{
+    if (_filePath.empty())
+        return;
+
+    long now = getMSTime();
+    if (now - _lastFlushMs < METRICS_FLUSH_INTERVAL)
+        return;
+
+    _lastFlushMs = now;
+
+    // written aside and renamed, so the collector never reads a partial file
+    std::string tmpPath = _filePath + ".tmp";
+    {
+        std::ofstream file(tmpPath);
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto const& family : _families)
+        {
+            file << "# HELP " << family.first << " " << family.second.help << "\n";
+            file << "# TYPE " << family.first << " " << family.second.type << "\n";
+            for (auto const& value : family.second.values)
+                file << family.first << "{" << value.first << "} " << value.second << "\n";
+        }
+
+        if (!file)
+            return;
+    }
+
+    rename(tmpPath.c_str(), _filePath.c_str());
+}
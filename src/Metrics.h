@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+
+#define METRICS_FLUSH_INTERVAL 1000 // ms
+
+// Stream metrics, exported in Prometheus text format to a file, meant for
+// node_exporter's textfile collector (or anything else that can read it)
+// Every metric gets the stream label, values are set by their owners at their
+// own pace and written out by whoever calls Flush() periodically.
+// Disabled (all calls are no-ops) unless initialized with a file path.
+class Metrics
+{
+public:
+    Metrics() { }
+
+    bool Initialize(std::string const& filePath, std::string const& streamName);
+    bool IsEnabled() const { return !_filePath.empty(); }
+
+    // extraLabels are added after the stream label, e.g "backend=\"epoll\""
+    void SetGauge(std::string const& name, double value, std::string const& help,
+        std::string const& extraLabels = "");
+    void SetCounter(std::string const& name, double value, std::string const& help,
+        std::string const& extraLabels = "");
+
+    // writes file if METRICS_FLUSH_INTERVAL passed since last time
+    void Flush();
+
+private:
+    void Set(std::string const& name, std::string const& type, double value,
+        std::string const& help, std::string const& extraLabels);
+
+private:
+    struct Family
+    {
+        std::string type;
+        std::string help;
+        std::map<std::string, double> values; // labels to value
+    };
+
+    std::string _filePath;
+    std::string _streamLabel;
+    long _lastFlushMs = 0;
+
+    std::mutex _mutex;
+    std::map<std::string, Family> _families;
+};
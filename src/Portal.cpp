@@ -4,6 +4,11 @@
 #include <IceUtil/IceUtil.h>
 #include <IceStorm/IceStorm.h>
 
+#include <algorithm>
+
+// replicas handed out per stream, best one included; clients race them
+#define PORTAL_MAX_REPLICAS 3
+
 using namespace StreamingService;
 
 int main(int argc, char* argv[])
@@ -18,17 +23,25 @@ void Portal::NewStream(StreamEntry const& entry, Ice::Current const& /*curr*/)
 {
     UpdateNotifier();
 
+    // same name from another streamer is a replica of the stream
     std::string const& name = entry.streamName;
-    auto itr = _streams.find(name);
-    if (itr == _streams.end())
-        _streams[name] = entry;
-    else
+    std::vector<StreamEntry>& replicas = _streams[name];
+    for (StreamEntry const& replica : replicas)
     {
-        LOG_ERROR("stream with name %s already exists", name.c_str());
-        return;
+        if (replica.endpoint == entry.endpoint)
+        {
+            LOG_ERROR("stream with name %s already exists at %s", name.c_str(),
+                entry.endpoint.c_str());
+            return;
+        }
     }
 
-    _notifier->NotifyStreamAdded(entry);
+    replicas.push_back(entry);
+    if (replicas.size() > 1)
+        LOG_INFO("stream %s has a replica at %s", name.c_str(), entry.endpoint.c_str());
+
+    // clients replace what they have on a name they know
+    _notifier->NotifyStreamAdded(GetEntry(name));
 }
 
 void Portal::CloseStream(StreamEntry const& entry, Ice::Current const& /*curr*/)
@@ -37,29 +50,101 @@ void Portal::CloseStream(StreamEntry const& entry, Ice::Current const& /*curr*/)
 
     std::string const& name = entry.streamName;
     auto itr = _streams.find(name);
-    if (itr != _streams.end())
-        _streams.erase(itr);
-    else
+    if (itr == _streams.end())
     {
         LOG_ERROR("stream %s not found", name.c_str());
         return;
     }
 
-    _notifier->NotifyStreamRemoved(entry);
+    std::vector<StreamEntry>& replicas = itr->second;
+    auto replica = std::find_if(replicas.begin(), replicas.end(),
+        [&](StreamEntry const& e) { return e.endpoint == entry.endpoint; });
+    if (replica == replicas.end())
+    {
+        LOG_ERROR("stream %s not found at %s", name.c_str(), entry.endpoint.c_str());
+        return;
+    }
+
+    replicas.erase(replica);
+    _health.erase(entry.endpoint);
+    if (replicas.empty())
+    {
+        _streams.erase(itr);
+        _notifier->NotifyStreamRemoved(entry);
+    }
+    else
+        _notifier->NotifyStreamAdded(GetEntry(name));
+}
+
+void Portal::ReportHealth(StreamHealth const& health, Ice::Current const& /*curr*/)
+{
+    std::string const& name = health.streamName;
+    if (_streams.find(name) == _streams.end())
+        return;
+
+    // only changes are worth a log line
+    auto itr = _health.find(health.endpoint);
+    bool wasHealthy = itr == _health.end() || itr->second.isHealthy;
+    if (wasHealthy && !health.isHealthy)
+    {
+        LOG_ERROR("stream %s at %s is unhealthy: %lld cc, %lld PAT, %lld PMT, %lld PCR errors, "
+            "%lld PCR discontinuities, keyframe %dms ago, %lld of %lld bit/s", name.c_str(),
+            health.endpoint.c_str(), (long long)health.ccErrors, (long long)health.patErrors,
+            (long long)health.pmtErrors, (long long)health.pcrErrors,
+            (long long)health.pcrDiscontinuities, health.keyframeAgeMs,
+            (long long)health.measuredBitRate, (long long)health.declaredBitRate);
+    }
+    else if (!wasHealthy && health.isHealthy)
+        LOG_INFO("stream %s at %s is healthy again", name.c_str(), health.endpoint.c_str());
+
+    _health[health.endpoint] = health;
+
+    // replicas are ranked by health, clients get the new order
+    if (wasHealthy != health.isHealthy)
+    {
+        UpdateNotifier();
+        _notifier->NotifyStreamAdded(GetEntry(name));
+    }
 }
 
 StreamList Portal::GetStreamList(Ice::Current const& /*curr*/)
 {
     StreamList streamList;
     for (auto const& itr : _streams)
-    {
-        StreamEntry const& entry = itr.second;
-        streamList.push_back(entry);
-    }
+        streamList.push_back(GetEntry(itr.first));
 
     return streamList;
 }
 
+StreamEntry Portal::GetEntry(std::string const& name) const
+{
+    std::vector<StreamEntry> const& replicas = _streams.at(name);
+
+    // healthy ones first, then in the order they came up; no heartbeat yet
+    // counts as healthy, a new replica is as good as any until it says otherwise
+    std::vector<StreamEntry const*> ranked;
+    for (StreamEntry const& replica : replicas)
+        ranked.push_back(&replica);
+    std::stable_sort(ranked.begin(), ranked.end(),
+        [this](StreamEntry const* a, StreamEntry const* b)
+        {
+            return IsHealthy(a->endpoint) && !IsHealthy(b->endpoint);
+        });
+
+    StreamEntry entry = *ranked[0];
+    entry.replicas.clear();
+    for (size_t i = 1; i < ranked.size() && i < PORTAL_MAX_REPLICAS; ++i)
+        entry.replicas.push_back(ranked[i]->endpoint);
+
+    return entry;
+}
+
+bool Portal::IsHealthy(std::string const& endpoint) const
+{
+    auto itr = _health.find(endpoint);
+    return itr == _health.end() || itr->second.isHealthy;
+}
+
 int Portal::run(int argc, char* argv[])
 {
     Ice::ObjectAdapterPtr adapter =
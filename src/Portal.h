@@ -1,5 +1,6 @@
 #include <string>
 #include <map>
+#include <vector>
 
 #include <Ice/Ice.h>
 #include "PortalInterface.h"
@@ -14,6 +15,7 @@ public:
     // PortalInterface overrides
     void NewStream(StreamEntry const& entry, Ice::Current const& curr) override;
     void CloseStream(StreamEntry const& entry, Ice::Current const& curr) override;
+    void ReportHealth(StreamHealth const& health, Ice::Current const& curr) override;
 
     StreamList GetStreamList(Ice::Current const& curr) override;
 
@@ -22,8 +24,14 @@ public:
 
 private:
     void UpdateNotifier();
+    // best replica's entry, with the next best ones' endpoints
+    StreamEntry GetEntry(std::string const& name) const;
+    bool IsHealthy(std::string const& endpoint) const;
 
 private:
-    std::map<std::string, StreamEntry> _streams;
+    // every streamer's own entry, replicas register the same stream name
+    std::map<std::string, std::vector<StreamEntry>> _streams;
+    // by endpoint
+    std::map<std::string, StreamHealth> _health;
     StreamNotifierInterfacePrx _notifier;
 };
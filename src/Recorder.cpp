@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "Recorder.h"
+#include "Util.h"
+
+#define RECORD_ALIGNMENT 4096
+#define RECORD_BLOCK_SIZE (256 * 1024)
+#define RECORD_BLOCK_COUNT 16
+#define RECORD_PREALLOC_SIZE (64 * 1024 * 1024)
+
+Recorder::Recorder(BroadcastRing const& ring) : RingConsumer(ring, "Recorder") { }
+
+Recorder::~Recorder()
+{
+    Stop();
+    Close();
+}
+
+bool Recorder::Initialize(std::string const& filePath, BufferArena& arena)
+{
+    _filePath = filePath;
+
+    // O_DIRECT isn't supported by every filesystem (e.g tmpfs)
+    _fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+    _isDirect = _fd >= 0;
+    if (!_isDirect)
+        _fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (_fd < 0)
+    {
+        LOG_ERROR("Failed to open recording file %s", filePath.c_str());
+        return false;
+    }
+
+    // arena mappings are page aligned, so are blocks, as O_DIRECT needs them
+    if (!_pool.Initialize(arena, RECORD_BLOCK_SIZE, RECORD_BLOCK_COUNT))
+    {
+        LOG_ERROR("Failed to allocate recording buffers");
+        return false;
+    }
+
+    _blocks.resize(RECORD_BLOCK_COUNT);
+
+    if (!_uring.Initialize(RECORD_BLOCK_COUNT))
+        LOG_INFO("io_uring unavailable, recording with synchronous writes");
+
+    if (!_indexWriter.Open(filePath + ".idx"))
+        return false;
+
+    Preallocate(RECORD_PREALLOC_SIZE);
+
+    LOG_INFO("Recording stream to %s%s", filePath.c_str(), _isDirect ? " (O_DIRECT)" : "");
+    return true;
+}
+
+void Recorder::Close()
+{
+    if (_fd < 0)
+        return;
+
+    if (_uring.IsInitialized())
+    {
+        _uring.Submit();
+        while (_inFlightCount > 0)
+        {
+            // writes still in flight are lost, the file is trimmed all the same
+            if (!ReapCompletions(true))
+            {
+                LOG_ERROR("Failed to wait for %u recording writes: %s", _inFlightCount,
+                    strerror(errno));
+                _writeErrors += _inFlightCount;
+                break;
+            }
+        }
+    }
+
+    // last block is partial, O_DIRECT still needs an aligned write size
+    // so pad it and trim the file afterwards
+    if (_current && _current->size > 0)
+    {
+        size_t size = (_current->size + RECORD_ALIGNMENT - 1) & ~(size_t)(RECORD_ALIGNMENT - 1);
+        memset(_current->data + _current->size, 0, size - _current->size);
+        if (pwrite(_fd, _current->data, size, _current->offset) != (ssize_t)size)
+            ++_writeErrors;
+    }
+
+    if (ftruncate(_fd, _dataSize) < 0)
+        LOG_ERROR("Failed to trim recording file");
+
+    close(_fd);
+    _fd = -1;
+    _indexWriter.Close();
+
+    LOG_INFO("Recorded %lu bytes to %s, %lu write errors, %lu bytes dropped",
+        (unsigned long)_dataSize, _filePath.c_str(), (unsigned long)_writeErrors,
+        (unsigned long)_droppedBytes);
+}
+
+void Recorder::Consume(char const* data, uint32_t size, uint32_t /*flags*/)
+{
+    _entries.clear();
+    _indexer.Feed((uint8_t const*)data, size, _entries);
+    _indexWriter.Append(_entries);
+
+    while (size > 0)
+    {
+        if (!_current)
+        {
+            _current = GetFreeBlock();
+            if (!_current)
+            {
+                // what's already recorded is kept, the rest of this chunk isn't
+                if (_droppedBytes == 0)
+                    LOG_ERROR("No recording buffer free, dropping data from %s", _filePath.c_str());
+                ++_writeErrors;
+                _droppedBytes += size;
+                return;
+            }
+
+            _current->size = 0;
+            _current->offset = _nextOffset;
+            _nextOffset += RECORD_BLOCK_SIZE;
+        }
+
+        size_t n = std::min((size_t)size, (size_t)RECORD_BLOCK_SIZE - _current->size);
+        memcpy(_current->data + _current->size, data, n);
+        _current->size += n;
+        _dataSize += n;
+        data += n;
+        size -= n;
+
+        if (_current->size == RECORD_BLOCK_SIZE)
+        {
+            QueueBlock(*_current);
+            _current = nullptr;
+        }
+    }
+}
+
+void Recorder::Tick()
+{
+    if (!_uring.IsInitialized())
+        return;
+
+    // all blocks filled since last tick go down in a single syscall
+    if (_queuedCount > 0)
+    {
+        int ret = _uring.Submit();
+        if (ret < 0)
+            LOG_ERROR("Failed to submit recording writes: %s", strerror(-ret));
+        else
+            _queuedCount = 0;
+    }
+
+    ReapCompletions(false);
+}
+
+RecordBlock* Recorder::GetFreeBlock()
+{
+    // blocks go back to the pool as their writes complete
+    char* data = (char*)_pool.Allocate();
+    while (!data && _inFlightCount > 0 && IsRunning())
+    {
+        // disk is falling behind, wait on it, only this thread stalls
+        int ret = _uring.Submit();
+        if (ret < 0)
+        {
+            LOG_ERROR("Failed to submit recording writes: %s", strerror(-ret));
+            return nullptr;
+        }
+
+        _queuedCount = 0;
+        if (!ReapCompletions(true))
+        {
+            LOG_ERROR("Failed to wait for recording writes: %s", strerror(errno));
+            return nullptr;
+        }
+
+        data = (char*)_pool.Allocate();
+    }
+
+    if (!data)
+        return nullptr;
+
+    RecordBlock& block = _blocks[_pool.GetIndex(data)];
+    block.data = data;
+    return &block;
+}
+
+void Recorder::QueueBlock(RecordBlock& block)
+{
+    Preallocate(block.offset + RECORD_BLOCK_SIZE);
+
+    io_uring_sqe* sqe = _uring.IsInitialized() && _isUringWrite ? _uring.GetSqe() : nullptr;
+    if (!sqe)
+    {
+        WriteBlock(block);
+        return;
+    }
+
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = _fd;
+    sqe->addr = (uint64_t)block.data;
+    sqe->len = block.size;
+    sqe->off = block.offset;
+    sqe->user_data = (uint64_t)&block;
+
+    ++_queuedCount;
+    ++_inFlightCount;
+}
+
+bool Recorder::ReapCompletions(bool wait)
+{
+    io_uring_cqe cqe;
+    if (wait && !_uring.WaitCqe(cqe))
+        return false;
+
+    bool ready = wait || _uring.PeekCqe(cqe);
+    while (ready)
+    {
+        RecordBlock* block = (RecordBlock*)cqe.user_data;
+        int res = cqe.res;
+        --_inFlightCount;
+        ready = _uring.PeekCqe(cqe);
+
+        // kernels before 5.6 don't have IORING_OP_WRITE, blocks are written
+        // synchronously from then on (misaligned O_DIRECT writes fail the same)
+        if (res == -EINVAL)
+        {
+            if (_isUringWrite)
+                LOG_INFO("io_uring writes unavailable, recording with synchronous writes");
+            _isUringWrite = false;
+            WriteBlock(*block);
+            continue;
+        }
+
+        if (res != (int)block->size)
+        {
+            ++_writeErrors;
+            LOG_ERROR("Recording write at %lu failed: %s", (unsigned long)block->offset,
+                res < 0 ? strerror(-res) : "short write");
+        }
+
+        _pool.Free(block->data);
+    }
+
+    return true;
+}
+
+void Recorder::WriteBlock(RecordBlock& block)
+{
+    if (pwrite(_fd, block.data, block.size, block.offset) != (ssize_t)block.size)
+        ++_writeErrors;
+
+    _pool.Free(block.data);
+}
+
+void Recorder::Preallocate(uint64_t end)
+{
+    if (end <= _preallocated)
+        return;
+
+    // grow in big steps, keeps the file contiguous and metadata updates rare
+    // file size is left alone, it grows with the actual writes
+    uint64_t size = std::max(end - _preallocated, (uint64_t)RECORD_PREALLOC_SIZE);
+    if (fallocate(_fd, FALLOC_FL_KEEP_SIZE, _preallocated, size) < 0)
+        LOG_INFO("Failed to preallocate recording file: %s", strerror(errno));
+
+    _preallocated += size;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "RingConsumer.h"
+#include "StreamIndex.h"
+#include "Uring.h"
+#include "BufferArena.h"
+
+struct RecordBlock
+{
+    char* data = nullptr;   // aligned for O_DIRECT
+    size_t size = 0;
+    uint64_t offset = 0;    // file offset block is written at
+};
+
+// Records the relayed stream to disk, along with a side index (.idx)
+// Runs as a consumer of the broadcast ring, and disk writes are done in
+// large aligned blocks through io_uring and O_DIRECT, preallocating the file
+// ahead of them. A slow disk only ever stalls the recorder thread, live
+// viewers never wait on it.
+// Falls back to plain pwrite if io_uring or O_DIRECT aren't available.
+class Recorder : public RingConsumer
+{
+public:
+    Recorder(BroadcastRing const& ring);
+    ~Recorder();
+
+    // blocks come from arena
+    bool Initialize(std::string const& filePath, BufferArena& arena);
+    // flushes last partial block and trims file, must be called after Stop
+    void Close();
+
+protected:
+    // RingConsumer overrides
+    void Consume(char const* data, uint32_t size, uint32_t flags) override;
+    void Tick() override;
+
+private:
+    // nullptr if none can be had, disk waits failed or we're stopping
+    RecordBlock* GetFreeBlock();
+    void QueueBlock(RecordBlock& block);
+    void WriteBlock(RecordBlock& block);
+    // false if waiting failed
+    bool ReapCompletions(bool wait);
+    void Preallocate(uint64_t end);
+
+private:
+    std::string _filePath;
+    int _fd = -1;
+    bool _isDirect = false;
+    Uring _uring;
+    bool _isUringWrite = true;  // kernel has IORING_OP_WRITE
+
+    // free blocks are on the pool's freelist, descriptors are by pool index
+    ArenaPool _pool;
+    std::vector<RecordBlock> _blocks;
+    RecordBlock* _current = nullptr;
+    uint64_t _nextOffset = 0;   // file offset for next block
+    uint64_t _dataSize = 0;     // bytes recorded so far
+    uint64_t _preallocated = 0;
+    unsigned _queuedCount = 0;  // queued but not submitted to the kernel yet
+    unsigned _inFlightCount = 0;
+    uint64_t _writeErrors = 0;
+    uint64_t _droppedBytes = 0; // no block to record them in
+
+    StreamIndexer _indexer;
+    StreamIndexWriter _indexWriter;
+    std::vector<StreamIndexEntry> _entries;
+};
@@ -0,0 +1,105 @@
+#include <stdio.h>
+
+#include "Renditions.h"
+#include "Util.h"
+
+void RenditionSet::Initialize(BroadcastRing const& ring, long byteRate)
+{
+    std::unique_ptr<Rendition> rendition(new Rendition());
+    rendition->byteRate = byteRate;
+    rendition->ring = &ring;
+    _renditions.push_back(std::move(rendition));
+    _default = 0;
+}
+
+bool RenditionSet::Add(std::string const& busName, long byteRate)
+{
+    std::unique_ptr<Rendition> rendition(new Rendition());
+    if (!rendition->bus.Subscribe(rendition->busRing, busName))
+        return false;
+
+    rendition->busName = busName;
+    rendition->byteRate = byteRate;
+    rendition->ring = &rendition->busRing;
+
+    // sorted by bit rate, default one may move up
+    size_t index = 0;
+    while (index < _renditions.size() && !_renditions[index]->isPinned &&
+           _renditions[index]->byteRate <= byteRate)
+        ++index;
+
+    _renditions.insert(_renditions.begin() + index, std::move(rendition));
+    if (index <= _default)
+        ++_default;
+
+    LOG_INFO("Rendition %s at %ld bytes/s added", busName.c_str(), byteRate);
+    return true;
+}
+
+size_t RenditionSet::AddPinned(BroadcastRing const& ring, long byteRate)
+{
+    std::unique_ptr<Rendition> rendition(new Rendition());
+    rendition->byteRate = byteRate;
+    rendition->ring = &ring;
+    rendition->isPinned = true;
+    _renditions.push_back(std::move(rendition));
+    return _renditions.size() - 1;
+}
+
+void RenditionSet::Close()
+{
+    _renditions.clear();
+    _default = 0;
+}
+
+void RenditionSet::Update()
+{
+    for (std::unique_ptr<Rendition>& rendition : _renditions)
+    {
+        if (!rendition->isLive || rendition->busName.empty())
+            continue;
+
+        rendition->isLive = !rendition->bus.IsPublisherGone();
+        if (!rendition->isLive)
+            LOG_INFO("Rendition %s is gone, moving its viewers", rendition->busName.c_str());
+    }
+}
+
+size_t RenditionSet::Choose(size_t current, uint64_t throughput, long lag, long maxLag) const
+{
+    if (_renditions[current]->isPinned)
+        return current;
+
+    // down when falling behind or when throughput can't sustain the rate
+    bool isDown = !_renditions[current]->isLive || lag > maxLag / 2 ||
+        (throughput > 0 && throughput < (uint64_t)_renditions[current]->byteRate);
+    if (isDown)
+    {
+        for (size_t index = current; index-- > 0;)
+        {
+            if (_renditions[index]->isLive && !_renditions[index]->isPinned)
+                return index;
+        }
+
+        // nothing lower, a rendition that's gone still has to be left
+        if (!_renditions[current]->isLive)
+            return _default;
+
+        return current;
+    }
+
+    // up only with headroom to spare, and while keeping up
+    for (size_t index = current + 1; index < _renditions.size(); ++index)
+    {
+        if (!_renditions[index]->isLive || _renditions[index]->isPinned)
+            continue;
+
+        if (lag < maxLag / 4 &&
+            throughput > _renditions[index]->byteRate * RENDITION_UP_HEADROOM)
+            return index;
+
+        break;
+    }
+
+    return current;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "BroadcastRing.h"
+#include "SourceBus.h"
+
+// ms a viewer stays on a rendition before it can be moved again
+#define RENDITION_HOLD_TIME 5000
+// throughput a viewer needs above a rendition's rate to be moved up to it
+#define RENDITION_UP_HEADROOM 1.5
+
+// one encode of the stream, ours, or one published on a bus by another
+// Streamer encoding the same source at another bit rate
+struct Rendition
+{
+    std::string busName; // empty for our own
+    long byteRate = 0;
+    BroadcastRing const* ring = nullptr;
+    bool isLive = true;
+    // sub stream, viewers come to it on its own port and stay
+    bool isPinned = false;
+
+    // bus renditions only
+    BroadcastRing busRing;
+    SourceBus bus;
+};
+
+// Renditions TCP viewers are moved between, server side ABR
+// Kept sorted by bit rate. A viewer is moved down when it can't keep up
+// (falling behind live, or throughput under its rendition's rate), and up
+// when its throughput leaves room for the next one, at most once every
+// RENDITION_HOLD_TIME so it doesn't flap. Streamer does the actual move, at a
+// keyframe of the new rendition, so the viewer's player just sees new video.
+class RenditionSet
+{
+public:
+    RenditionSet() { }
+
+    // our own ring, the rendition new viewers start on
+    void Initialize(BroadcastRing const& ring, long byteRate);
+    // subscribes to rendition published on bus
+    bool Add(std::string const& busName, long byteRate);
+    // after all the others, returns its index
+    size_t AddPinned(BroadcastRing const& ring, long byteRate);
+    void Close();
+
+    size_t GetCount() const { return _renditions.size(); }
+    size_t GetDefault() const { return _default; }
+    Rendition const& Get(size_t index) const { return *_renditions[index]; }
+
+    // checks which bus renditions are still being published
+    void Update();
+    // rendition a viewer should be on, throughput in bytes/s, 0 if unknown
+    size_t Choose(size_t current, uint64_t throughput, long lag, long maxLag) const;
+
+private:
+    std::vector<std::unique_ptr<Rendition>> _renditions;
+    size_t _default = 0;
+};
@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "RingConsumer.h"
+#include "Util.h"
+
+RingConsumer::RingConsumer(BroadcastRing const& ring, std::string const& name) :
+    _ring(ring), _name(name), _running(false) { }
+
+RingConsumer::~RingConsumer()
+{
+    Stop();
+}
+
+void RingConsumer::Start()
+{
+    _readSeq = _ring.GetWriteSeq();
+    _running = true;
+    _thread = std::thread(&RingConsumer::Run, this);
+}
+
+void RingConsumer::Stop()
+{
+    _running = false;
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void RingConsumer::Run()
+{
+    while (_running)
+    {
+        ConsumeRing();
+        Tick();
+
+        usleep(10 * 1e3); // 10ms
+    }
+}
+
+void RingConsumer::ConsumeRing()
+{
+    char buffer[RING_CHUNK_SIZE];
+    while (_readSeq < _ring.GetWriteSeq())
+    {
+        if (_ring.IsOverrun(_readSeq))
+        {
+            uint64_t writeSeq = _ring.GetWriteSeq();
+            LOG_ERROR("%s fell behind live, skipping %lu chunks",
+                _name.c_str(), (unsigned long)(writeSeq - _readSeq));
+            _readSeq = writeSeq;
+            break;
+        }
+
+        uint32_t size = 0;
+        uint32_t flags = 0;
+        if (!_ring.Read(_readSeq, buffer, size, flags, &_chunkPos))
+            continue; // overwritten during copy, overrun check above skips ahead
+
+        Consume(buffer, size, flags);
+        ++_readSeq;
+    }
+}
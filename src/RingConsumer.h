@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <atomic>
+
+#include "BroadcastRing.h"
+
+// Base for anything that follows the broadcast ring on its own thread
+// (DVR window, indexing, recording...), keeping slow work like disk I/O
+// off the live fan-out path.
+// If a consumer falls a full ring behind, it skips ahead to live.
+class RingConsumer
+{
+public:
+    RingConsumer(BroadcastRing const& ring, std::string const& name);
+    virtual ~RingConsumer();
+
+    void Start();
+    void Stop();
+
+protected:
+    // called from consumer thread for each relayed chunk
+    virtual void Consume(char const* data, uint32_t size, uint32_t flags) = 0;
+    // called from consumer thread once per cycle, after consuming new chunks
+    virtual void Tick() { }
+
+    bool IsRunning() const { return _running; }
+    // stream offset of the chunk being consumed, it jumps ahead past skipped ones
+    uint64_t GetChunkPos() const { return _chunkPos; }
+
+private:
+    void Run();
+    void ConsumeRing();
+
+private:
+    BroadcastRing const& _ring;
+    std::string _name;
+    uint64_t _readSeq = 0;
+    uint64_t _chunkPos = 0;
+
+    std::thread _thread;
+    std::atomic<bool> _running;
+};
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <algorithm>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "SourceBus.h"
+#include "Util.h"
+
+#define BUS_LISTEN_BACKLOG 16
+#define BUS_POLL_TIMEOUT 100 // ms
+
+SourceBus::~SourceBus()
+{
+    Close();
+}
+
+bool SourceBus::GetAddress(std::string const& name, sockaddr_un& addr, socklen_t& addrLen)
+{
+    // abstract namespace, nothing left behind in the filesystem if we crash
+    std::string path = "iss_bus_" + name;
+    if (path.size() + 1 > sizeof(addr.sun_path))
+    {
+        LOG_ERROR("Bus name %s is too long", name.c_str());
+        return false;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path + 1, path.c_str(), path.size());
+    addrLen = offsetof(sockaddr_un, sun_path) + 1 + path.size();
+    return true;
+}
+
+bool SourceBus::Publish(BroadcastRing const& ring, std::string const& name)
+{
+    sockaddr_un addr;
+    socklen_t addrLen = 0;
+    if (ring.GetFd() < 0 || !GetAddress(name, addr, addrLen))
+        return false;
+
+    _readOnlyFd = ring.OpenReadOnly();
+    if (_readOnlyFd < 0)
+        return false;
+
+    _socketFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (_socketFd < 0)
+    {
+        LOG_ERROR("Failed to create bus socket");
+        return false;
+    }
+
+    // fails if there's already a publisher on the host with that name
+    if (bind(_socketFd, (sockaddr*)&addr, addrLen) < 0 ||
+        listen(_socketFd, BUS_LISTEN_BACKLOG) < 0)
+    {
+        LOG_ERROR("Failed to open bus %s, is it already published?", name.c_str());
+        return false;
+    }
+
+    _name = name;
+    _publishedRing = &ring;
+    _running = true;
+    _thread = std::thread(&SourceBus::Run, this);
+
+    LOG_INFO("Publishing stream on bus %s", name.c_str());
+    return true;
+}
+
+bool SourceBus::PublishInherited(BroadcastRing const& ring, std::string const& name,
+    int socketFd, std::vector<int> const& subscribers)
+{
+    // subscribers mapped the same memfd, they don't see a thing
+    _readOnlyFd = ring.OpenReadOnly();
+    _socketFd = socketFd;
+    _subscribers = subscribers;
+    _name = name;
+    _publishedRing = &ring;
+    _running = true;
+    _thread = std::thread(&SourceBus::Run, this);
+
+    LOG_INFO("Publishing stream on bus %s, %zu subscribers taken over", name.c_str(),
+        subscribers.size());
+    return true;
+}
+
+void SourceBus::Pause()
+{
+    _running = false;
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void SourceBus::Resume()
+{
+    if (!_publishedRing || _thread.joinable())
+        return;
+
+    _running = true;
+    _thread = std::thread(&SourceBus::Run, this);
+}
+
+bool SourceBus::Subscribe(BroadcastRing& ring, std::string const& name)
+{
+    sockaddr_un addr;
+    socklen_t addrLen = 0;
+    if (!GetAddress(name, addr, addrLen))
+        return false;
+
+    _socketFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (_socketFd < 0)
+    {
+        LOG_ERROR("Failed to create bus socket");
+        return false;
+    }
+
+    if (connect(_socketFd, (sockaddr*)&addr, addrLen) < 0)
+    {
+        LOG_ERROR("Failed to connect to bus %s, is it published?", name.c_str());
+        return false;
+    }
+
+    // anyone can bind an abstract name, we only relay our own user's streams
+    if (!isPeerOurs(_socketFd))
+    {
+        LOG_ERROR("Bus %s is published by another user", name.c_str());
+        return false;
+    }
+
+    // publisher sends the ring's memfd as soon as it accepts us
+    char data;
+    char control[CMSG_SPACE(sizeof(int))];
+    iovec iov = { &data, sizeof(data) };
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(_socketFd, &msg, MSG_CMSG_CLOEXEC) <= 0)
+    {
+        LOG_ERROR("Bus %s closed before sharing its ring", name.c_str());
+        return false;
+    }
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        LOG_ERROR("Bus %s didn't share its ring", name.c_str());
+        return false;
+    }
+
+    int ringFd = -1;
+    memcpy(&ringFd, CMSG_DATA(cmsg), sizeof(ringFd));
+    if (!ring.Attach(ringFd))
+        return false;
+
+    // start from live, like a client connecting to the publisher would
+    _name = name;
+    _ring = &ring;
+    _readSeq = ring.GetWriteSeq();
+    _subscribed = true;
+
+    LOG_INFO("Subscribed to bus %s", name.c_str());
+    return true;
+}
+
+void SourceBus::Close()
+{
+    _running = false;
+    if (_thread.joinable())
+        _thread.join();
+
+    for (int subscriberFd : _subscribers)
+        close(subscriberFd);
+    _subscribers.clear();
+
+    if (_socketFd >= 0)
+        close(_socketFd);
+    _socketFd = -1;
+
+    if (_readOnlyFd >= 0)
+        close(_readOnlyFd);
+    _readOnlyFd = -1;
+
+    _publishedRing = nullptr;
+    _ring = nullptr;
+    _subscribed = false;
+}
+
+RingChunk const* SourceBus::Next(bool const& exitFlag)
+{
+    while (!exitFlag)
+    {
+        if (_ring->IsOverrun(_readSeq))
+        {
+            uint64_t writeSeq = _ring->GetWriteSeq();
+            LOG_ERROR("Bus %s subscriber fell behind live, skipping %lu chunks",
+                _name.c_str(), (unsigned long)(writeSeq - _readSeq));
+            _readSeq = writeSeq;
+        }
+
+        if (_ring->WaitForData(_readSeq, BUS_POLL_TIMEOUT))
+        {
+            RingChunk const* chunk = _ring->GetChunk(_readSeq);
+            if (chunk->seq.load(std::memory_order_acquire) != _readSeq ||
+                chunk->size > RING_CHUNK_SIZE)
+                continue; // overwritten already, overrun check skips ahead
+
+            return chunk;
+        }
+
+        // anything still in the ring was relayed before giving up
+        if (IsPublisherGone())
+        {
+            LOG_INFO("Bus %s publisher is gone", _name.c_str());
+            return nullptr;
+        }
+    }
+
+    return nullptr;
+}
+
+bool SourceBus::Read(char* buffer, uint32_t& size) const
+{
+    uint32_t flags = 0;
+    return _ring->Read(_readSeq, buffer, size, flags);
+}
+
+void SourceBus::Release()
+{
+    ++_readSeq;
+}
+
+bool SourceBus::IsPublisherGone() const
+{
+    pollfd fd = { _socketFd, POLLIN, 0 };
+    if (poll(&fd, 1, 0) <= 0)
+        return false;
+
+    // publisher never sends anything after the ring, readable means closed
+    return true;
+}
+
+void SourceBus::Run()
+{
+    std::vector<pollfd> fds;
+    while (_running)
+    {
+        fds.clear();
+        fds.push_back({ _socketFd, POLLIN, 0 });
+        for (int subscriberFd : _subscribers)
+            fds.push_back({ subscriberFd, POLLIN, 0 });
+
+        if (poll(fds.data(), fds.size(), BUS_POLL_TIMEOUT) <= 0)
+            continue;
+
+        if (fds[0].revents & POLLIN)
+            Accept();
+
+        // subscribers only ever close their end, that's all there is to see
+        for (size_t i = 1; i < fds.size(); ++i)
+        {
+            if (fds[i].revents == 0)
+                continue;
+
+            close(fds[i].fd);
+            _subscribers.erase(std::find(_subscribers.begin(), _subscribers.end(), fds[i].fd));
+            LOG_INFO("Bus %s subscriber left, %zu remaining", _name.c_str(), _subscribers.size());
+        }
+    }
+}
+
+void SourceBus::Accept()
+{
+    int subscriberFd = accept4(_socketFd, NULL, NULL, SOCK_CLOEXEC);
+    if (subscriberFd < 0)
+        return;
+
+    if (!isPeerOurs(subscriberFd) || _readOnlyFd < 0)
+    {
+        LOG_ERROR("Refusing bus %s subscriber of another user", _name.c_str());
+        close(subscriberFd);
+        return;
+    }
+
+    int ringFd = _readOnlyFd;
+    char data = 0;
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    iovec iov = { &data, sizeof(data) };
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &ringFd, sizeof(ringFd));
+
+    if (sendmsg(subscriberFd, &msg, MSG_NOSIGNAL) < 0)
+    {
+        LOG_ERROR("Failed to share ring with bus %s subscriber", _name.c_str());
+        close(subscriberFd);
+        return;
+    }
+
+    _subscribers.push_back(subscriberFd);
+    LOG_INFO("Bus %s subscriber joined, %zu total", _name.c_str(), _subscribers.size());
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "BroadcastRing.h"
+
+// published rings are bigger, fan-out processes don't all keep up equally
+// 1024 chunks is about 4MB, over a minute of a 400k stream
+#define BUS_CHUNK_COUNT 1024
+
+// Shared-memory source bus, one encode feeding many Streamer processes
+// The publisher's broadcast ring lives in a memfd, handed out over an abstract
+// unix socket ("iss_bus_$name") to Streamer processes of the same user on the
+// host that subscribe. Subscribers get a read only fd, so they can't write to
+// what the publisher's viewers get, map the ring and send to their clients
+// straight out of it, sleeping on the ring's futex between writes, so there's
+// no copy and no ffmpeg per process.
+// Players on the same host (see Client's shm:// endpoints) subscribe the same
+// way and pipe the ring to ffplay, instead of going through loopback TCP.
+// Subscribers stay connected to the bus socket, it closing is how they learn
+// the publisher is gone, i.e end of stream.
+class SourceBus
+{
+public:
+    SourceBus() : _running(false) { }
+    ~SourceBus();
+
+    // publisher side, ring must be memfd backed (InitializeShared or Attach)
+    bool Publish(BroadcastRing const& ring, std::string const& name);
+    // subscriber side, attaches ring to the one shared on the bus
+    bool Subscribe(BroadcastRing& ring, std::string const& name);
+    void Close();
+
+    // hot restart, publisher side: the bus socket and subscribers are handed
+    // over to the streamer taking over, which publishes on them as they are
+    // paused publishers accept nobody, so nobody joins the wrong process
+    int GetSocketFd() const { return _socketFd; }
+    std::vector<int> const& GetSubscribers() const { return _subscribers; }
+    void Pause();
+    void Resume();
+    bool PublishInherited(BroadcastRing const& ring, std::string const& name, int socketFd,
+        std::vector<int> const& subscribers);
+
+    bool IsSubscribed() const { return _subscribed; }
+    // subscriber side, false while the publisher is still there
+    bool IsPublisherGone() const;
+
+    // subscriber side, next chunk to relay, read in place
+    // blocks until there's one, nullptr once publisher is gone or exitFlag is set
+    // the publisher can overwrite it any time, check its seq before each use
+    RingChunk const* Next(bool const& exitFlag);
+    // true once Next() has a chunk to return right away, false after timeoutMs
+    bool Wait(int timeoutMs) const { return _ring->WaitForData(_readSeq, timeoutMs); }
+    // copies chunk returned by Next() out, false if it got overwritten, for
+    // sending where a torn chunk can't be taken back
+    bool Read(char* buffer, uint32_t& size) const;
+    // done with chunk returned by Next()
+    void Release();
+
+private:
+    static bool GetAddress(std::string const& name, struct sockaddr_un& addr, socklen_t& addrLen);
+    void Run();
+    void Accept();
+
+private:
+    std::string _name;
+    int _socketFd = -1; // listen socket for publisher, bus connection for subscribers
+
+    // publisher side
+    BroadcastRing const* _publishedRing = nullptr;
+    // what subscribers get, see BroadcastRing::OpenReadOnly()
+    int _readOnlyFd = -1;
+    std::vector<int> _subscribers;
+    std::thread _thread;
+    std::atomic<bool> _running;
+
+    // subscriber side
+    BroadcastRing const* _ring = nullptr;
+    bool _subscribed = false;
+    uint64_t _readSeq = 0;
+};
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "StreamIndex.h"
+#include "TSPacket.h"
+#include "Util.h"
+
+// flush pending entries to disk once a page worth piles up
+#define INDEX_FLUSH_ENTRIES (4096 / sizeof(StreamIndexEntry))
+
+#define TIMESTAMP_WRAP (1LL << 33)
+
+void StreamIndexer::Feed(uint8_t const* data, size_t size, std::vector<StreamIndexEntry>& entries)
+{
+    for (size_t offset = 0; offset + TS_PACKET_SIZE <= size; offset += TS_PACKET_SIZE)
+    {
+        uint8_t const* pkt = data + offset;
+
+        uint8_t streamId = 0;
+        int64_t timestamp = 0;
+        if (!tsIsSynced(pkt) || !tsParsePesStart(pkt, streamId, timestamp) ||
+            !tsIsVideoStream(streamId))
+            continue;
+
+        // unwrap 33 bit timestamps, a big backwards jump means they wrapped
+        if (_lastTimestamp >= 0 && timestamp + _wrapOffset < _lastTimestamp - TIMESTAMP_WRAP / 2)
+            _wrapOffset += TIMESTAMP_WRAP;
+
+        timestamp += _wrapOffset;
+        _lastTimestamp = timestamp;
+
+        StreamIndexEntry entry;
+        entry.pts = timestamp;
+        entry.offset = _offset + offset;
+        entry.flags = tsIsRandomAccess(pkt) ? INDEX_FLAG_KEYFRAME : 0;
+        entries.push_back(entry);
+    }
+
+    _offset += size;
+}
+
+StreamIndexWriter::~StreamIndexWriter()
+{
+    Close();
+}
+
+bool StreamIndexWriter::Open(std::string const& filePath)
+{
+    _fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0)
+    {
+        LOG_ERROR("Failed to open index file %s", filePath.c_str());
+        return false;
+    }
+
+    StreamIndexHeader header;
+    memcpy(header.magic, STREAM_INDEX_MAGIC, sizeof(header.magic));
+    header.version = STREAM_INDEX_VERSION;
+    header.entrySize = sizeof(StreamIndexEntry);
+
+    if (write(_fd, &header, sizeof(header)) != sizeof(header))
+    {
+        LOG_ERROR("Failed to write index header");
+        return false;
+    }
+
+    return true;
+}
+
+void StreamIndexWriter::Append(std::vector<StreamIndexEntry> const& entries)
+{
+    _pending.insert(_pending.end(), entries.begin(), entries.end());
+    if (_pending.size() >= INDEX_FLUSH_ENTRIES)
+        Flush();
+}
+
+void StreamIndexWriter::Flush()
+{
+    if (_fd < 0 || _pending.empty())
+        return;
+
+    size_t size = _pending.size() * sizeof(StreamIndexEntry);
+    if (write(_fd, _pending.data(), size) != (ssize_t)size)
+        LOG_ERROR("Failed to write %zu index entries", _pending.size());
+
+    _pending.clear();
+}
+
+void StreamIndexWriter::Close()
+{
+    Flush();
+
+    if (_fd >= 0)
+    {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+StreamIndexReader::~StreamIndexReader()
+{
+    Close();
+}
+
+bool StreamIndexReader::Open(std::string const& filePath)
+{
+    Close();
+
+    _fd = open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_fd < 0)
+    {
+        LOG_ERROR("Failed to open index file %s", filePath.c_str());
+        return false;
+    }
+
+    StreamIndexHeader header;
+    if (read(_fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, STREAM_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != STREAM_INDEX_VERSION ||
+        header.entrySize != sizeof(StreamIndexEntry))
+    {
+        LOG_ERROR("Invalid index file %s", filePath.c_str());
+        Close();
+        return false;
+    }
+
+    return Refresh();
+}
+
+bool StreamIndexReader::Refresh()
+{
+    struct stat st;
+    if (fstat(_fd, &st) < 0 || st.st_size < (off_t)sizeof(StreamIndexHeader))
+        return false;
+
+    size_t entryCount = (st.st_size - sizeof(StreamIndexHeader)) / sizeof(StreamIndexEntry);
+    size_t mapSize = sizeof(StreamIndexHeader) + entryCount * sizeof(StreamIndexEntry);
+    if (mapSize == _mapSize)
+        return true;
+
+    if (_map)
+        munmap(_map, _mapSize);
+
+    _map = mmap(NULL, mapSize, PROT_READ, MAP_SHARED, _fd, 0);
+    if (_map == MAP_FAILED)
+    {
+        _map = nullptr;
+        _mapSize = 0;
+        _entryCount = 0;
+        LOG_ERROR("Failed to map index file");
+        return false;
+    }
+
+    _mapSize = mapSize;
+    _entries = (StreamIndexEntry const*)((char const*)_map + sizeof(StreamIndexHeader));
+    _entryCount = entryCount;
+    return true;
+}
+
+void StreamIndexReader::Close()
+{
+    if (_map)
+        munmap(_map, _mapSize);
+
+    if (_fd >= 0)
+        close(_fd);
+
+    _fd = -1;
+    _map = nullptr;
+    _mapSize = 0;
+    _entries = nullptr;
+    _entryCount = 0;
+}
+
+StreamIndexEntry const* StreamIndexReader::FindKeyframe(int64_t pts) const
+{
+    if (_entryCount == 0)
+        return nullptr;
+
+    StreamIndexEntry const* begin = _entries;
+    StreamIndexEntry const* end = _entries + _entryCount;
+
+    // first entry after pts, entry before it is the frame showing at pts
+    StreamIndexEntry const* itr = std::upper_bound(begin, end, pts,
+        [](int64_t time, StreamIndexEntry const& entry)
+        {
+            return time < entry.pts;
+        });
+
+    // walk back to the keyframe starting that frame's GOP
+    while (itr != begin)
+    {
+        --itr;
+        if (itr->flags & INDEX_FLAG_KEYFRAME)
+            return itr;
+    }
+
+    // pts before first keyframe, use first one there is
+    for (itr = begin; itr != end; ++itr)
+    {
+        if (itr->flags & INDEX_FLAG_KEYFRAME)
+            return itr;
+    }
+
+    return nullptr;
+}
+
+RelayIndexer::RelayIndexer(BroadcastRing const& ring) : RingConsumer(ring, "Indexer") { }
+
+bool RelayIndexer::Initialize(std::string const& filePath)
+{
+    LOG_INFO("Indexing stream to %s", filePath.c_str());
+    return _writer.Open(filePath);
+}
+
+void RelayIndexer::Consume(char const* data, uint32_t size, uint32_t /*flags*/)
+{
+    // offsets follow the stream as it was written, chunks skipped while we
+    // were behind included
+    if (_startPos < 0)
+        _startPos = GetChunkPos();
+    _indexer.SetOffset(GetChunkPos() - _startPos);
+
+    _entries.clear();
+    _indexer.Feed((uint8_t const*)data, size, _entries);
+    _writer.Append(_entries);
+}
+
+void RelayIndexer::Tick()
+{
+    // keep index reasonably fresh for readers following it
+    long now = getMSTime();
+    if (now - _lastFlushMs > 1000)
+    {
+        _writer.Flush();
+        _lastFlushMs = now;
+    }
+}
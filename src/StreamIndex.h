@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "RingConsumer.h"
+
+// Side index for random access into TS data
+// File layout is a fixed header followed by fixed size entries, sorted by
+// timestamp, so readers can mmap the file and binary search it directly.
+// The entry count is implied by the file size, which lets readers follow a
+// file that's still being written (any trailing partial entry is ignored).
+
+#define STREAM_INDEX_MAGIC "ISSINDEX"
+#define STREAM_INDEX_VERSION 1
+
+// entry flags
+#define INDEX_FLAG_KEYFRAME 0x1
+
+struct StreamIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entrySize;
+};
+
+struct StreamIndexEntry
+{
+    // video timestamp in 90kHz units, DTS if stream has one, PTS otherwise
+    // unwrapped, so it keeps growing past the 33 bit TS limit
+    int64_t pts;
+    // byte offset of the TS packet starting the frame
+    uint64_t offset : 56;
+    uint64_t flags : 8;
+};
+
+static_assert(sizeof(StreamIndexHeader) == 16, "index header must stay 16 bytes");
+static_assert(sizeof(StreamIndexEntry) == 16, "index entry must stay 16 bytes");
+
+// Builds index entries out of TS data, one per video frame
+class StreamIndexer
+{
+public:
+    StreamIndexer() { }
+
+    // data must start on a TS packet boundary
+    void Feed(uint8_t const* data, size_t size, std::vector<StreamIndexEntry>& entries);
+    uint64_t GetOffset() const { return _offset; }
+    // offset of the data fed next, e.g past data that was never fed
+    void SetOffset(uint64_t offset) { _offset = offset; }
+
+private:
+    uint64_t _offset = 0;
+    int64_t _lastTimestamp = -1;
+    int64_t _wrapOffset = 0;
+};
+
+class StreamIndexWriter
+{
+public:
+    StreamIndexWriter() { }
+    ~StreamIndexWriter();
+
+    bool Open(std::string const& filePath);
+    void Append(std::vector<StreamIndexEntry> const& entries);
+    void Flush();
+    void Close();
+
+private:
+    int _fd = -1;
+    std::vector<StreamIndexEntry> _pending;
+};
+
+class StreamIndexReader
+{
+public:
+    StreamIndexReader() { }
+    ~StreamIndexReader();
+
+    bool Open(std::string const& filePath);
+    // picks up entries appended since last Open/Refresh
+    bool Refresh();
+    void Close();
+
+    size_t GetEntryCount() const { return _entryCount; }
+    StreamIndexEntry const* GetEntry(size_t index) const { return &_entries[index]; }
+
+    // last keyframe at or before pts, or first keyframe if pts is before it
+    // nullptr if index has no keyframes
+    StreamIndexEntry const* FindKeyframe(int64_t pts) const;
+
+private:
+    int _fd = -1;
+    void* _map = nullptr;
+    size_t _mapSize = 0;
+    StreamIndexEntry const* _entries = nullptr;
+    size_t _entryCount = 0;
+};
+
+// Indexes the relayed stream into a side index file, offsets being relative
+// to the first byte relayed since the consumer started
+class RelayIndexer : public RingConsumer
+{
+public:
+    RelayIndexer(BroadcastRing const& ring);
+
+    bool Initialize(std::string const& filePath);
+
+protected:
+    // RingConsumer overrides
+    void Consume(char const* data, uint32_t size, uint32_t flags) override;
+    void Tick() override;
+
+private:
+    StreamIndexer _indexer;
+    StreamIndexWriter _writer;
+    std::vector<StreamIndexEntry> _entries;
+    long _lastFlushMs = 0;
+    // stream offset of the first chunk indexed, -1 until there's one
+    int64_t _startPos = -1;
+};
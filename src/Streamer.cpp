@@ -1,4 +1,6 @@
 #include <sstream>
+#include <fstream>
+#include <algorithm>
 #include <csignal>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,17 +10,31 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <limits.h>
+#include <libgen.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/tcp.h>
 
 #include "Streamer.h"
+#include "TSParser.h"
 #include "Util.h"
 
 #define LISTEN_BACKLOG 10
 #define BUFFER_SIZE 4136
+#define RING_CHUNK_COUNT 256
+// unsent bytes a viewer's socket holds before writes fail with EAGAIN, so
+// video that's late waits in the ring, where it can still be skipped
+#define CLIENT_NOTSENT_LOWAT (4 * BUFFER_SIZE)
+#define CLIENT_SAMPLE_INTERVAL 1000 // ms between TCP_INFO samples of a viewer
+// ms new viewers are checked for control bytes, zapping clients send them right away
+#define CLIENT_CONTROL_WINDOW 1000
+// most UDP viewers get at once when paced, in bytes
+#define PACING_BURST (2 * BUFFER_SIZE)
 
 using namespace StreamingService;
 
@@ -42,7 +58,67 @@ void exitHandler(int /*signal*/)
     early_exit = true;
 }
 
-Streamer::Streamer() : Ice::Application(Ice::NoSignalHandling) { }
+// non blocking, -1 if it can't be opened
+static int openListenSocket(int port, bool isTcp)
+{
+    int fd = socket(AF_INET, (isTcp ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        LOG_ERROR("Failed to initialize listen socket");
+        return -1;
+    }
+
+    sockaddr_in addr;
+    bzero((char*)&addr, sizeof(addr));
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        LOG_ERROR("Failed to bind listen socket");
+        close(fd);
+        return -1;
+    }
+
+    if (isTcp && listen(fd, LISTEN_BACKLOG) < 0)
+    {
+        LOG_ERROR("Failed to open listen socket");
+        close(fd);
+        return -1;
+    }
+
+    int setVal = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &setVal, sizeof(int));
+    if (!isTcp)
+        setsockopt(fd, SOL_SOCKET, IP_RECVERR, (const void *)&setVal , sizeof(int));
+
+    return fd;
+}
+
+// parses ffmpeg style bit rates, e.g "400k" or "400000"
+static long parseBitRate(std::string const& bitRate)
+{
+    long rate = atol(bitRate.c_str());
+    if (!bitRate.empty() && (bitRate.back() == 'k' || bitRate.back() == 'K'))
+        rate *= 1000;
+    else if (!bitRate.empty() && (bitRate.back() == 'm' || bitRate.back() == 'M'))
+        rate *= 1000000;
+    return rate;
+}
+
+// ffconcat list entry, ' is quoted as '\''
+static std::string concatEntry(std::string const& path)
+{
+    std::string quoted;
+    for (char c : path)
+        quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+
+    return "file '" + quoted + "'\n";
+}
+
+Streamer::Streamer() : Ice::Application(Ice::NoSignalHandling), _dvr(_ring), _indexer(_ring), _recorder(_ring) { }
 
 int Streamer::run(int argc, char** argv)
 {
@@ -59,7 +135,15 @@ int Streamer::run(int argc, char** argv)
     _transport = "tcp";
     _host = "localhost";
     _listenPort = 9600;
-    _ffmpegPort = 9601;
+    _dvrPort = 9602;
+    _failoverTimeout = 1000;
+    _encoderPoolSize = 0;
+    _encoderThreads = 2;
+    _preset = "ultrafast";
+    _netIo = "sync";
+    _numaNode = "auto";
+    _maxLag = 3000;
+    _chunkDeadline = 100;
     std::string videoSize = "480x270";
     std::string bitRate = "400k";
     std::string keywords; // actually a list with csv values
@@ -86,8 +170,6 @@ int Streamer::run(int argc, char** argv)
             _host = arg;
         else if (option == "--port")
             _listenPort = atoi(arg.c_str());
-        else if (option == "--ffmpeg_port")
-            _ffmpegPort = atoi(arg.c_str());
         else if (option == "--video_size")
             videoSize = arg;
         else if (option == "--bit_rate")
@@ -98,12 +180,95 @@ int Streamer::run(int argc, char** argv)
             _hlsHost = arg;
         else if (option == "--dash")
             _dashHost = arg;
+        else if (option == "--dvr_window")
+            _dvrWindow = atol(arg.c_str());
+        else if (option == "--dvr_port")
+            _dvrPort = atoi(arg.c_str());
+        else if (option == "--dvr_file")
+            _dvrFilePath = arg;
+        else if (option == "--index_file")
+            _indexFilePath = arg;
+        else if (option == "--record")
+            _recordFilePath = arg;
+        else if (option == "--vod")
+            _vodCachePath = arg;
+        else if (option == "--loop")
+            _loopCount = atoi(arg.c_str());
+        else if (option == "--ingest")
+            _ingestUrl = arg;
+        else if (option == "--standby")
+            _standbySource = arg;
+        else if (option == "--failover_timeout")
+            _failoverTimeout = atol(arg.c_str());
+        else if (option == "--encoder_pool")
+            _encoderPoolSize = atoi(arg.c_str());
+        else if (option == "--host_cores")
+            _hostCores = atoi(arg.c_str());
+        else if (option == "--encoder_threads")
+            _encoderThreads = atoi(arg.c_str());
+        else if (option == "--preset")
+            _preset = arg;
+        else if (option == "--admission_wait")
+            _admissionWait = atoi(arg.c_str());
+        else if (option == "--metrics_file")
+            _metricsFilePath = arg;
+        else if (option == "--publish_bus")
+            _publishBus = arg;
+        else if (option == "--bus")
+            _subscribeBus = arg;
+        else if (option == "--net_io")
+            _netIo = arg;
+        else if (option == "--numa_node")
+            _numaNode = arg;
+        else if (option == "--chunk_deadline")
+            _chunkDeadline = atol(arg.c_str());
+        else if (option == "--max_lag")
+            _maxLag = atol(arg.c_str());
+        else if (option == "--pacing")
+            _pacingHeadroom = atoi(arg.c_str());
+        else if (option == "--rendition")
+            _renditionBuses.push_back(arg);
+        else if (option == "--sub_stream")
+            _subStreamArgs.push_back(arg);
+        else if (option == "--ts_parser")
+            tsSetScalarParser(arg == "scalar");
+        else if (option == "--hot_restart")
+            _restartName = arg;
         else
             LOG_INFO("Unrecognized option '%s', skipping", option.c_str());
     }
 
+    // the bus carries what goes through the ring, i.e regular TCP/UDP streams
+    bool isHttp = !_hlsHost.empty() || !_dashHost.empty() || !_vodCachePath.empty();
+    if ((!_publishBus.empty() || !_subscribeBus.empty()) && isHttp)
+    {
+        LOG_INFO("Source bus can't be used with HLS, DASH or VOD");
+        return 1;
+    }
+
+    if (!_publishBus.empty() && !_subscribeBus.empty())
+    {
+        LOG_INFO("Can't both publish and subscribe to a source bus");
+        return 1;
+    }
+
+    if (_netIo != "sync" && _netIo != "uring" && _netIo != "uring_sqpoll")
+    {
+        LOG_INFO("Unknown net I/O backend '%s', it's sync, uring or uring_sqpoll", _netIo.c_str());
+        return 1;
+    }
+
+    // only sockets and rings are handed over, files we write would be
+    // truncated by the new streamer
+    if (!_restartName.empty() && (isHttp || _netIo != "sync" || _dvrWindow > 0 ||
+        !_recordFilePath.empty() || !_indexFilePath.empty()))
+    {
+        LOG_INFO("Hot restart is for TCP/UDP streams on sync net I/O, without DVR, recording or index");
+        return 1;
+    }
+
     // switch to HTTP mode
-    if (!_hlsHost.empty() || !_dashHost.empty())
+    if (isHttp)
         _transport = "http";
 
     // setup stream entry
@@ -124,11 +289,33 @@ int Streamer::run(int argc, char** argv)
         // http://nginx_host:port/dash/stream.m3u8
         endpoint += "/dash/" + streamName + "/index.mpd";
     }
+    else if (!_vodCachePath.empty())
+    {
+        // format new endpoint
+        // http://host:port/stream.ts
+        endpoint += "/" + streamName + ".ts";
+    }
 
     _streamEntry.streamName = streamName;
     _streamEntry.endpoint = endpoint;
     _streamEntry.videoSize = videoSize;
     _streamEntry.bitRate = bitRate;
+    _byteRate = std::max(parseBitRate(bitRate) / 8, 1L);
+    // first report covers a full interval of data, also after a hot restart
+    _lastHealthMs = getMSTime();
+    _health.Initialize(_byteRate, _lastHealthMs);
+    if (_pacingHeadroom >= 0)
+        _pacingRate = _byteRate * (100 + _pacingHeadroom) / 100;
+    if (_dvrWindow > 0)
+    {
+        // DVR clients pick a timeshift through the query string
+        // http://host:port/?timeshift=30
+        _streamEntry.dvrEndpoint = "http://" + _host +
+            ":" + std::to_string(_dvrPort) + "/";
+
+        if (_dvrFilePath.empty())
+            _dvrFilePath = "/tmp/" + streamName + ".dvr";
+    }
     // fill stream keywords
     {
         std::string t;
@@ -138,7 +325,8 @@ int Streamer::run(int argc, char** argv)
     }
 
     int exitCode = 0;
-    if (_transport != "tcp")
+    // VOD is served over HTTP, which still needs a TCP listen socket
+    if (_transport != "tcp" && _vodCachePath.empty())
         _isTcp = false;
     // actual stream logic
     {
@@ -162,6 +350,66 @@ int Streamer::run(int argc, char** argv)
 
 bool Streamer::Initialize()
 {
+    long startMs = getMSTime();
+    if (!_supervisor.Initialize())
+        return false;
+
+    // encoders are handed over on hot restart, they outlive us then
+    _supervisor.SetOrphanable(!_restartName.empty());
+
+    if (!PrepareInput())
+    {
+        LOG_ERROR("Failed to prepare input %s", _videoFilePath.c_str());
+        return false;
+    }
+
+    // warm up encoders first, they get ready while everything else is set up
+    bool isRegular = _hlsHost.empty() && _dashHost.empty() && _vodCachePath.empty() &&
+        _ingestUrl.empty() && _subscribeBus.empty();
+    if (!_metricsFilePath.empty() && !_metrics.Initialize(_metricsFilePath, _streamEntry.streamName))
+        return false;
+
+    // hot restart, a streamer already running the stream hands it over to us
+    _isTakingOver = !_restartName.empty() && _restart.Connect(_restartName);
+    if (_isTakingOver)
+    {
+        LOG_INFO("Taking over from running streamer...");
+        if (!_restart.Receive(_restartState) ||
+            _streamEntry.streamName != _restartState.header.streamName)
+        {
+            LOG_ERROR("Failed to take over stream %s", _streamEntry.streamName.c_str());
+            _restart.Close();
+            _restartState.CloseFds();
+            return false;
+        }
+
+        // until it lets go, it's all the old streamer's too
+        _isStateShared = true;
+    }
+
+    // host has to have room for another encode before anything gets started
+    // a stream taken over already has it, the old streamer's slot is freed as it exits
+    if (isRegular)
+    {
+        if (!_scheduler.Initialize(_streamEntry.streamName, _hostCores, _encoderThreads, _preset))
+            return false;
+        if (_isTakingOver ? !_scheduler.Claim() : !_scheduler.Admit(_admissionWait, early_exit))
+            return false;
+
+        _supervisor.SetProgressHandler([this](int index, pid_t pid, double speed)
+                                       {
+                                           OnEncoderProgress(index, pid, speed);
+                                       });
+    }
+
+    // the old streamer's pool stays until it has let go, ours is started then
+    _isEncoderPooled = isRegular && _encoderPoolSize > 0 && !_inputList.empty();
+    if (_isEncoderPooled && !_isTakingOver)
+    {
+        LOG_INFO("Starting %d pooled encoders...", _encoderPoolSize);
+        _supervisor.SetPool(GetPoolArgs(), _encoderPoolSize);
+    }
+
     Ice::ObjectPrx base = communicator()->propertyToProxy("Portal.Proxy");
     _portal = PortalInterfacePrx::checkedCast(base);
 
@@ -177,46 +425,157 @@ bool Streamer::Initialize()
     {
         LOG_INFO("Setting up listen socket...");
 
-        if (_isTcp)
-            _listenSocketFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
-        else
-            _listenSocketFd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        // stream buffers all come from here
+        _arena.Initialize(_numaNode);
 
+        _listenSocketFd = _isTakingOver ?
+            _restartState.TakeFd(_restartState.header.listenSocketFd) :
+            openListenSocket(_listenPort, _isTcp);
         if (_listenSocketFd < 0)
+            return false;
+
+        // subscribers relay a ring written by another process
+        if (!_subscribeBus.empty())
+        {
+            if (!_bus.Subscribe(_ring, _subscribeBus))
+                return false;
+        }
+        else if (!_vodCachePath.empty())
+        {
+            if (!_ring.Initialize(RING_CHUNK_COUNT, &_arena))
+                return false;
+        }
+        else if (_isTakingOver)
         {
-            LOG_ERROR("Failed to initialize listen socket");
+            // mapped as it is, viewers' cursors stay valid
+            if (!_ring.Adopt(_restartState.TakeFd(_restartState.header.ringFd)))
+                return false;
+        }
+        else if (!_ring.InitializeShared(_publishBus.empty() ? RING_CHUNK_COUNT : BUS_CHUNK_COUNT,
+                                         _streamEntry.streamName, &_arena))
             return false;
+
+        // players and streamers on the host can follow a published ring
+        if (!_publishBus.empty())
+        {
+            std::string const& busName = _publishBus;
+            bool isPublished = false;
+            if (_isTakingOver && _restartState.header.busSocketFd >= 0)
+            {
+                // local players and streamers following us carry on too
+                std::vector<int> subscribers;
+                for (int32_t fd : _restartState.busSubscriberFds)
+                    subscribers.push_back(_restartState.TakeFd(fd));
+                isPublished = _publisher.PublishInherited(_ring, busName,
+                    _restartState.TakeFd(_restartState.header.busSocketFd), subscribers);
+            }
+            else
+                isPublished = _publisher.Publish(_ring, busName);
+
+            if (!isPublished)
+                return false;
+
+            _streamEntry.localEndpoint = "shm://" + busName;
+        }
+
+        // other renditions are encoded by other streamers, published on buses
+        // $bus:$bit_rate, e.g "news_low:200k"
+        _renditions.Initialize(_ring, _byteRate);
+        for (std::string const& rendition : _renditionBuses)
+        {
+            size_t colon = rendition.find(':');
+            if (!_isTcp || colon == std::string::npos ||
+                !_renditions.Add(rendition.substr(0, colon),
+                                 std::max(parseBitRate(rendition.substr(colon + 1)) / 8, 1L)))
+                LOG_ERROR("Skipping rendition %s, it's '$bus:$bit_rate' for TCP streams",
+                    rendition.c_str());
         }
 
-        sockaddr_in addr;
-        bzero((char*)&addr, sizeof(addr));
+        if (_dvrWindow > 0)
+        {
+            // window is sized from the declared bit rate, with headroom for
+            // audio and TS overhead
+            size_t fileSize = _dvrWindow * parseBitRate(_streamEntry.bitRate) / 8 * 2;
+            fileSize = std::max(fileSize, (size_t)RING_CHUNK_SIZE * RING_CHUNK_COUNT);
 
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(_listenPort);
+            LOG_INFO("Setting up %ld second DVR window...", _dvrWindow);
+            if (!_dvr.Initialize(_dvrFilePath, fileSize, _dvrPort, _arena))
+            {
+                LOG_ERROR("Failed to initialize DVR window");
+                return false;
+            }
+        }
 
-        if (bind(_listenSocketFd, (sockaddr*)&addr, sizeof(addr)) < 0)
+        if (!_indexFilePath.empty() && !_indexer.Initialize(_indexFilePath))
         {
-            LOG_ERROR("Failed to bind listen socket");
+            LOG_ERROR("Failed to initialize stream index");
             return false;
         }
 
-        if (_isTcp && listen(_listenSocketFd, LISTEN_BACKLOG) < 0)
+        if (!_recordFilePath.empty() && !_recorder.Initialize(_recordFilePath, _arena))
         {
-            LOG_ERROR("Failed to open listen socket");
+            LOG_ERROR("Failed to initialize recording");
             return false;
         }
 
-        int setVal = 1;
-        setsockopt(_listenSocketFd, SOL_SOCKET, SO_REUSEADDR, &setVal, sizeof(int));
-        if (!_isTcp)
-            setsockopt(_listenSocketFd, SOL_SOCKET, IP_RECVERR,
-               (const void *)&setVal , sizeof(int));
+        // io_uring takes over accepting and sending to TCP viewers
+        if (_netIo != "sync" && _isTcp && _vodCachePath.empty())
+        {
+            _fanout.SetPacingRate(_pacingRate);
+            if (_fanout.Initialize(_ring, _listenSocketFd, _netIo == "uring_sqpoll"))
+                LOG_INFO("Sending to viewers through io_uring");
+            else
+            {
+                LOG_INFO("io_uring unavailable, sending to viewers with regular syscalls");
+                _netIo = "sync";
+            }
+        }
+
+        if (!_subStreamArgs.empty() && !InitializeSubStreams())
+            return false;
+    }
+
+    // everything is set up, the old streamer can let go
+    if (_isTakingOver && !TakeOver())
+        return false;
 
+    if (_isEncoderPooled && _isTakingOver)
+    {
+        LOG_INFO("Starting %d pooled encoders...", _encoderPoolSize);
+        _supervisor.SetPool(GetPoolArgs(), _encoderPoolSize);
     }
 
     // handle ffmpeg start
-    if (!_hlsHost.empty() || !_dashHost.empty())
+    int ffmpegIndex = -1;
+    if (!_vodCachePath.empty())
+    {
+        // VOD case, ffmpeg only runs once to fill the cache, if at all
+        if (!_vod.Initialize(_videoFilePath, _vodCachePath, _streamEntry.videoSize,
+                             _streamEntry.bitRate, _listenSocketFd))
+        {
+            LOG_ERROR("Failed to prepare VOD file");
+            return false;
+        }
+    }
+    else if (!_subscribeBus.empty())
+    {
+        // bus case, publisher's encode is all we need
+    }
+    else if (!_ingestUrl.empty())
+    {
+        // live ingest case, encoder pushes TS to us, no ffmpeg needed
+        RestartSource const& source = _restartState.header.sources[0];
+        bool isOpen = _isTakingOver ?
+            _primary.InitializeInherited(_ingestUrl, "Encoder",
+                _restartState.TakeFd(source.listenFd), _restartState.TakeFd(source.socketFd)) :
+            _primary.Initialize(_ingestUrl, "Encoder");
+        if (!isOpen)
+        {
+            LOG_ERROR("Failed to open ingest endpoint");
+            return false;
+        }
+    }
+    else if (!_hlsHost.empty() || !_dashHost.empty())
     {
         // HLS/DASH case
         std::string const& endpoint = (!_hlsHost.empty()) ? _hlsHost : _dashHost;
@@ -226,144 +585,302 @@ bool Streamer::Initialize()
         else if (!_dashHost.empty())
             LOG_INFO("Streaming DASH stream on %s", endpoint.c_str());
 
-        _ffmpegPid = fork();
-        if (_ffmpegPid == 0)
-        {
-            // for the sake of flexibility, a shell script is used
-            // it's better than coding all ffmpeg arguments
-            // arguments used
-            // $1 = video file path
-            // $2 = HLS/DASH end point info in "transport://ip:port/path" format
-            //    (e.g rtmp://127.0.0.1:8080/hls_app/stream)
-            execlp("./streamer_ffmpeg_hls_dash.sh", "streamer_ffmpeg_hls_dash.sh",
-                _videoFilePath.c_str(),             // $1
-                endpoint.c_str(),                   // $2
-                nullptr);
-        }
+        // for the sake of flexibility, a shell script is used
+        // it's better than coding all ffmpeg arguments
+        // arguments used
+        // $1 = video file path
+        // $2 = HLS/DASH end point info in "transport://ip:port/path" format
+        //    (e.g rtmp://127.0.0.1:8080/hls_app/stream)
+        // $3 = extra input options (e.g playlist/loop options)
+        std::vector<std::string> args = {
+            "./streamer_ffmpeg_hls_dash.sh",
+            _inputPath,                         // $1
+            endpoint,                           // $2
+            _inputOptions                       // $3
+        };
+
+        // output goes to nginx, nothing to wait for
+        if (_supervisor.Spawn("ffmpeg", args, false) < 0)
+            return false;
     }
     else
     {
-        // regular case, wait for open port
-        // ffmpeg necessarily starts on localhost, only port can change
-        std::string ffmpegHost = "127.0.0.1";
+        // regular case, ffmpeg output becomes the primary source
+        // on hot restart, the old streamer's ffmpeg carries on as ours
+        if (_isTakingOver)
+            ffmpegIndex = InheritFFmpeg(0, "ffmpeg",
+                GetFFmpegArgs(_inputPath, _inputOptions), _isEncoderPooled ? _inputList : "");
+        else if (_isEncoderPooled)
+            ffmpegIndex = _supervisor.SpawnPooled("ffmpeg", GetFFmpegArgs(_inputPath, _inputOptions),
+                                                  _inputList);
+        else
+            ffmpegIndex = StartFFmpeg(_inputPath, _inputOptions, "ffmpeg");
 
-        // need to setup a seperate endpoint for ffmpeg, since the port will differ
+        if (ffmpegIndex < 0)
+            return false;
 
-        std::string endpoint = std::string("tcp") +
-            "://" + ffmpegHost +
-            ":" + std::to_string(_ffmpegPort);
+        if (_isInputSeekable)
+            _supervisor.SetResumable(ffmpegIndex);
 
-        LOG_INFO("Starting and connecting to ffmpeg...");
+        _primary.InitializeConnected(_supervisor.GetOutputFd(ffmpegIndex), "ffmpeg");
+    }
 
-        _ffmpegPid = fork();
-        if (_ffmpegPid == 0)
+    // standby runs alongside the primary source the whole time, so it's ready
+    // to take over the moment the primary one stalls
+    if (_primary.IsInitialized() && !_standbySource.empty())
+    {
+        if (_standbySource.find("://") != std::string::npos)
         {
-            // for the sake of flexibility, a shell script is used
-            // it's better than coding all ffmpeg arguments
-            // arguments used:
-            // $1 = video file path
-            // $2 = end point info in "transport://ip:port" format (e.g tcp://127.0.0.1:999$
-            // $3 = video size (e.g 420x320)
-            // $4 = video bitrate (e.g 400k or 400000)
-            execlp("./streamer_ffmpeg.sh", "streamer_ffmpeg.sh",
-                _videoFilePath.c_str(),             // $1
-                endpoint.c_str(),                   // $2
-                _streamEntry.videoSize.c_str(),     // $3
-                _streamEntry.bitRate.c_str(),       // $4
-                nullptr);
+            RestartSource const& source = _restartState.header.sources[1];
+            bool isOpen = _isTakingOver ?
+                _standby.InitializeInherited(_standbySource, "Standby encoder",
+                    _restartState.TakeFd(source.listenFd), _restartState.TakeFd(source.socketFd)) :
+                _standby.Initialize(_standbySource, "Standby encoder");
+            if (!isOpen)
+            {
+                LOG_ERROR("Failed to open standby ingest endpoint");
+                return false;
+            }
         }
-        _ffmpegSocketFd = socket(AF_INET, SOCK_STREAM, 0);
+        else
+        {
+            // e.g a "technical difficulties" slate, looped for as long as needed
+            _standbyIndex = _isTakingOver ?
+                InheritFFmpeg(1, "Standby ffmpeg", GetFFmpegArgs(_standbySource, "-stream_loop -1"), "") :
+                StartFFmpeg(_standbySource, "-stream_loop -1", "Standby ffmpeg");
+            if (_standbyIndex < 0)
+                return false;
 
-        hostent* server = gethostbyname(ffmpegHost.c_str());
+            _standby.InitializeConnected(_supervisor.GetOutputFd(_standbyIndex), "Standby ffmpeg");
+        }
+    }
 
-        sockaddr_in addr;
-        bzero((char*)&addr, sizeof(addr));
-        addr.sin_family = AF_INET;
-        bcopy((char*)server->h_addr, (char*)&addr.sin_addr.s_addr, server->h_length);
-        addr.sin_port = htons(_ffmpegPort);
+    if (_primary.IsInitialized())
+    {
+        _failover.Initialize(&_primary, _standby.IsInitialized() ? &_standby : nullptr,
+                             _failoverTimeout);
+        if (_isTakingOver)
+            _failover.Restore(_restartState.header.failover, _restartState.readyData,
+                              _restartState.rawData);
+    }
 
-        while (true)
+    // stream is only announced once there's something to watch, a stream
+    // taken over is watched already, and stays announced
+    if (ffmpegIndex >= 0 && !_isTakingOver && !_supervisor.WaitReady(ffmpegIndex, early_exit))
+        return false;
+
+    _ffmpegIndex = ffmpegIndex;
+
+    _supervisor.Start();
+    if (_isTakingOver)
+        LOG_INFO("Took over stream with %zu viewers in %ld ms", _clients.Size(),
+            getMSTime() - startMs);
+    else
+    {
+        LOG_INFO("Stream start took %ld ms", getMSTime() - startMs);
+        _portal->NewStream(_streamEntry);
+        for (std::unique_ptr<SubStream> const& subStream : _subStreams)
+            _portal->NewStream(GetSubStreamEntry(*subStream));
+    }
+    _isAnnounced = true;
+
+    // next one takes over from us
+    if (!_restartName.empty())
+    {
+        int restartSocketFd = _restartState.TakeFd(_restartState.header.restartSocketFd);
+        if (restartSocketFd >= 0)
+            _restart.ListenInherited(restartSocketFd);
+        else if (!_restart.Listen(_restartName))
+            return false;
+    }
+
+    // whatever was handed over and isn't used
+    _restartState.CloseFds();
+    _restartState = RestartState();
+    return true;
+}
+
+bool Streamer::InitializeSubStreams()
+{
+    // viewers are sent to by the regular backend, out of rings filled from ours
+    if (!_isTcp || _fanout.IsInitialized() || !_subscribeBus.empty() || !_vodCachePath.empty())
+    {
+        LOG_ERROR("Sub streams are only for TCP streams we read ourselves, with --net_io sync");
+        return false;
+    }
+
+    for (size_t i = 0; i < _subStreamArgs.size(); ++i)
+    {
+        std::string const& arg = _subStreamArgs[i];
+        // $name:$port:$pids[:$bit_rate], e.g "news_radio:9610:audio:128k"
+        std::vector<std::string> fields;
+        std::stringstream ss(arg);
+        std::string field;
+        while (std::getline(ss, field, ':'))
+            fields.push_back(field);
+
+        std::unique_ptr<SubStream> subStream(new SubStream());
+        if (fields.size() < 3 || !subStream->filter.Initialize(fields[2]))
         {
-            if (early_exit)
-            {
-                LOG_INFO("Exiting early...");
+            LOG_ERROR("Bad sub stream %s, it's '$name:$port:$pids[:$bit_rate]'", arg.c_str());
+            return false;
+        }
+
+        subStream->name = fields[0];
+        subStream->port = atoi(fields[1].c_str());
+        subStream->bitRate = fields.size() > 3 ? fields[3] : _streamEntry.bitRate;
+        subStream->byteRate = std::max(parseBitRate(subStream->bitRate) / 8, 1L);
+        // on hot restart, handed over like the stream's own
+        if (_isTakingOver && i < _restartState.subStreamFds.size() / 2)
+        {
+            if (!subStream->ring.Adopt(_restartState.TakeFd(_restartState.subStreamFds[2 * i + 1])))
                 return false;
-            }
 
-            // @todo: socket won't connect if ffmpeg had an early exit, handle that
-            int error = connect(_ffmpegSocketFd, (sockaddr*)&addr, sizeof(addr));
-            if (error >= 0)
-                break; // no error, finally have a valid socket
+            subStream->listenSocketFd = _restartState.TakeFd(_restartState.subStreamFds[2 * i]);
+        }
+        else
+        {
+            bool isRingOpen = _restartName.empty() ?
+                subStream->ring.Initialize(RING_CHUNK_COUNT, &_arena) :
+                subStream->ring.InitializeShared(RING_CHUNK_COUNT, subStream->name, &_arena);
+            if (!isRingOpen)
+                return false;
 
-            usleep(500 * 1e3); // 500ms sleep
+            subStream->listenSocketFd = openListenSocket(subStream->port, true);
         }
+
+        if (subStream->listenSocketFd < 0)
+            return false;
+
+        subStream->rendition = _renditions.AddPinned(subStream->ring, subStream->byteRate);
+        LOG_INFO("Sub stream %s (%s) on port %d", subStream->name.c_str(), fields[2].c_str(),
+            subStream->port);
+        _subStreams.push_back(std::move(subStream));
     }
-    _portal->NewStream(_streamEntry);
+
     return true;
 }
 
+StreamEntry Streamer::GetSubStreamEntry(SubStream const& subStream) const
+{
+    // found by searching for the stream it's part of, too
+    StreamEntry entry = _streamEntry;
+    entry.streamName = subStream.name;
+    entry.endpoint = _transport + "://" + _host + ":" + std::to_string(subStream.port);
+    entry.bitRate = subStream.bitRate;
+    entry.dvrEndpoint.clear();
+    entry.localEndpoint.clear();
+    entry.keyword.push_back(_streamEntry.streamName);
+    if (subStream.filter.IsAudioOnly())
+        entry.keyword.push_back("audio");
+
+    return entry;
+}
+
 void Streamer::Close()
 {
-    while (!_clientList.empty())
+    _dvr.Stop();
+    _indexer.Stop();
+    _recorder.Stop();
+    _recorder.Close();
+
+    _fanout.Close();
+
+    for (size_t i = 0; i < _clients.Size(); ++i)
     {
-        int clientSocket = _clientList.front();
-        _clientList.pop_front();
-        close(clientSocket);
+        if (_clients.GetFd(i) >= 0)
+            close(_clients.GetFd(i));
     }
+    _clients.Clear();
 
     if (_listenSocketFd > 0)
     {
-        shutdown(_listenSocketFd, SHUT_RDWR);
+        // after a hot restart it's the new streamer's listen socket too
+        if (!_isStateShared)
+            shutdown(_listenSocketFd, SHUT_RDWR);
         close(_listenSocketFd);
     }
 
-    if (_ffmpegSocketFd > 0)
+    _primary.Close();
+    _standby.Close();
+    _bus.Close();
+    _publisher.Close();
+    _renditions.Close();
+
+    for (std::unique_ptr<SubStream> const& subStream : _subStreams)
     {
-        shutdown(_ffmpegSocketFd, SHUT_RDWR);
-        close(_ffmpegSocketFd);
+        if (_portal && _isAnnounced)
+            _portal->CloseStream(GetSubStreamEntry(*subStream));
+        if (subStream->listenSocketFd >= 0)
+            close(subStream->listenSocketFd);
     }
 
-    if (_portal)
+    if (_portal && _isAnnounced)
         _portal->CloseStream(_streamEntry);
 
-    if (_ffmpegPid > 0)
-    {
-        LOG_INFO("Sending SIGTERM to ffmpeg...");
-        kill(_ffmpegPid, SIGTERM);
+    if (!_concatFilePath.empty() && !_isStateShared)
+        unlink(_concatFilePath.c_str());
 
-        LOG_INFO("Waiting on ffmpeg to exit...");
-        wait(NULL);
-    }
+    // a successor still waiting on us gives up right away
+    _restart.Close();
+    _restartState.CloseFds();
+
+    _supervisor.Stop();
+    _scheduler.Release();
 }
 
 void Streamer::Run()
 {
-    LOG_INFO("Streamer ready");
+    LOG_INFO("Streamer ready, %s TS parser", tsGetParserPath());
 
     // HLS/DASH case, nginx is acting as a stream server and we've got nothing to do
     // just sleep until ffmpeg exits
     if (!_hlsHost.empty() || !_dashHost.empty())
     {
-        while (!early_exit)
+        while (!early_exit && !_supervisor.IsAllFinished())
             usleep(100 * 1e3);
 
         return;
     }
 
+    // VOD case, clients are served from the cached file, at their own pace
+    if (!_vodCachePath.empty())
+    {
+        while (!early_exit)
+        {
+            _vod.Serve();
+            usleep(10 * 1e3);
+        }
+
+        return;
+    }
+
+    if (_dvrWindow > 0)
+        _dvr.Start();
+
+    if (!_indexFilePath.empty())
+        _indexer.Start();
+
+    if (!_recordFilePath.empty())
+        _recorder.Start();
+
     long const sleepTime = 20; // 20ms sleep time per cycle
     long const tickTimer = 30; // 30ms for sending data per cycle
 
     while (true)
     {
+        // a new streamer binary is taking over, we're done once it has
+        if (_restart.Accept() && HandOver())
+            return;
+
         // periodically accept new clients
-        if (_isTcp) // tcp
+        if (_fanout.IsInitialized())
+            _fanout.Update();
+        else if (_isTcp) // tcp
         {
-            int clientSocket = accept4(_listenSocketFd, NULL, NULL, SOCK_NONBLOCK);
-            if (clientSocket > 0)
-            {
-                _clientList.push_back(clientSocket);
-                LOG_INFO("Accepted new client, fd %d", clientSocket);
-            }
+            AcceptClient(_listenSocketFd, _renditions.GetDefault());
+            for (std::unique_ptr<SubStream> const& subStream : _subStreams)
+                AcceptClient(subStream->listenSocketFd, subStream->rendition);
         }
 
         else // udp
@@ -371,72 +888,108 @@ void Streamer::Run()
             struct sockaddr_in clientaddr;
             socklen_t clientlen = sizeof(clientaddr);
             char buffer[BUFFER_SIZE];
+            ++_netSyscalls;
             int n = recvfrom(_listenSocketFd, buffer, BUFFER_SIZE, 0,
                              (struct sockaddr *) &clientaddr, &clientlen);
             clientaddr.sin_port = htons(atoi(buffer));
             //clientaddr.sin_family = AF_INET;
             //clientaddr.sin_addr.s_addr = INADDR_ANY;
-            if (n != -1 && Streamer::IsNewClient(clientaddr))
+            if (n != -1 && _clients.Find(clientaddr) == SIZE_MAX)
             {
                 LOG_INFO("Pushing new Client port %d", htons(clientaddr.sin_port));
-                _clientUdpList.push_back(clientaddr);
+                _clients.Add(-1, clientaddr, _ring.GetWriteSeq(), getMSTime());
             }
         }
 
-        usleep(sleepTime * 1e3); // wait a bit so there's some data to send
+        if (_isTcp && !_fanout.IsInitialized())
+            SampleClients();
+
+        UpdateNetMetrics();
+        UpdateArenaMetrics();
+        ReportHealth();
+        _metrics.Flush();
+
+        PacedSleep(sleepTime); // wait a bit so there's some data to send
 
         long timeBeforeTick = getMSTime();
 
-        // read from ffmpeg and send data
-        // ffmpeg will produce data to be read at the right video play speed
+        // read from source and send data
+        // ffmpeg (or a live encoder) will produce data at the right video play speed
         while (true)
         {
-            char buffer[BUFFER_SIZE];
-            ssize_t remaining = BUFFER_SIZE;
-            while (remaining > 0)
+            // paced UDP viewers are sent to on time, not only as chunks come in
+            long wakeMs = GetPacingWakeMs();
+            bool isRead = true;
+            if (_bus.IsSubscribed())
+            {
+                if (wakeMs > 0 && !_bus.Wait(std::max(wakeMs - getMSTime(), 0L)))
+                    isRead = false;
+                // sent straight out of the publisher's ring, no copy
+                else if (!_bus.Next(early_exit))
+                    return;
+            }
+            else
             {
-                if (early_exit)
+                // read straight into the broadcast ring, DVR reads it from there
+                RingChunk* chunk = _ring.BeginWrite();
+                size_t size = 0;
+                if (!ReadChunk(chunk->data, size, wakeMs))
                     return;
 
-                size_t offset = BUFFER_SIZE - remaining;
-                ssize_t n = read(_ffmpegSocketFd, buffer + offset, remaining);
-                if (n < 0)
+                // woken up to pace UDP viewers, nothing read yet
+                isRead = size > 0;
+                if (isRead)
                 {
-                    LOG_ERROR("ffmpeg socket read failed");
-                    return;
+                    // chunks are cut before keyframes, so one can only be first
+                    uint8_t const* data = (uint8_t const*)chunk->data;
+                    _ring.CommitWrite(size, tsIsKeyframeStart(data) ? RING_FLAG_KEYFRAME : 0,
+                                      tsFindPcr(data, size));
+                    _health.Analyze(data, size, getMSTime());
+
+                    // filtered once for all of a sub stream's viewers
+                    for (std::unique_ptr<SubStream>& subStream : _subStreams)
+                    {
+                        RingChunk* subChunk = subStream->ring.BeginWrite();
+                        uint8_t* subData = (uint8_t*)subChunk->data;
+                        size_t subSize = subStream->filter.Filter(data, size, subData);
+                        if (subSize == 0)
+                            continue;
+
+                        // any audio frame is a place to start from, with no video
+                        bool isKeyframe = tsIsKeyframeStart(subData) ||
+                            (subStream->filter.IsAudioOnly() && tsIsPayloadStart(subData));
+                        subStream->ring.CommitWrite(subSize, isKeyframe ? RING_FLAG_KEYFRAME : 0,
+                                                    tsFindPcr(subData, subSize));
+                    }
                 }
-
-                remaining -= n;
             }
 
             // send data to all clients, remove clients with invalid/closed sockets
-            if (_isTcp)
+            if (_fanout.IsInitialized())
+                _fanout.Update();
+            else if (_isTcp)
             {
-                _clientList.remove_if([buffer](int clientSocket)
-                                      {
-                                          if (write(clientSocket, buffer, BUFFER_SIZE) < 0)
-                                          {
-                                              LOG_INFO("Removing client fd %d from client list", clientSocket);
-                                              return true;
-                                          }
-
-                                          return false;
-                                      });
+                // each client catches up from its own cursor, as far as its socket takes
+                // removing moves the last client into i, which is sent to next
+                size_t i = 0;
+                while (i < _clients.Size())
+                {
+                    if (!SendToClient(i))
+                    {
+                        LOG_INFO("Removing client fd %d from client list", _clients.GetFd(i));
+                        close(_clients.GetFd(i));
+                        _clients.Remove(i);
+                        continue;
+                    }
+
+                    ++i;
+                }
             }
             else
-            {
-                _clientUdpList.remove_if([buffer, this](struct sockaddr_in clientaddr) {
-                        int clientlen = sizeof(clientaddr);
-                        if (sendto(_listenSocketFd, buffer, BUFFER_SIZE, 0,
-                                   (struct sockaddr *) &clientaddr, clientlen) < 0)
-                            {
-                                //LOG_INFO("Removing client fd %d from client list", clientSocket);
-                                LOG_INFO("Failed sent to port %d, removing", ntohs(clientaddr.sin_port));
-                                return true;
-                            }
-                        return false;
-                    });
-            }
+                SendToUdpClients();
+
+            if (_bus.IsSubscribed() && isRead)
+                _bus.Release();
 
             // break out of send cycle and accept new clients if a tick has passed
             long now = getMSTime();
@@ -446,31 +999,835 @@ void Streamer::Run()
     }
 }
 
+void Streamer::AcceptClient(int listenSocketFd, size_t rendition)
+{
+    ++_netSyscalls;
+    struct sockaddr_in clientaddr;
+    socklen_t clientlen = sizeof(clientaddr);
+    int clientSocket = accept4(listenSocketFd, (struct sockaddr *) &clientaddr,
+                               &clientlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (clientSocket <= 0)
+        return;
+
+    int lowat = CLIENT_NOTSENT_LOWAT;
+    if (setsockopt(clientSocket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) < 0)
+        LOG_INFO("Can't bound send queue of fd %d: %s", clientSocket, strerror(errno));
+
+    // TCP paces itself at that rate, no fq qdisc needed
+    uint32_t pacingRate = _pacingRate * _renditions.Get(rendition).byteRate / _byteRate;
+    if (pacingRate > 0 && setsockopt(clientSocket, SOL_SOCKET, SO_MAX_PACING_RATE,
+                                     &pacingRate, sizeof(pacingRate)) < 0)
+        LOG_INFO("Can't pace fd %d: %s", clientSocket, strerror(errno));
+
+    // same as io_uring backend, the ring is a GOP cache, new clients start from
+    // its newest keyframe so their players have something to decode right away
+    BroadcastRing const& ring = *_renditions.Get(rendition).ring;
+    uint64_t seq = ring.FindKeyframe(UINT64_MAX);
+    if (seq == UINT64_MAX)
+        seq = ring.GetWriteSeq();
+
+    _clients.Add(clientSocket, clientaddr, seq, getMSTime(), rendition);
+    LOG_INFO("Accepted new client, fd %d", clientSocket);
+}
+
+bool Streamer::ReadControl(size_t index)
+{
+    // only zapping clients send anything, and they start right after connecting
+    uint8_t flags = _clients.GetFlags(index);
+    if (!(flags & CLIENT_FLAG_ZAPPING) &&
+        getMSTime() - _clients.GetJoinedMs(index) > CLIENT_CONTROL_WINDOW)
+        return true;
+
+    char control[16];
+    ++_netSyscalls;
+    ssize_t ret = recv(_clients.GetFd(index), control, sizeof(control), MSG_DONTWAIT);
+    if (ret < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    if (ret == 0)
+        return false; // client is gone
+
+    bool isActivated = false;
+    for (ssize_t i = 0; i < ret; ++i)
+    {
+        if (control[i] == CLIENT_CONTROL_STANDBY)
+            flags |= CLIENT_FLAG_ZAPPING | CLIENT_FLAG_STANDBY;
+        else if (control[i] == CLIENT_CONTROL_ACTIVATE)
+        {
+            flags = (flags | CLIENT_FLAG_ZAPPING) & ~CLIENT_FLAG_STANDBY;
+            isActivated = true;
+        }
+    }
+
+    _clients.SetFlags(index, flags);
+
+    // standby only takes hold between chunks, so this is a fresh start
+    if (isActivated && !(flags & CLIENT_FLAG_STANDBY) && _clients.GetOffset(index) == 0)
+    {
+        BroadcastRing const& ring = *_renditions.Get(_clients.GetRendition(index)).ring;
+        uint64_t seq = ring.FindKeyframe(UINT64_MAX);
+        _clients.SkipTo(index, seq != UINT64_MAX ? seq : ring.GetWriteSeq());
+        ++_zapActivations;
+    }
+
+    return true;
+}
+
+bool Streamer::SendToClient(size_t index)
+{
+    if (!ReadControl(index))
+        return false;
+
+    // standby viewers are kept connected, and sent nothing
+    if ((_clients.GetFlags(index) & CLIENT_FLAG_STANDBY) && _clients.GetOffset(index) == 0)
+        return true;
+
+    int clientSocket = _clients.GetFd(index);
+    BroadcastRing const& ring = *_renditions.Get(_clients.GetRendition(index)).ring;
+    uint64_t writeSeq = ring.GetWriteSeq();
+    uint64_t seq = _clients.GetSeq(index);
+    bool isOverrun = ring.IsOverrun(seq);
+
+    // rather than sending stale video, a viewer that fell behind live skips
+    // ahead to the newest keyframe, which can only be done between chunks
+    if (_clients.GetOffset(index) == 0 && (isOverrun || GetClientLag(index) > _maxLag))
+    {
+        // on a long GOP it can be at the tail of the ring, a bus publisher may
+        // overwrite it before we get to send it, the next one is newest then
+        uint64_t keyframeSeq = ring.FindKeyframe(UINT64_MAX);
+        while (keyframeSeq != UINT64_MAX && ring.IsOverrun(keyframeSeq))
+            keyframeSeq = ring.FindKeyframe(UINT64_MAX);
+
+        if (keyframeSeq != UINT64_MAX && keyframeSeq > seq)
+        {
+            LOG_INFO("Client fd %d is %ldms behind live, skipping to keyframe",
+                clientSocket, GetClientLag(index));
+            _clients.SkipTo(index, keyframeSeq);
+            isOverrun = false;
+            ++_lagSkips;
+        }
+    }
+
+    if (isOverrun)
+    {
+        LOG_INFO("Client fd %d fell a full ring behind", clientSocket);
+        return false;
+    }
+
+    while (_clients.GetSeq(index) < writeSeq)
+    {
+        seq = _clients.GetSeq(index);
+        RingChunk const* chunk = ring.GetChunk(seq);
+        char const* data = chunk->data;
+        uint32_t offset = _clients.GetOffset(index);
+        uint32_t size = std::min(chunk->size, (uint32_t)RING_CHUNK_SIZE);
+
+        // a bus ring can be overwritten under us, nothing torn is sent if it
+        // already was, and the viewer is dropped if it was while sending
+        if (chunk->seq.load(std::memory_order_acquire) != seq)
+        {
+            LOG_INFO("Client fd %d fell a full ring behind", clientSocket);
+            return false;
+        }
+
+        // first chunk of another encode, the same flagged copy each time round
+        // if it takes a few writes
+        if (_clients.GetFlags(index) & CLIENT_FLAG_SWITCHED)
+        {
+            size = tsMarkDiscontinuity((uint8_t const*)data, size, (uint8_t*)_switchChunk);
+            data = _switchChunk;
+        }
+
+        ++_netSyscalls;
+        ssize_t ret = write(clientSocket, data + offset, size - offset);
+        if (ret < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK; // send queue is at its bound
+
+        if (chunk->seq.load(std::memory_order_acquire) != seq)
+        {
+            LOG_INFO("Client fd %d fell a full ring behind", clientSocket);
+            return false;
+        }
+
+        _clients.OnSent(index, ret, size);
+        if (_clients.GetSeq(index) != seq)
+            _clients.SetFlags(index, _clients.GetFlags(index) & ~CLIENT_FLAG_SWITCHED);
+        if ((uint32_t)ret < size - offset)
+            break;
+
+        // went standby mid-chunk, and that chunk is done
+        if (_clients.GetFlags(index) & CLIENT_FLAG_STANDBY)
+            break;
+    }
+
+    return true;
+}
+
+long Streamer::GetClientLag(size_t index)
+{
+    // whatever is queued for the viewer, ring backlog and socket, at stream rate,
+    // plus half a round trip for what's in flight
+    Rendition const& rendition = _renditions.Get(_clients.GetRendition(index));
+    ClientTcpInfo const& info = _clients.GetTcpInfo(index);
+    // offset into a first chunk flagged for a switch can be past its size
+    uint64_t queued = rendition.ring->GetBytesSince(_clients.GetSeq(index));
+    queued -= std::min(queued, (uint64_t)_clients.GetOffset(index));
+    queued += info.queuedBytes;
+    return queued * 1000 / rendition.byteRate + info.rttUs / 2000;
+}
+
+void Streamer::SwitchRendition(size_t index, size_t rendition, long now)
+{
+    // lands about as far behind live as the viewer is now, on the keyframe
+    // before that, so it neither skips nor repeats more than a GOP
+    // chunks are cut short at keyframes, so lag is walked back in their sizes
+    BroadcastRing const& ring = *_renditions.Get(rendition).ring;
+    uint64_t behind = GetClientLag(index) * _renditions.Get(rendition).byteRate / 1000;
+    uint64_t seq = ring.GetWriteSeq();
+    while (seq > 0 && !ring.IsOverrun(seq - 1) && ring.GetBytesSince(seq) < behind)
+        --seq;
+
+    uint64_t keyframeSeq = ring.FindKeyframe(seq);
+    if (keyframeSeq == UINT64_MAX)
+        keyframeSeq = ring.FindKeyframe(UINT64_MAX);
+
+    // none in the ring yet, tried again next sample
+    if (keyframeSeq == UINT64_MAX)
+        return;
+
+    LOG_INFO("Moving client fd %d to %ld bytes/s rendition", _clients.GetFd(index),
+        _renditions.Get(rendition).byteRate);
+    _clients.SwitchTo(index, rendition, keyframeSeq, now);
+    ++_renditionSwitches;
+}
+
+void Streamer::SendToUdpClients()
+{
+    // UDP viewers all get the same chunks, at the same time
+    uint64_t writeSeq = _ring.GetWriteSeq();
+    if (_ring.IsOverrun(_udpSeq) && !_clients.Empty())
+        LOG_ERROR("UDP viewers fell a full ring behind, skipping %lu chunks",
+            (unsigned long)(writeSeq - 1 - _udpSeq));
+    if (_ring.IsOverrun(_udpSeq) || _clients.Empty())
+    {
+        _udpSeq = writeSeq - 1;
+        _isUdpBehind = false;
+    }
+
+    // paced viewers get chunks at the pacing rate, out of a token bucket
+    // refilled as time passes, rather than in bursts as the source has them
+    // credit only builds up to a burst while they were caught up, while they
+    // were behind a late wake up sends them what they're owed
+    long now = getMSTime();
+    if (_pacingRate > 0)
+    {
+        _pacingTokens += (double)_pacingRate * (now - _pacingMs) / 1e3;
+        if (!_isUdpBehind)
+            _pacingTokens = std::min(_pacingTokens, (double)PACING_BURST);
+    }
+    _pacingMs = now;
+
+    while (_udpSeq < writeSeq)
+    {
+        RingChunk const* chunk = _ring.GetChunk(_udpSeq);
+        char const* data = chunk->data;
+        uint32_t size = std::min(chunk->size, (uint32_t)RING_CHUNK_SIZE);
+        if (_pacingRate > 0 && _pacingTokens < size)
+            break;
+
+        // a bus ring can be overwritten under us, and datagrams can't be taken
+        // back, so its chunks are copied out once for all viewers
+        if (_bus.IsSubscribed())
+        {
+            uint32_t flags = 0;
+            if (!_ring.Read(_udpSeq, _udpChunk, size, flags))
+            {
+                LOG_ERROR("Bus chunk was overwritten before being sent");
+                ++_udpSeq;
+                continue;
+            }
+
+            data = _udpChunk;
+        }
+
+        size_t i = 0;
+        while (i < _clients.Size())
+        {
+            ++_netSyscalls;
+            sockaddr_in const& clientaddr = _clients.GetAddr(i);
+            if (sendto(_listenSocketFd, data, size, 0,
+                       (struct sockaddr *) &clientaddr, sizeof(clientaddr)) < 0)
+            {
+                LOG_INFO("Failed sent to port %d, removing", ntohs(clientaddr.sin_port));
+                _clients.Remove(i);
+                continue;
+            }
+
+            _clients.OnSent(i, size, size);
+            ++i;
+        }
+
+        _pacingTokens -= size;
+        ++_udpSeq;
+    }
+
+    _isUdpBehind = _udpSeq < writeSeq;
+}
+
+long Streamer::GetPacingWakeMs() const
+{
+    if (_isTcp || _pacingRate == 0 || _clients.Empty() || _udpSeq >= _ring.GetWriteSeq())
+        return 0;
+
+    // when the bucket holds enough for the next chunk
+    RingChunk const* chunk = _ring.GetChunk(_udpSeq);
+    double missing = std::min(chunk->size, (uint32_t)RING_CHUNK_SIZE) - _pacingTokens;
+    return _pacingMs + std::max((long)(missing * 1e3 / _pacingRate), 0L) + 1;
+}
+
+void Streamer::PacedSleep(long ms)
+{
+    long endMs = getMSTime() + ms;
+    for (long now = getMSTime(); now < endMs; now = getMSTime())
+    {
+        long wakeMs = GetPacingWakeMs();
+        usleep((std::min(wakeMs > 0 ? wakeMs : endMs, endMs) - now) * 1000);
+        if (wakeMs > 0)
+            SendToUdpClients();
+    }
+}
+
+void Streamer::SampleClients()
+{
+    long now = getMSTime();
+    if (_renditions.GetCount() > 1)
+        _renditions.Update();
+
+    for (size_t i = 0; i < _clients.Size(); ++i)
+    {
+        ClientTcpInfo& info = _clients.GetTcpInfo(i);
+        if (now - info.sampledMs < CLIENT_SAMPLE_INTERVAL ||
+            (_clients.GetFlags(i) & CLIENT_FLAG_STANDBY))
+            continue;
+
+        tcp_info tcpInfo;
+        socklen_t length = sizeof(tcpInfo);
+        memset(&tcpInfo, 0, sizeof(tcpInfo));
+        ++_netSyscalls;
+        if (getsockopt(_clients.GetFd(i), IPPROTO_TCP, TCP_INFO, &tcpInfo, &length) < 0)
+            continue;
+
+        info.rttUs = tcpInfo.tcpi_rtt;
+        info.cwnd = tcpInfo.tcpi_snd_cwnd;
+        // tcpi_notsent_bytes is 0 on kernels that don't report it
+        info.queuedBytes = tcpInfo.tcpi_notsent_bytes + tcpInfo.tcpi_unacked * tcpInfo.tcpi_snd_mss;
+
+        // a viewer with a backlog takes all it can, so what went out is its
+        // throughput, otherwise it's only what we had to send, and what its
+        // congestion window allows per round trip is a better bet
+        uint64_t sent = _clients.GetSentBytes(i) - info.sentBytes;
+        Rendition const& rendition = _renditions.Get(_clients.GetRendition(i));
+        if (info.sampledMs > 0 && _clients.GetBacklog(i, rendition.ring->GetWriteSeq()) > 0)
+            info.throughput = sent * 1000 / (now - info.sampledMs);
+        else if (tcpInfo.tcpi_rtt > 0)
+        {
+            info.throughput = std::max((uint64_t)tcpInfo.tcpi_delivery_rate,
+                (uint64_t)tcpInfo.tcpi_snd_cwnd * tcpInfo.tcpi_snd_mss * 1000000 / tcpInfo.tcpi_rtt);
+        }
+
+        info.sentBytes = _clients.GetSentBytes(i);
+        info.sampledMs = now;
+
+        // moves only happen between chunks, or it's left for next sample
+        if (_renditions.GetCount() > 1 && _clients.GetOffset(i) == 0 &&
+            now - _clients.GetSwitchedMs(i) >= RENDITION_HOLD_TIME)
+        {
+            size_t current = _clients.GetRendition(i);
+            size_t target = _renditions.Choose(current, info.throughput, GetClientLag(i), _maxLag);
+            if (target != current)
+                SwitchRendition(i, target, now);
+        }
+    }
+}
+
+void Streamer::UpdateNetMetrics()
+{
+    if (!_metrics.IsEnabled())
+        return;
+
+    // backends are compared by syscalls and CPU per viewer
+    std::string backend = "backend=\"" + _netIo + "\"";
+    uint64_t syscalls = _fanout.IsInitialized() ? _fanout.GetSyscallCount() : _netSyscalls;
+    size_t viewers = _fanout.IsInitialized() ? _fanout.GetClientCount() :
+        _clients.Size();
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+
+    _metrics.SetCounter("iss_net_syscalls_total", syscalls,
+        "Syscalls made to accept and send to viewers", backend);
+    _metrics.SetGauge("iss_viewers", viewers, "Connected viewers", backend);
+    _metrics.SetCounter("iss_cpu_seconds_total", cpu, "Streamer CPU time, user and system", backend);
+
+    if (_fanout.IsInitialized())
+    {
+        _metrics.SetGauge("iss_standby_viewers", _fanout.GetStandbyCount(),
+            "Zapping clients' connections kept on standby");
+        _metrics.SetCounter("iss_zap_activations_total", _fanout.GetZapActivations(),
+            "Standby connections zapped to");
+    }
+
+    if (!_isTcp || _fanout.IsInitialized())
+        return;
+
+    long maxLag = 0;
+    size_t standbys = 0;
+    for (size_t i = 0; i < _clients.Size(); ++i)
+    {
+        if (_clients.GetFlags(i) & CLIENT_FLAG_STANDBY)
+            ++standbys;
+        else
+            maxLag = std::max(maxLag, GetClientLag(i));
+    }
+
+    _metrics.SetGauge("iss_viewer_lag_max_ms", maxLag,
+        "Estimated lag behind live of the viewer furthest behind");
+    _metrics.SetCounter("iss_viewer_lag_skips_total", _lagSkips,
+        "Times a viewer skipped ahead to live");
+    _metrics.SetCounter("iss_rendition_switches_total", _renditionSwitches,
+        "Times a viewer was moved to another rendition");
+    _metrics.SetGauge("iss_standby_viewers", standbys,
+        "Zapping clients' connections kept on standby");
+    _metrics.SetCounter("iss_zap_activations_total", _zapActivations,
+        "Standby connections zapped to");
+}
+
+void Streamer::ReportHealth()
+{
+    // a relayed bus stream is analyzed by its publisher
+    long now = getMSTime();
+    if (_bus.IsSubscribed() || now - _lastHealthMs < HEALTH_REPORT_INTERVAL)
+        return;
+
+    _lastHealthMs = now;
+    _health.Sample(now);
+    HealthStats const& stats = _health.GetStats();
+
+    if (_metrics.IsEnabled())
+    {
+        std::string const help = "TR 101 290-lite errors in relayed stream";
+        _metrics.SetCounter("iss_stream_errors_total", stats.ccErrors, help, "type=\"cc\"");
+        _metrics.SetCounter("iss_stream_errors_total", stats.patErrors, help, "type=\"pat\"");
+        _metrics.SetCounter("iss_stream_errors_total", stats.pmtErrors, help, "type=\"pmt\"");
+        _metrics.SetCounter("iss_stream_errors_total", stats.pcrErrors, help, "type=\"pcr\"");
+        _metrics.SetCounter("iss_stream_errors_total", stats.pcrDiscontinuities, help,
+            "type=\"pcr_discontinuity\"");
+        _metrics.SetGauge("iss_stream_pcr_jitter_ms", stats.pcrJitterMs,
+            "Peak to peak PCR jitter against arrival time");
+        _metrics.SetGauge("iss_stream_pat_interval_ms", stats.patIntervalMs,
+            "Longest gap between PATs");
+        _metrics.SetGauge("iss_stream_pcr_interval_ms", stats.pcrIntervalMs,
+            "Longest gap between PCRs");
+        _metrics.SetGauge("iss_stream_bit_rate", stats.bitRate, "Measured stream bit rate");
+        _metrics.SetGauge("iss_stream_keyframe_age_ms", stats.keyframeAgeMs,
+            "Time since last keyframe");
+        _metrics.SetGauge("iss_stream_healthy", _health.IsHealthy(),
+            "Whether last interval was free of errors and within limits");
+    }
+
+    StreamHealth health;
+    health.streamName = _streamEntry.streamName;
+    health.endpoint = _streamEntry.endpoint;
+    health.isHealthy = _health.IsHealthy();
+    health.ccErrors = stats.ccErrors;
+    health.patErrors = stats.patErrors;
+    health.pmtErrors = stats.pmtErrors;
+    health.pcrErrors = stats.pcrErrors;
+    health.pcrDiscontinuities = stats.pcrDiscontinuities;
+    health.pcrJitterMs = stats.pcrJitterMs;
+    health.patIntervalMs = stats.patIntervalMs;
+    health.pcrIntervalMs = stats.pcrIntervalMs;
+    health.keyframeAgeMs = stats.keyframeAgeMs;
+    health.measuredBitRate = stats.bitRate;
+    health.declaredBitRate = _byteRate * 8;
+
+    // a heartbeat isn't worth waiting for, or failing over
+    try
+    {
+        PortalInterfacePrx::uncheckedCast(_portal->ice_oneway())->ReportHealth(health);
+    }
+    catch (Ice::Exception const& e)
+    {
+        LOG_ERROR("Failed to report stream health: %s", e.what());
+    }
+}
+
+void Streamer::UpdateArenaMetrics()
+{
+    if (!_metrics.IsEnabled())
+        return;
+
+    _metrics.SetGauge("iss_arena_mapped_bytes", _arena.GetHugeBytes(),
+        "Stream buffer memory mapped by the arena", "pages=\"huge\"");
+    _metrics.SetGauge("iss_arena_mapped_bytes", _arena.GetRegularBytes(),
+        "Stream buffer memory mapped by the arena", "pages=\"regular\"");
+    _metrics.SetCounter("iss_arena_maps_total", _arena.GetMapCount(), "Arena mappings made");
+    _metrics.SetCounter("iss_pool_allocations_total", _arena.GetPoolAllocations(),
+        "Buffer blocks taken from pool freelists");
+    _metrics.SetCounter("iss_pool_exhausted_total", _arena.GetPoolExhausted(),
+        "Buffer block requests that found the pool empty");
+
+    int64_t dtlbMisses = _arena.GetDtlbMisses();
+    if (dtlbMisses >= 0)
+        _metrics.SetCounter("iss_dtlb_misses_total", dtlbMisses, "dTLB load misses, user space");
+}
+
+bool Streamer::PrepareInput()
+{
+    _inputPath = _videoFilePath;
+    // same input as a concat list, for pooled encoders
+    std::string entries;
+
+    // .m3u playlists are played back to back by a single ffmpeg instance,
+    // through its concat demuxer, so timestamps, PCR and continuity counters
+    // carry on from one file to the next and viewers see a single stream
+    std::string extension = _videoFilePath.substr(_videoFilePath.find_last_of('.') + 1);
+    if (extension == "m3u" || extension == "m3u8")
+    {
+        std::ifstream playlist(_videoFilePath);
+        if (!playlist)
+            return false;
+
+        // playlist entries are relative to the playlist itself
+        char dirBuffer[PATH_MAX];
+        strncpy(dirBuffer, _videoFilePath.c_str(), sizeof(dirBuffer) - 1);
+        dirBuffer[sizeof(dirBuffer) - 1] = 0;
+        std::string playlistDir = dirname(dirBuffer);
+
+        size_t fileCount = 0;
+        std::string line;
+        while (std::getline(playlist, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+
+            // skip comments and #EXTINF style directives
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            std::string path = line[0] == '/' ? line : playlistDir + "/" + line;
+            char resolved[PATH_MAX];
+            if (!realpath(path.c_str(), resolved))
+            {
+                LOG_ERROR("Playlist entry %s not found", line.c_str());
+                return false;
+            }
+
+            entries += concatEntry(resolved);
+            ++fileCount;
+        }
+
+        _concatFilePath = "/tmp/" + _streamEntry.streamName + ".concat";
+        std::ofstream concat(_concatFilePath);
+        concat << "ffconcat version 1.0\n" << entries;
+
+        if (fileCount == 0 || !concat)
+            return false;
+
+        LOG_INFO("Playing %zu files from playlist %s", fileCount, _videoFilePath.c_str());
+        _inputPath = _concatFilePath;
+        _inputOptions = "-f concat -safe 0";
+    }
+    else
+    {
+        // urls and such can't go in a list, they just don't use the pool
+        char resolved[PATH_MAX];
+        if (realpath(_videoFilePath.c_str(), resolved))
+            entries = concatEntry(resolved);
+
+        // ffmpeg seeks by time in a file, not in a concat list or across loops,
+        // where it'd have to know each file's duration
+        _isInputSeekable = !entries.empty() && _loopCount == 0;
+    }
+
+    // looping is done by ffmpeg too, with no restart in between
+    if (_loopCount != 0)
+        _inputOptions = "-stream_loop " + std::to_string(_loopCount) +
+            (_inputOptions.empty() ? "" : " ") + _inputOptions;
+
+    // a list loops by repeating its entries, which can't go on forever
+    if (!entries.empty() && _loopCount >= 0)
+    {
+        _inputList = "ffconcat version 1.0\n";
+        for (int i = 0; i <= _loopCount; ++i)
+            _inputList += entries;
+    }
+
+    return true;
+}
+
+std::vector<std::string> Streamer::GetFFmpegArgs(std::string const& input,
+    std::string const& inputOptions) const
+{
+    // ffmpeg writes to an fd inherited from us, no port to wait on
+    std::string output = "pipe:" + std::to_string(SUPERVISOR_OUTPUT_FD);
+
+    // for the sake of flexibility, a shell script is used
+    // it's better than coding all ffmpeg arguments
+    // arguments used:
+    // $1 = video file path
+    // $2 = output url (e.g pipe:3)
+    // $3 = video size (e.g 420x320)
+    // $4 = video bitrate (e.g 400k or 400000)
+    // $5 = extra input options (e.g playlist/loop options)
+    // $6 = encoder options (e.g "-preset ultrafast -threads 2")
+    // $7 = position to resume at, added by the supervisor on restarts
+    return {
+        "./streamer_ffmpeg.sh",
+        input,                              // $1
+        output,                             // $2
+        _streamEntry.videoSize,             // $3
+        _streamEntry.bitRate,               // $4
+        inputOptions,                       // $5
+        _scheduler.GetEncoderOptions()      // $6
+    };
+}
+
+std::vector<std::string> Streamer::GetPoolArgs() const
+{
+    // pooled encoders read their input as a concat list from stdin
+    return GetFFmpegArgs("pipe:0", "-protocol_whitelist file,pipe -f concat -safe 0");
+}
+
+void Streamer::OnEncoderProgress(int index, pid_t pid, double speed)
+{
+    // standby encoder idles along, only the live one is scheduled
+    if (index != _ffmpegIndex)
+        return;
+
+    // restarting an encoder that can't resume would replay its input from the
+    // start, it keeps the options it was admitted with then
+    bool changed = false;
+    if (_isInputSeekable)
+        changed = _scheduler.Update(pid, speed);
+    else
+        _scheduler.Sample(pid, speed);
+
+    _metrics.SetGauge("iss_encoder_realtime_factor", speed,
+        "Encoder speed relative to realtime, ffmpeg's speed (capped near 1 by -re)");
+    _metrics.SetGauge("iss_encoder_cpu_cores", _scheduler.GetCpu(), "Encoder CPU use in cores");
+    _metrics.SetGauge("iss_encoder_threads", _scheduler.GetThreads(), "Encoder thread cap");
+    _metrics.SetGauge("iss_encoder_preset_level", _scheduler.GetPresetLevel(),
+        "x264 preset in use, 0 is ultrafast, higher is slower and better");
+
+    if (changed)
+        _supervisor.Reconfigure(index, GetFFmpegArgs(_inputPath, _inputOptions), GetPoolArgs());
+}
+
+int Streamer::StartFFmpeg(std::string const& input, std::string const& inputOptions,
+    std::string const& name)
+{
+    LOG_INFO("Starting %s for %s...", name.c_str(), input.c_str());
+
+    int index = _supervisor.Spawn(name, GetFFmpegArgs(input, inputOptions), true);
+    if (index < 0)
+        LOG_ERROR("Failed to start %s", name.c_str());
+
+    return index;
+}
+
+int Streamer::InheritFFmpeg(int source, std::string const& name,
+    std::vector<std::string> const& args, std::string const& inputList)
+{
+    RestartEncoder const& encoder = _restartState.header.encoders[source];
+    int outputFd = _restartState.TakeFd(_restartState.header.sources[source].socketFd);
+    if (outputFd < 0)
+    {
+        LOG_ERROR("No %s to take over", name.c_str());
+        return -1;
+    }
+
+    return _supervisor.Inherit(name, args, inputList, encoder.pid,
+        _restartState.TakeFd(encoder.stderrFd), _restartState.TakeFd(encoder.childOutputFd),
+        outputFd, encoder.resumeUs);
+}
+
+bool Streamer::TakeOver()
+{
+    // viewers' renditions are indexes, ours have to be the same
+    RestartHeader const& header = _restartState.header;
+    bool isCompatible = header.renditionCount == _renditions.GetCount() &&
+        header.subStreamCount == _subStreams.size();
+    for (RestartClient const& client : _restartState.clients)
+        isCompatible = isCompatible && client.rendition < _renditions.GetCount();
+
+    if (!isCompatible)
+    {
+        LOG_ERROR("Streamer we take over from has other renditions or sub streams, are the options the same?");
+        return false;
+    }
+
+    if (!_restart.TakeOver())
+    {
+        LOG_ERROR("Streamer we take over from carried on");
+        return false;
+    }
+
+    // it's all ours now, viewers carry on from where they were, mid-chunk or not
+    _isStateShared = false;
+    long now = getMSTime();
+    for (RestartClient const& client : _restartState.clients)
+    {
+        size_t index = _clients.Add(_restartState.TakeFd(client.fd), client.addr, client.seq, now,
+                                    client.rendition);
+        _clients.SetOffset(index, client.offset);
+        _clients.SetFlags(index, client.flags);
+    }
+
+    _udpSeq = header.udpSeq;
+    return true;
+}
+
+bool Streamer::HandOver()
+{
+    LOG_INFO("Handing stream over for a hot restart...");
+    long startMs = getMSTime();
+
+    // nothing moves until it's settled who carries on
+    _supervisor.Pause();
+    _publisher.Pause();
+
+    RestartState state;
+    RestartHeader& header = state.header;
+    strncpy(header.streamName, _streamEntry.streamName.c_str(), RESTART_NAME_SIZE - 1);
+    header.renditionCount = _renditions.GetCount();
+    header.restartSocketFd = state.AddFd(_restart.GetListenFd());
+    header.listenSocketFd = state.AddFd(_listenSocketFd);
+    header.ringFd = _bus.IsSubscribed() ? -1 : state.AddFd(_ring.GetFd());
+    header.busSocketFd = state.AddFd(_publisher.GetSocketFd());
+    for (int fd : _publisher.GetSubscribers())
+        state.busSubscriberFds.push_back(state.AddFd(fd));
+
+    IngestSource const* sources[2] = { &_primary, &_standby };
+    int encoders[2] = { _ffmpegIndex, _standbyIndex };
+    for (int i = 0; i < 2; ++i)
+    {
+        header.sources[i].listenFd = state.AddFd(sources[i]->GetListenFd());
+        header.sources[i].socketFd = state.AddFd(sources[i]->GetSocketFd());
+        if (encoders[i] < 0)
+            continue;
+
+        // one that finished only has its output left to be read
+        SupervisedProcess const& process = _supervisor.GetProcess(encoders[i]);
+        header.encoders[i].pid = process.finished ? -1 : process.pid;
+        if (process.finished)
+            continue;
+
+        header.encoders[i].stderrFd = state.AddFd(process.stderrFd);
+        header.encoders[i].childOutputFd = state.AddFd(process.childOutputFd);
+        header.encoders[i].resumeUs = process.resumeUs;
+    }
+
+    for (std::unique_ptr<SubStream> const& subStream : _subStreams)
+    {
+        state.subStreamFds.push_back(state.AddFd(subStream->listenSocketFd));
+        state.subStreamFds.push_back(state.AddFd(subStream->ring.GetFd()));
+    }
+
+    for (size_t i = 0; i < _clients.Size(); ++i)
+    {
+        RestartClient client;
+        memset(&client, 0, sizeof(client));
+        client.fd = state.AddFd(_clients.GetFd(i));
+        client.addr = _clients.GetAddr(i);
+        client.seq = _clients.GetSeq(i);
+        client.offset = _clients.GetOffset(i);
+        client.rendition = _clients.GetRendition(i);
+        client.flags = _clients.GetFlags(i);
+        state.clients.push_back(client);
+    }
+
+    header.udpSeq = _udpSeq;
+    if (_primary.IsInitialized())
+        _failover.Save(header.failover, state.readyData, state.rawData);
+
+    if (!_restart.HandOver(state))
+    {
+        LOG_ERROR("New streamer didn't take over, carrying on");
+        if (_primary.IsInitialized())
+            _failover.Restore(header.failover, state.readyData, state.rawData);
+        _publisher.Resume();
+        _supervisor.Start();
+        return false;
+    }
+
+    // it's the new streamer's, we let go without closing anything down
+    if (_ffmpegIndex >= 0)
+        _supervisor.Release(_ffmpegIndex);
+    if (_standbyIndex >= 0)
+        _supervisor.Release(_standbyIndex);
+    _isStateShared = true;
+    _isAnnounced = false;
+    LOG_INFO("Handed over %zu viewers in %ld ms", _clients.Size(), getMSTime() - startMs);
+    return true;
+}
+
+bool Streamer::ReadChunk(char* buffer, size_t& size, long wakeMs)
+{
+    // sources are validated and framed by the ingest, and supervised by failover
+    return _failover.Read(buffer, BUFFER_SIZE, size, _chunkDeadline, early_exit, wakeMs);
+}
 void Streamer::PrintUsage()
 {
     LOG_INFO("Usage: ./streamer $video_file $stream_name [options]");
+    LOG_INFO("$video_file can also be an .m3u playlist, played back to back as one stream");
     LOG_INFO("Options:");
     LOG_INFO("'--transport $trans' sets endpoint transport protocol, tcp by default");
     LOG_INFO("'--host $host' sets endpoint host, localhost by default");
     LOG_INFO("'--port $port' specifies listen port, 9600 by default");
-    LOG_INFO("'--ffmpeg_port $port' sets port for ffmpeg instance, 9601 by default");
     LOG_INFO("'--video_size $size' specifies video size, 480x270 by default");
     LOG_INFO("'--bit_rate $rate' sets video bit rate, 400k by default");
     LOG_INFO("'--keywords $key1,$key2...,$keyn' adds search keywords to stream");
     LOG_INFO("'--hls $nginx_host'");
     LOG_INFO("'--dash $nginx_host'");
-}
-
-bool Streamer::IsNewClient(sockaddr_in clientaddr)
-{
-    int clientPort = ntohs(clientaddr.sin_port);
-    char *clientIp = inet_ntoa(clientaddr.sin_addr);
-    for (sockaddr_in& addr : _clientUdpList)
-    {
-        int port = ntohs(addr.sin_port);
-        char *ip = inet_ntoa(addr.sin_addr);
-        if (port == clientPort && strcmp(clientIp, ip) == 0)
-            return false;
-    }
-    return true;
+    LOG_INFO("'--dvr_window $seconds' keeps a timeshift window of given length, disabled by default");
+    LOG_INFO("'--dvr_port $port' sets timeshift HTTP port, 9602 by default");
+    LOG_INFO("'--dvr_file $path' sets timeshift ring file, /tmp/$stream_name.dvr by default");
+    LOG_INFO("'--index_file $path' writes a keyframe/time side index of the relayed stream");
+    LOG_INFO("'--record $path' records stream to $path, with a side index at $path.idx");
+    LOG_INFO("'--vod $cache_file' serves video as seekable VOD over HTTP, transcoded once to $cache_file");
+    LOG_INFO("'--loop $count' loops video (or playlist) $count more times, -1 loops forever");
+    LOG_INFO("'--ingest $url' takes TS pushed by an encoder to tcp://host:port or udp://host:port");
+    LOG_INFO("                instead of reading $video_file, which is then ignored");
+    LOG_INFO("'--standby $source' keeps a hot-standby source to fail over to, either an ingest url");
+    LOG_INFO("                or a video file looped by a second ffmpeg instance");
+    LOG_INFO("'--failover_timeout $ms' fails over after $ms without data, 1000 by default");
+    LOG_INFO("'--encoder_pool $count' keeps $count pre-started encoders, for fast starts and restarts, 0 by default");
+    LOG_INFO("'--host_cores $count' sets cores shared by all encoders on the host, all by default");
+    LOG_INFO("'--encoder_threads $count' caps encoder threads, 2 by default");
+    LOG_INFO("'--preset $preset' sets best x264 preset, lowered while behind realtime, ultrafast by default");
+    LOG_INFO("'--admission_wait $seconds' waits for encoder capacity instead of refusing stream, 0 by default");
+    LOG_INFO("'--metrics_file $path' writes Prometheus text format metrics to $path");
+    LOG_INFO("'--publish_bus $name' shares stream with other streamers on the host through bus $name,");
+    LOG_INFO("                its name by default, with a bigger ring");
+    LOG_INFO("'--numa_node $node' binds stream buffers to NUMA node $node, or the node of NIC $node,");
+    LOG_INFO("                or the one Streamer starts on with auto, auto by default");
+    LOG_INFO("'--net_io $backend' sends to TCP viewers with sync (regular syscalls), uring or");
+    LOG_INFO("                uring_sqpoll (kernel thread submits), sync by default");
+    LOG_INFO("'--chunk_deadline $ms' sends data that waited $ms for a full chunk anyway,");
+    LOG_INFO("                100 by default");
+    LOG_INFO("'--max_lag $ms' skips TCP viewers more than $ms behind live ahead to the newest");
+    LOG_INFO("                keyframe, 3000 by default");
+    LOG_INFO("'--pacing $percent' paces each viewer at the stream bit rate plus $percent,");
+    LOG_INFO("                not paced by default");
+    LOG_INFO("'--rendition $bus:$bit_rate' moves TCP viewers to and from the rendition");
+    LOG_INFO("                published on bus $bus as their throughput allows, can be repeated");
+    LOG_INFO("'--sub_stream $name:$port:$pids[:$bit_rate]' serves part of the stream on $port,");
+    LOG_INFO("                $pids is audio or a PID list, e.g 256,257, can be repeated");
+    LOG_INFO("'--ts_parser scalar' parses TS packets one at a time, the fastest path the");
+    LOG_INFO("                CPU supports (avx2, sse4.1) is used by default");
+    LOG_INFO("'--bus $name' relays stream published on bus $name instead of reading $video_file");
+    LOG_INFO("'--hot_restart $name' hands the stream over to a new streamer run with the same");
+    LOG_INFO("                options and $name, viewers and encoders carry on");
 }
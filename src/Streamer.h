@@ -1,9 +1,28 @@
 #include <unistd.h>
 #include <string>
+#include <vector>
 
 #include <Ice/Ice.h>
 #include "PortalInterface.h"
 
+#include "BroadcastRing.h"
+#include "DvrBuffer.h"
+#include "StreamIndex.h"
+#include "Recorder.h"
+#include "VodServer.h"
+#include "IngestSource.h"
+#include "Failover.h"
+#include "FFmpegSupervisor.h"
+#include "EncoderScheduler.h"
+#include "Metrics.h"
+#include "SourceBus.h"
+#include "UringFanout.h"
+#include "ClientTable.h"
+#include "Renditions.h"
+#include "HealthAnalyzer.h"
+#include "SubStream.h"
+#include "HotRestart.h"
+
 using namespace StreamingService;
 
 class Streamer : public Ice::Application
@@ -20,27 +39,165 @@ public:
 
 private:
     static void PrintUsage();
-    bool IsNewClient(struct sockaddr_in clientaddr);
+    bool PrepareInput();
+    std::vector<std::string> GetFFmpegArgs(std::string const& input,
+        std::string const& inputOptions) const;
+    std::vector<std::string> GetPoolArgs() const;
+    bool InitializeSubStreams();
+    StreamEntry GetSubStreamEntry(SubStream const& subStream) const;
+    void OnEncoderProgress(int index, pid_t pid, double speed);
+    int StartFFmpeg(std::string const& input, std::string const& inputOptions,
+        std::string const& name);
+    // wakeMs as for FailoverSource::Read()
+    bool ReadChunk(char* buffer, size_t& size, long wakeMs = 0);
+    void AcceptClient(int listenSocketFd, size_t rendition);
+    // false if client has to be removed
+    bool ReadControl(size_t index);
+    bool SendToClient(size_t index);
+    // ms behind live, estimated
+    long GetClientLag(size_t index);
+    void SwitchRendition(size_t index, size_t rendition, long now);
+    void SendToUdpClients();
+    // when paced UDP viewers can get their next chunk, 0 if they've none waiting
+    long GetPacingWakeMs() const;
+    // sleeps ms, sending to paced UDP viewers as it goes
+    void PacedSleep(long ms);
+    void SampleClients();
+    void UpdateNetMetrics();
+    void UpdateArenaMetrics();
+    void ReportHealth();
+    // hot restart, false if the new streamer didn't take over
+    bool HandOver();
+    // false if we can't carry on with what the old streamer sent
+    bool TakeOver();
+    // encoder feeding source, as it was handed over
+    int InheritFFmpeg(int source, std::string const& name,
+        std::vector<std::string> const& args, std::string const& inputList);
 
 private:
     // configs
     std::string _videoFilePath;
+    // times to loop video, -1 loops forever
+    int _loopCount = 0;
+    // what ffmpeg actually reads, video file or generated concat list
+    std::string _inputPath;
+    std::string _inputOptions;
+    std::string _concatFilePath;
+    // a single file played once, a restarted encoder resumes where it was
+    bool _isInputSeekable = false;
+    // input as a concat list for pooled encoders, empty if it can't be one
+    std::string _inputList;
+    // pre-started encoders, waiting for their input
+    int _encoderPoolSize = 0;
+    bool _isEncoderPooled = false;
+    // host wide encoder scheduling, 0 cores means all of them
+    int _hostCores = 0;
+    int _encoderThreads = 0;
+    std::string _preset;
+    int _admissionWait = 0;
+    // shared-memory source bus, publishes our ring under another name or relays
+    // someone else's, disabled if empty
+    std::string _publishBus;
+    std::string _subscribeBus;
+    // viewer network I/O backend, sync, uring or uring_sqpoll
+    std::string _netIo;
+    // NUMA node for stream buffers, number, NIC name or auto
+    std::string _numaNode;
+    // ms data waits for a full chunk before it's sent anyway
+    long _chunkDeadline = 0;
+    // ms a TCP viewer can fall behind live before skipping ahead
+    long _maxLag = 0;
+    // % above stream bit rate viewers are paced at, -1 doesn't pace
+    int _pacingHeadroom = -1;
+    // renditions published by other streamers, $bus:$bit_rate
+    std::vector<std::string> _renditionBuses;
+    // parts of the stream served on ports of their own, $name:$port:$pids[:$bit_rate]
+    std::vector<std::string> _subStreamArgs;
+    // Prometheus textfile, disabled if empty
+    std::string _metricsFilePath;
+    // live ingest url, encoder pushes to us instead of ffmpeg, disabled if empty
+    std::string _ingestUrl;
+    // hot-standby source, ingest url or a file looped by a second ffmpeg, disabled if empty
+    std::string _standbySource;
+    // how long the active source can go without data before failing over
+    long _failoverTimeout = 0;
     // endpoint info
     std::string _transport;
     std::string _host;
     int _listenPort = 0;
-    int _ffmpegPort = 0;
     // support for HLS/DASH
     std::string _hlsHost;
     std::string _dashHost;
+    // timeshift/DVR window, disabled if 0
+    long _dvrWindow = 0;
+    int _dvrPort = 0;
+    std::string _dvrFilePath;
+    // side index of relayed stream, disabled if empty
+    std::string _indexFilePath;
+    // server side recording, disabled if empty
+    std::string _recordFilePath;
+    // seekable VOD mode, disabled if empty
+    std::string _vodCachePath;
+    // hot restart socket name, disabled if empty
+    std::string _restartName;
 
     PortalInterfacePrx _portal;
     StreamEntry _streamEntry;
-    std::list<int> _clientList;
-    std::list<struct sockaddr_in> _clientUdpList;
+    // declared first, buffers below are mapped from it
+    BufferArena _arena;
+    BroadcastRing _ring;
+    DvrBuffer _dvr;
+    RelayIndexer _indexer;
+    Recorder _recorder;
+    VodServer _vod;
+    IngestSource _primary;
+    IngestSource _standby;
+    FailoverSource _failover;
+    FFmpegSupervisor _supervisor;
+    EncoderScheduler _scheduler;
+    Metrics _metrics;
+    SourceBus _bus;
+    // shares our ring with local players, and streamers publishing through us
+    SourceBus _publisher;
+    UringFanout _fanout;
+    // accept/send syscalls made by sync backend
+    uint64_t _netSyscalls = 0;
+    int _ffmpegIndex = -1;
+    // viewers of sync backend, TCP or UDP
+    ClientTable _clients;
+    // stream bit rate in bytes/s, converts queued bytes to lag
+    long _byteRate = 1;
+    uint64_t _lagSkips = 0;
+    uint64_t _zapActivations = 0;
+    // ours and other streamers', TCP viewers are moved between them
+    RenditionSet _renditions;
+    uint64_t _renditionSwitches = 0;
+    std::vector<std::unique_ptr<SubStream>> _subStreams;
+    // what we relay, sampled and reported to the Portal every HEALTH_REPORT_INTERVAL
+    HealthAnalyzer _health;
+    long _lastHealthMs = 0;
+    // bytes/s each viewer is paced at, 0 if not paced
+    uint32_t _pacingRate = 0;
+    // next chunk UDP viewers get, and what pacing lets them get right now
+    uint64_t _udpSeq = 0;
+    double _pacingTokens = 0;
+    long _pacingMs = 0;
+    bool _isUdpBehind = false; // as of the last send, see SendToUdpClients()
+    // bus chunk being sent to UDP viewers, see SendToUdpClients()
+    char _udpChunk[RING_CHUNK_SIZE];
+    // viewer's first chunk of a rendition, see tsMarkDiscontinuity()
+    char _switchChunk[RING_CHUNK_SIZE * 2];
     int _listenSocketFd = 0;
-    int _ffmpegSocketFd = 0;
-    pid_t _ffmpegPid = 0;
     bool _isTcp = true;
+    HotRestart _restart;
+    // what the streamer we take over from sent, fds left are closed once we're up
+    RestartState _restartState;
+    bool _isTakingOver = false;
+    // sockets, rings and encoders are another streamer's too, the one we hand
+    // over to or take over from, so Close() leaves them be
+    bool _isStateShared = false;
+    // stream is in the Portal's catalog on our behalf
+    bool _isAnnounced = false;
+    int _standbyIndex = -1;
 };
 
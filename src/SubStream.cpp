@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+
+#include "SubStream.h"
+
+// MPEG-2 CRC-32, PSI sections end with it
+static uint32_t crc32(uint8_t const* data, size_t size)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc ^= (uint32_t)data[i] << 24;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+
+    return crc;
+}
+
+PidFilter::PidFilter()
+{
+    memset(_actions, PID_DROP, sizeof(_actions));
+    memset(_isListed, 0, sizeof(_isListed));
+    _actions[0] = PID_PAT;
+}
+
+bool PidFilter::Initialize(std::string const& pids)
+{
+    _isAudioOnly = pids == "audio";
+    if (_isAudioOnly)
+        return true;
+
+    std::stringstream ss(pids);
+    std::string pid;
+    while (std::getline(ss, pid, ','))
+    {
+        // PAT and PMT are always there
+        int value = atoi(pid.c_str());
+        if (value <= 0 || value >= TS_NULL_PID)
+            return false;
+
+        _isListed[value] = true;
+        _actions[value] = PID_KEEP;
+    }
+
+    return !pids.empty();
+}
+
+size_t PidFilter::Filter(uint8_t const* data, size_t size, uint8_t* out)
+{
+    size_t outSize = 0;
+    for (size_t offset = 0; offset + TS_PACKET_SIZE <= size; offset += TS_PACKET_SIZE)
+    {
+        uint8_t const* pkt = data + offset;
+        uint8_t action = _actions[tsGetPid(pkt)];
+        if (action == PID_KEEP || action == PID_PAT)
+        {
+            if (action == PID_PAT && tsIsPayloadStart(pkt))
+                ParsePat(pkt);
+
+            memcpy(out + outSize, pkt, TS_PACKET_SIZE);
+            outSize += TS_PACKET_SIZE;
+        }
+        else if (action == PID_PMT)
+        {
+            // continuation packets of multi packet PMTs are left out too
+            if (tsIsPayloadStart(pkt) && RewritePmt(pkt, out + outSize))
+                outSize += TS_PACKET_SIZE;
+        }
+        else if (action == PID_PCR && tsGetPcr(pkt) >= 0)
+        {
+            WritePcr(pkt, out + outSize);
+            outSize += TS_PACKET_SIZE;
+        }
+    }
+
+    return outSize;
+}
+
+void PidFilter::ParsePat(uint8_t const* pkt)
+{
+    // first program's PMT, ffmpeg only writes one
+    size_t offset = tsGetPayloadOffset(pkt);
+    if (offset >= TS_PACKET_SIZE)
+        return;
+
+    offset += 1 + pkt[offset]; // pointer_field
+    if (offset + 12 > TS_PACKET_SIZE || pkt[offset] != 0x00)
+        return;
+
+    for (size_t i = offset + 8; i + 4 <= TS_PACKET_SIZE; i += 4)
+    {
+        uint16_t program = (pkt[i] << 8) | pkt[i + 1];
+        if (program == 0) // NIT
+            continue;
+
+        uint16_t pmtPid = ((pkt[i + 2] & 0x1F) << 8) | pkt[i + 3];
+        if (pmtPid > 0 && pmtPid < TS_NULL_PID)
+            _actions[pmtPid] = PID_PMT;
+        return;
+    }
+}
+
+bool PidFilter::RewritePmt(uint8_t const* pkt, uint8_t* out)
+{
+    // same PMT as last time, only the continuity counter changes
+    if (_hasPmt && memcmp(pkt + 4, _pmt + 4, TS_PACKET_SIZE - 4) == 0)
+    {
+        memcpy(out, pkt, 4);
+        memcpy(out + 4, _rewrittenPmt + 4, TS_PACKET_SIZE - 4);
+        return true;
+    }
+
+    size_t offset = tsGetPayloadOffset(pkt);
+    if (offset >= TS_PACKET_SIZE)
+        return false;
+
+    size_t start = offset + 1 + pkt[offset]; // pointer_field
+    if (start + 16 > TS_PACKET_SIZE || pkt[start] != 0x02)
+        return false;
+
+    // whole section has to be in this packet
+    uint8_t const* section = pkt + start;
+    size_t sectionLength = ((section[1] & 0x0F) << 8) | section[2];
+    size_t programInfoLength = ((section[10] & 0x0F) << 8) | section[11];
+    size_t esStart = 12 + programInfoLength;
+    size_t esEnd = 3 + sectionLength - 4; // CRC
+    if (start + 3 + sectionLength > TS_PACKET_SIZE || sectionLength < 13 || esStart > esEnd)
+        return false;
+
+    uint8_t rewritten[TS_PACKET_SIZE];
+    memset(rewritten, 0xFF, sizeof(rewritten));
+    memcpy(rewritten, pkt, start + esStart);
+    size_t length = start + esStart;
+
+    for (size_t i = esStart; i + 5 <= esEnd;)
+    {
+        uint16_t pid = ((section[i + 1] & 0x1F) << 8) | section[i + 2];
+        size_t infoLength = ((section[i + 3] & 0x0F) << 8) | section[i + 4];
+        if (i + 5 + infoLength > esEnd)
+            return false;
+
+        bool isKept = _isAudioOnly ? IsAudio(section[i], section + i + 5, infoLength) :
+            _isListed[pid];
+        _actions[pid] = isKept ? PID_KEEP : PID_DROP;
+        if (isKept)
+        {
+            memcpy(rewritten + length, section + i, 5 + infoLength);
+            length += 5 + infoLength;
+        }
+
+        i += 5 + infoLength;
+    }
+
+    uint16_t pcrPid = ((section[8] & 0x1F) << 8) | section[9];
+    if (pcrPid != TS_NULL_PID && _actions[pcrPid] == PID_DROP)
+        _actions[pcrPid] = PID_PCR;
+
+    // section_length counts what follows it, CRC included
+    uint8_t* newSection = rewritten + start;
+    size_t newSectionLength = length - start - 3 + 4;
+    newSection[1] = (newSection[1] & 0xF0) | (newSectionLength >> 8);
+    newSection[2] = newSectionLength & 0xFF;
+
+    uint32_t crc = crc32(newSection, length - start);
+    rewritten[length] = crc >> 24;
+    rewritten[length + 1] = crc >> 16;
+    rewritten[length + 2] = crc >> 8;
+    rewritten[length + 3] = crc;
+
+    memcpy(_pmt, pkt, TS_PACKET_SIZE);
+    memcpy(_rewrittenPmt, rewritten, TS_PACKET_SIZE);
+    _hasPmt = true;
+
+    memcpy(out, rewritten, TS_PACKET_SIZE);
+    return true;
+}
+
+bool PidFilter::IsAudio(uint8_t streamType, uint8_t const* descriptors, size_t length)
+{
+    // MPEG-1/2 audio, AAC (ADTS, LATM), AC-3 and E-AC-3 (ATSC)
+    if (streamType == 0x03 || streamType == 0x04 || streamType == 0x0F ||
+        streamType == 0x11 || streamType == 0x81 || streamType == 0x87)
+        return true;
+
+    // private data, DVB says what it is in a descriptor
+    if (streamType != 0x06)
+        return false;
+
+    for (size_t i = 0; i + 2 <= length; i += 2 + descriptors[i + 1])
+    {
+        uint8_t tag = descriptors[i];
+        // AC-3, E-AC-3, DTS, AAC
+        if (tag == 0x6A || tag == 0x7A || tag == 0x7B || tag == 0x7C)
+            return true;
+
+        // registration descriptor, how ffmpeg marks Opus
+        if (tag == 0x05 && i + 6 <= length && memcmp(descriptors + i + 2, "Opus", 4) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+void PidFilter::WritePcr(uint8_t const* pkt, uint8_t* out)
+{
+    // adaptation field only, continuity counter doesn't count these
+    // random access is left out, it's the dropped video's
+    out[0] = TS_SYNC_BYTE;
+    out[1] = pkt[1] & 0x1F;
+    out[2] = pkt[2];
+    out[3] = 0x20;
+    out[4] = TS_PACKET_SIZE - 5;
+    out[5] = pkt[5] & 0x90; // discontinuity, PCR
+    memcpy(out + 6, pkt + 6, 6);
+    memset(out + 12, 0xFF, TS_PACKET_SIZE - 12);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "TSPacket.h"
+#include "BroadcastRing.h"
+
+// Keeps a subset of the stream's PIDs, e.g audio only for viewers on poor links
+// PAT is passed as is, the PMT is rewritten to only list what's kept (only
+// single packet PMTs, which is all ffmpeg writes), and if the PCR PID is
+// dropped (it's usually video), its PCRs still go out, in packets of their
+// own with no payload, so players keep their clock.
+// Packets are otherwise copied as they are, one table lookup per packet, and a
+// PMT is only rewritten when it changes.
+class PidFilter
+{
+public:
+    PidFilter();
+
+    // "audio" keeps audio streams listed in the PMT, otherwise a comma
+    // separated PID list, e.g "256,257"
+    bool Initialize(std::string const& pids);
+
+    bool IsAudioOnly() const { return _isAudioOnly; }
+
+    // out has room for size bytes, returns bytes written to it
+    size_t Filter(uint8_t const* data, size_t size, uint8_t* out);
+
+private:
+    void ParsePat(uint8_t const* pkt);
+    // false if PMT couldn't be parsed, and is left out
+    bool RewritePmt(uint8_t const* pkt, uint8_t* out);
+    static bool IsAudio(uint8_t streamType, uint8_t const* descriptors, size_t length);
+    void WritePcr(uint8_t const* pkt, uint8_t* out);
+
+private:
+    enum : uint8_t
+    {
+        PID_DROP,
+        PID_KEEP,
+        PID_PAT,
+        PID_PMT,
+        PID_PCR,    // dropped, but its PCRs are kept
+    };
+
+    uint8_t _actions[TS_PID_COUNT];
+    bool _isAudioOnly = false;
+    bool _isListed[TS_PID_COUNT];
+
+    // last PMT as received, and as rewritten
+    uint8_t _pmt[TS_PACKET_SIZE];
+    uint8_t _rewrittenPmt[TS_PACKET_SIZE];
+    bool _hasPmt = false;
+};
+
+// A sub stream, served on its own port and announced to the Portal as a
+// stream of its own
+// Filtered once per chunk into a ring of its own, its viewers are sent to
+// out of it like any other's, it's a rendition they're pinned to.
+struct SubStream
+{
+    std::string name;
+    int port = 0;
+    std::string bitRate;
+    long byteRate = 0;
+    int listenSocketFd = -1;
+    size_t rendition = 0;
+    PidFilter filter;
+    BroadcastRing ring;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MPEG-TS packet helpers
+// ffmpeg's mpegts muxer produces fixed 188 byte packets, so all helpers assume
+// a pointer to the start of a packet (the 0x47 sync byte)
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+#define TS_PID_COUNT 8192
+#define TS_NULL_PID 0x1FFF
+
+inline bool tsIsSynced(uint8_t const* pkt)
+{
+    return pkt[0] == TS_SYNC_BYTE;
+}
+
+inline uint16_t tsGetPid(uint8_t const* pkt)
+{
+    return ((pkt[1] & 0x1F) << 8) | pkt[2];
+}
+
+inline bool tsHasTransportError(uint8_t const* pkt)
+{
+    return (pkt[1] & 0x80) != 0;
+}
+
+// payload_unit_start_indicator, set when a PES/PSI section starts in this packet
+inline bool tsIsPayloadStart(uint8_t const* pkt)
+{
+    return (pkt[1] & 0x40) != 0;
+}
+
+inline bool tsHasAdaptationField(uint8_t const* pkt)
+{
+    return (pkt[3] & 0x20) != 0;
+}
+
+inline bool tsHasPayload(uint8_t const* pkt)
+{
+    return (pkt[3] & 0x10) != 0;
+}
+
+inline uint8_t tsGetContinuityCounter(uint8_t const* pkt)
+{
+    return pkt[3] & 0x0F;
+}
+
+// discontinuity_indicator, continuity counters may jump on these packets
+inline bool tsIsDiscontinuity(uint8_t const* pkt)
+{
+    return tsHasAdaptationField(pkt) && pkt[4] > 0 && (pkt[5] & 0x80) != 0;
+}
+
+// random_access_indicator, ffmpeg sets it on packets starting a video keyframe
+// and on every audio frame, see tsIsKeyframeStart() for keyframes only
+inline bool tsIsRandomAccess(uint8_t const* pkt)
+{
+    return tsHasAdaptationField(pkt) && pkt[4] > 0 && (pkt[5] & 0x40) != 0;
+}
+
+// PCR in 27MHz units, -1 if packet doesn't carry one
+inline int64_t tsGetPcr(uint8_t const* pkt)
+{
+    if (!tsHasAdaptationField(pkt) || pkt[4] < 7 || (pkt[5] & 0x10) == 0)
+        return -1;
+
+    uint8_t const* p = pkt + 6;
+    int64_t base = ((int64_t)p[0] << 25) | (p[1] << 17) | (p[2] << 9) | (p[3] << 1) | (p[4] >> 7);
+    int64_t extension = ((p[4] & 0x01) << 8) | p[5];
+    return base * 300 + extension;
+}
+
+// offset of payload inside packet, TS_PACKET_SIZE if packet has no payload
+inline size_t tsGetPayloadOffset(uint8_t const* pkt)
+{
+    if (!tsHasPayload(pkt))
+        return TS_PACKET_SIZE;
+
+    size_t offset = 4;
+    if (tsHasAdaptationField(pkt))
+        offset += 1 + pkt[4];
+
+    return offset < TS_PACKET_SIZE ? offset : TS_PACKET_SIZE;
+}
+
+// reads a 33 bit PES timestamp (90kHz)
+inline int64_t tsReadTimestamp(uint8_t const* p)
+{
+    return ((int64_t)(p[0] & 0x0E) << 29) |
+        (p[1] << 22) | ((p[2] & 0xFE) << 14) |
+        (p[3] << 7) | (p[4] >> 1);
+}
+
+inline bool tsIsVideoStream(uint8_t streamId)
+{
+    return (streamId & 0xF0) == 0xE0;
+}
+
+// parses the PES header starting in this packet
+// timestamp is the DTS if present, PTS otherwise, so it's always in decode order
+// returns false if packet doesn't start a PES packet with a timestamp
+inline bool tsParsePesStart(uint8_t const* pkt, uint8_t& streamId, int64_t& timestamp)
+{
+    if (!tsIsPayloadStart(pkt))
+        return false;
+
+    size_t offset = tsGetPayloadOffset(pkt);
+    if (offset + 19 > TS_PACKET_SIZE)
+        return false;
+
+    uint8_t const* pes = pkt + offset;
+    if (pes[0] != 0x00 || pes[1] != 0x00 || pes[2] != 0x01)
+        return false;
+
+    streamId = pes[3];
+    uint8_t ptsDtsFlags = pes[7] >> 6;
+    if (ptsDtsFlags == 3)
+        timestamp = tsReadTimestamp(pes + 14);
+    else if (ptsDtsFlags == 2)
+        timestamp = tsReadTimestamp(pes + 9);
+    else
+        return false;
+
+    return true;
+}
+
+// video keyframes are where a stream can be joined, random access is also set
+// on audio packets by some muxers
+inline bool tsIsKeyframeStart(uint8_t const* pkt)
+{
+    uint8_t streamId = 0;
+    int64_t timestamp = 0;
+    return tsIsRandomAccess(pkt) && tsParsePesStart(pkt, streamId, timestamp) &&
+        tsIsVideoStream(streamId);
+}
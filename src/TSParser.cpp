@@ -0,0 +1,331 @@
+#include <string.h>
+#include <algorithm>
+#include <immintrin.h>
+
+#include "TSParser.h"
+
+enum ParserPath
+{
+    PARSER_SCALAR,
+    PARSER_SSE41,
+    PARSER_AVX2
+};
+
+static ParserPath detectPath()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return PARSER_AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return PARSER_SSE41;
+    return PARSER_SCALAR;
+}
+
+static ParserPath const detectedPath = detectPath();
+static ParserPath path = detectedPath;
+
+static inline uint32_t load32(uint8_t const* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline bool hasAdaptationFlag(uint8_t const* pkt, uint8_t flags)
+{
+    return tsIsSynced(pkt) && tsHasAdaptationField(pkt) && pkt[4] > 0 && (pkt[5] & flags) != 0;
+}
+
+// scalar
+
+static size_t countSyncedScalar(uint8_t const* buffer, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!tsIsSynced(buffer + i * TS_PACKET_SIZE))
+            return i;
+    }
+
+    return count;
+}
+
+static void getPidsScalar(uint8_t const* buffer, size_t count, uint16_t* pids)
+{
+    for (size_t i = 0; i < count; ++i)
+        pids[i] = tsGetPid(buffer + i * TS_PACKET_SIZE);
+}
+
+static size_t findAdaptationFlagScalar(uint8_t const* buffer, size_t count, uint8_t flags)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (hasAdaptationFlag(buffer + i * TS_PACKET_SIZE, flags))
+            return i;
+    }
+
+    return count;
+}
+
+// SSE4.1, 4 packets per batch, loaded one by one, there's no gather
+
+__attribute__((target("sse4.1")))
+static inline __m128i load4(uint8_t const* buffer, size_t offset)
+{
+    return _mm_setr_epi32(load32(buffer + offset),
+                          load32(buffer + TS_PACKET_SIZE + offset),
+                          load32(buffer + 2 * TS_PACKET_SIZE + offset),
+                          load32(buffer + 3 * TS_PACKET_SIZE + offset));
+}
+
+__attribute__((target("sse4.1")))
+static size_t countSyncedSse41(uint8_t const* buffer, size_t count)
+{
+    __m128i const byteMask = _mm_set1_epi32(0xFF);
+    __m128i const sync = _mm_set1_epi32(TS_SYNC_BYTE);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i header = load4(buffer + i * TS_PACKET_SIZE, 0);
+        __m128i isSynced = _mm_cmpeq_epi32(_mm_and_si128(header, byteMask), sync);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(isSynced));
+        if (mask != 0xF)
+            return i + __builtin_ctz(~mask);
+    }
+
+    return i + countSyncedScalar(buffer + i * TS_PACKET_SIZE, count - i);
+}
+
+__attribute__((target("sse4.1")))
+static void getPidsSse41(uint8_t const* buffer, size_t count, uint16_t* pids)
+{
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        // header bytes 1 and 2, big endian, minus the 3 flag bits
+        __m128i header = load4(buffer + i * TS_PACKET_SIZE, 0);
+        __m128i pid = _mm_or_si128(
+            _mm_and_si128(header, _mm_set1_epi32(0x1F00)),
+            _mm_and_si128(_mm_srli_epi32(header, 16), _mm_set1_epi32(0xFF)));
+        __m128i packed = _mm_packus_epi32(pid, pid);
+        _mm_storel_epi64((__m128i*)(pids + i), packed);
+    }
+
+    getPidsScalar(buffer + i * TS_PACKET_SIZE, count - i, pids + i);
+}
+
+__attribute__((target("sse4.1")))
+static size_t findAdaptationFlagSse41(uint8_t const* buffer, size_t count, uint8_t flags)
+{
+    __m128i const zero = _mm_setzero_si128();
+    // sync byte, and adaptation_field_control's adaptation field bit
+    __m128i const headerMask = _mm_set1_epi32(0x200000FF);
+    __m128i const headerWanted = _mm_set1_epi32(0x20000000 | TS_SYNC_BYTE);
+    __m128i const lengthMask = _mm_set1_epi32(0xFF);
+    __m128i const flagMask = _mm_set1_epi32(flags << 8);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint8_t const* batch = buffer + i * TS_PACKET_SIZE;
+        __m128i header = load4(batch, 0);
+        __m128i field = load4(batch, 4);
+        __m128i isMatch = _mm_cmpeq_epi32(_mm_and_si128(header, headerMask), headerWanted);
+        isMatch = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(field, lengthMask), zero), isMatch);
+        isMatch = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(field, flagMask), zero), isMatch);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(isMatch));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + findAdaptationFlagScalar(buffer + i * TS_PACKET_SIZE, count - i, flags);
+}
+
+// AVX2, 8 packets per batch, gathered
+
+__attribute__((target("avx2")))
+static inline __m256i gather8(uint8_t const* buffer, size_t offset)
+{
+    __m256i const offsets = _mm256_setr_epi32(0, TS_PACKET_SIZE, 2 * TS_PACKET_SIZE,
+        3 * TS_PACKET_SIZE, 4 * TS_PACKET_SIZE, 5 * TS_PACKET_SIZE, 6 * TS_PACKET_SIZE,
+        7 * TS_PACKET_SIZE);
+    return _mm256_i32gather_epi32((int const*)(buffer + offset), offsets, 1);
+}
+
+__attribute__((target("avx2")))
+static size_t countSyncedAvx2(uint8_t const* buffer, size_t count)
+{
+    __m256i const byteMask = _mm256_set1_epi32(0xFF);
+    __m256i const sync = _mm256_set1_epi32(TS_SYNC_BYTE);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i header = gather8(buffer + i * TS_PACKET_SIZE, 0);
+        __m256i isSynced = _mm256_cmpeq_epi32(_mm256_and_si256(header, byteMask), sync);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(isSynced));
+        if (mask != 0xFF)
+            return i + __builtin_ctz(~mask);
+    }
+
+    return i + countSyncedScalar(buffer + i * TS_PACKET_SIZE, count - i);
+}
+
+__attribute__((target("avx2")))
+static void getPidsAvx2(uint8_t const* buffer, size_t count, uint16_t* pids)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i header = gather8(buffer + i * TS_PACKET_SIZE, 0);
+        __m256i pid = _mm256_or_si256(
+            _mm256_and_si256(header, _mm256_set1_epi32(0x1F00)),
+            _mm256_and_si256(_mm256_srli_epi32(header, 16), _mm256_set1_epi32(0xFF)));
+        // packs within 128 bit lanes, the two halves are then put side by side
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(pid, pid), 0x08);
+        _mm_storeu_si128((__m128i*)(pids + i), _mm256_castsi256_si128(packed));
+    }
+
+    getPidsScalar(buffer + i * TS_PACKET_SIZE, count - i, pids + i);
+}
+
+__attribute__((target("avx2")))
+static size_t findAdaptationFlagAvx2(uint8_t const* buffer, size_t count, uint8_t flags)
+{
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i const headerMask = _mm256_set1_epi32(0x200000FF);
+    __m256i const headerWanted = _mm256_set1_epi32(0x20000000 | TS_SYNC_BYTE);
+    __m256i const lengthMask = _mm256_set1_epi32(0xFF);
+    __m256i const flagMask = _mm256_set1_epi32(flags << 8);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint8_t const* batch = buffer + i * TS_PACKET_SIZE;
+        __m256i header = gather8(batch, 0);
+        __m256i field = gather8(batch, 4);
+        __m256i isMatch = _mm256_cmpeq_epi32(_mm256_and_si256(header, headerMask), headerWanted);
+        isMatch = _mm256_andnot_si256(
+            _mm256_cmpeq_epi32(_mm256_and_si256(field, lengthMask), zero), isMatch);
+        isMatch = _mm256_andnot_si256(
+            _mm256_cmpeq_epi32(_mm256_and_si256(field, flagMask), zero), isMatch);
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(isMatch));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + findAdaptationFlagScalar(buffer + i * TS_PACKET_SIZE, count - i, flags);
+}
+
+size_t tsCountSynced(uint8_t const* buffer, size_t count)
+{
+    switch (path)
+    {
+        case PARSER_AVX2: return countSyncedAvx2(buffer, count);
+        case PARSER_SSE41: return countSyncedSse41(buffer, count);
+        default: return countSyncedScalar(buffer, count);
+    }
+}
+
+void tsGetPids(uint8_t const* buffer, size_t count, uint16_t* pids)
+{
+    switch (path)
+    {
+        case PARSER_AVX2: getPidsAvx2(buffer, count, pids); break;
+        case PARSER_SSE41: getPidsSse41(buffer, count, pids); break;
+        default: getPidsScalar(buffer, count, pids); break;
+    }
+}
+
+size_t tsFindAdaptationFlag(uint8_t const* buffer, size_t count, uint8_t flags)
+{
+    switch (path)
+    {
+        case PARSER_AVX2: return findAdaptationFlagAvx2(buffer, count, flags);
+        case PARSER_SSE41: return findAdaptationFlagSse41(buffer, count, flags);
+        default: return findAdaptationFlagScalar(buffer, count, flags);
+    }
+}
+
+int tsFindRandomAccess(uint8_t const* buffer, size_t size)
+{
+    size_t count = size / TS_PACKET_SIZE;
+    size_t index = tsFindAdaptationFlag(buffer, count, TS_AF_RANDOM_ACCESS);
+    return index < count ? (int)(index * TS_PACKET_SIZE) : -1;
+}
+
+int tsFindKeyframeStart(uint8_t const* buffer, size_t size)
+{
+    // random access is also set on each audio frame, a few hits per chunk at most
+    size_t count = size / TS_PACKET_SIZE;
+    size_t index = 0;
+    while (index < count)
+    {
+        index += tsFindAdaptationFlag(buffer + index * TS_PACKET_SIZE, count - index,
+                                      TS_AF_RANDOM_ACCESS);
+        if (index < count && tsIsKeyframeStart(buffer + index * TS_PACKET_SIZE))
+            return (int)(index * TS_PACKET_SIZE);
+
+        ++index;
+    }
+
+    return -1;
+}
+
+size_t tsMarkDiscontinuity(uint8_t const* buffer, size_t size, uint8_t* out)
+{
+    // a chunk has a handful of PIDs, a list beats a table of all of them
+    uint16_t seen[64];
+    size_t seenCount = 0;
+    size_t outSize = 0;
+    for (size_t offset = 0; offset + TS_PACKET_SIZE <= size; offset += TS_PACKET_SIZE)
+    {
+        uint8_t const* pkt = buffer + offset;
+        uint16_t pid = tsGetPid(pkt);
+        bool isFirst = pid != TS_NULL_PID && seenCount < sizeof(seen) / sizeof(seen[0]) &&
+            std::find(seen, seen + seenCount, pid) == seen + seenCount;
+        if (isFirst)
+            seen[seenCount++] = pid;
+
+        uint8_t* outPkt = out + outSize;
+        if (isFirst && !(tsHasAdaptationField(pkt) && pkt[4] > 0))
+        {
+            // counter is the one before this packet's, which then follows on
+            memset(outPkt, 0xFF, TS_PACKET_SIZE);
+            outPkt[0] = TS_SYNC_BYTE;
+            outPkt[1] = pkt[1] & 0x1F; // no payload start
+            outPkt[2] = pkt[2];
+            outPkt[3] = (pkt[3] & 0xC0) | 0x20 | ((tsGetContinuityCounter(pkt) - 1) & 0x0F);
+            outPkt[4] = TS_PACKET_SIZE - 5;
+            outPkt[5] = 0x80;
+            outSize += TS_PACKET_SIZE;
+            outPkt = out + outSize;
+            isFirst = false;
+        }
+
+        memcpy(outPkt, pkt, TS_PACKET_SIZE);
+        if (isFirst)
+            outPkt[5] |= 0x80;
+        outSize += TS_PACKET_SIZE;
+    }
+
+    return outSize;
+}
+
+int64_t tsFindPcr(uint8_t const* buffer, size_t size)
+{
+    size_t count = size / TS_PACKET_SIZE;
+    size_t index = tsFindAdaptationFlag(buffer, count, TS_AF_PCR);
+    return index < count ? tsGetPcr(buffer + index * TS_PACKET_SIZE) : -1;
+}
+
+char const* tsGetParserPath()
+{
+    switch (path)
+    {
+        case PARSER_AVX2: return "avx2";
+        case PARSER_SSE41: return "sse4.1";
+        default: return "scalar";
+    }
+}
+
+void tsSetScalarParser(bool isScalar)
+{
+    path = isScalar ? PARSER_SCALAR : detectedPath;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "TSPacket.h"
+
+// adaptation field flags, see tsFindAdaptationFlag()
+#define TS_AF_RANDOM_ACCESS 0x40
+#define TS_AF_PCR 0x10
+
+// Batch TS parsing, over count packets laid out back to back from buffer
+// Looks at the same header bytes the TSPacket.h helpers do, a batch at a
+// time: the 4 byte header and the first 2 adaptation field bytes of 8
+// packets are gathered into one AVX2 register each, 4 packets at a time with
+// SSE4.1, picked at runtime from what the CPU has, scalar otherwise.
+
+// leading packets starting with a sync byte, count if all of them do
+size_t tsCountSynced(uint8_t const* buffer, size_t count);
+// PID of each packet, into pids[count]
+void tsGetPids(uint8_t const* buffer, size_t count, uint16_t* pids);
+// first synced packet with an adaptation field that has any of flags set
+// count if there is none
+size_t tsFindAdaptationFlag(uint8_t const* buffer, size_t count, uint8_t flags);
+
+// offset of first keyframe packet in buffer, -1 if there is none
+int tsFindRandomAccess(uint8_t const* buffer, size_t size);
+// same, only for packets starting a video PES, see tsIsKeyframeStart()
+int tsFindKeyframeStart(uint8_t const* buffer, size_t size);
+// copies packets from buffer to out, flagging a discontinuity on the first
+// packet of each PID, so a player takes what follows as a new clock and new
+// continuity counters; a packet with no adaptation field to flag gets an
+// adaptation field only packet before it, so out needs room for twice size
+// returns bytes written to out
+size_t tsMarkDiscontinuity(uint8_t const* buffer, size_t size, uint8_t* out);
+// first PCR in buffer, -1 if there is none
+int64_t tsFindPcr(uint8_t const* buffer, size_t size);
+
+// "avx2", "sse4.1" or "scalar"
+char const* tsGetParserPath();
+// forces scalar path, e.g to compare
+void tsSetScalarParser(bool isScalar);
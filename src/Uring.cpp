@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "Uring.h"
+#include "Util.h"
+
+static int uringSetup(unsigned entries, io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, void const* arg, unsigned count)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+// ring indexes are shared with the kernel
+static unsigned loadAcquire(unsigned const* p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void storeRelease(unsigned* p, unsigned value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+Uring::~Uring()
+{
+    Close();
+}
+
+bool Uring::Initialize(unsigned entries, unsigned flags)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = flags;
+    if (flags & IORING_SETUP_SQPOLL)
+        params.sq_thread_idle = 1000; // ms before kernel thread goes to sleep
+
+    _ringFd = uringSetup(entries, &params);
+    if (_ringFd < 0)
+    {
+        LOG_ERROR("io_uring_setup failed: %s", strerror(errno));
+        return false;
+    }
+
+    _flags = flags;
+    _sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    // newer kernels map both rings in one go
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap)
+    {
+        if (_cqMapSize > _sqMapSize)
+            _sqMapSize = _cqMapSize;
+        _cqMapSize = _sqMapSize;
+    }
+
+    _sqMap = mmap(NULL, _sqMapSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+    if (_sqMap == MAP_FAILED)
+    {
+        _sqMap = nullptr;
+        LOG_ERROR("Failed to map io_uring submission queue");
+        Close();
+        return false;
+    }
+
+    if (singleMap)
+        _cqMap = _sqMap;
+    else
+    {
+        _cqMap = mmap(NULL, _cqMapSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+        if (_cqMap == MAP_FAILED)
+        {
+            _cqMap = nullptr;
+            LOG_ERROR("Failed to map io_uring completion queue");
+            Close();
+            return false;
+        }
+    }
+
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(NULL, _sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map io_uring sqes");
+        Close();
+        return false;
+    }
+
+    _sqes = (io_uring_sqe*)sqes;
+    _sqEntries = params.sq_entries;
+
+    char* sq = (char*)_sqMap;
+    _sqHead = (unsigned*)(sq + params.sq_off.head);
+    _sqTail = (unsigned*)(sq + params.sq_off.tail);
+    _sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    _sqFlags = (unsigned*)(sq + params.sq_off.flags);
+    _sqArray = (unsigned*)(sq + params.sq_off.array);
+
+    char* cq = (char*)_cqMap;
+    _cqHead = (unsigned*)(cq + params.cq_off.head);
+    _cqTail = (unsigned*)(cq + params.cq_off.tail);
+    _cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    _cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+    return true;
+}
+
+void Uring::Close()
+{
+    if (_sqes)
+        munmap(_sqes, _sqesSize);
+
+    if (_cqMap && _cqMap != _sqMap)
+        munmap(_cqMap, _cqMapSize);
+
+    if (_sqMap)
+        munmap(_sqMap, _sqMapSize);
+
+    if (_ringFd >= 0)
+        close(_ringFd);
+
+    _ringFd = -1;
+    _sqMap = nullptr;
+    _cqMap = nullptr;
+    _sqes = nullptr;
+}
+
+io_uring_sqe* Uring::GetSqe()
+{
+    unsigned head = loadAcquire(_sqHead);
+    if (_sqeTail - head >= _sqEntries)
+        return nullptr;
+
+    io_uring_sqe* sqe = &_sqes[_sqeTail & *_sqMask];
+    ++_sqeTail;
+
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int Uring::Submit(unsigned waitCount)
+{
+    // publish handed out sqes to the kernel
+    unsigned tail = *_sqTail;
+    unsigned toSubmit = _sqeTail - _sqeHead;
+    while (_sqeHead != _sqeTail)
+    {
+        _sqArray[tail & *_sqMask] = _sqeHead & *_sqMask;
+        ++tail;
+        ++_sqeHead;
+    }
+
+    storeRelease(_sqTail, tail);
+
+    unsigned flags = 0;
+    if (waitCount > 0)
+        flags |= IORING_ENTER_GETEVENTS;
+
+    // with SQPOLL the kernel thread picks sqes up by itself, only enter to wake it up
+    if (_flags & IORING_SETUP_SQPOLL)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (loadAcquire(_sqFlags) & IORING_SQ_NEED_WAKEUP)
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        else if (waitCount == 0)
+            return toSubmit;
+    }
+    else if (toSubmit == 0 && waitCount == 0)
+        return 0;
+
+    ++_enterCount;
+    int ret = uringEnter(_ringFd, toSubmit, waitCount, flags);
+    if (ret < 0)
+        return -errno;
+
+    return ret;
+}
+
+bool Uring::PeekCqe(io_uring_cqe& cqe)
+{
+    unsigned head = *_cqHead;
+    if (head == loadAcquire(_cqTail))
+        return false;
+
+    cqe = _cqes[head & *_cqMask];
+    storeRelease(_cqHead, head + 1);
+    return true;
+}
+
+bool Uring::WaitCqe(io_uring_cqe& cqe)
+{
+    while (!PeekCqe(cqe))
+    {
+        ++_enterCount;
+        int ret = uringEnter(_ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR)
+            return false;
+    }
+
+    return true;
+}
+
+int Uring::RegisterBuffers(iovec const* iovecs, unsigned count)
+{
+    int ret = uringRegister(_ringFd, IORING_REGISTER_BUFFERS, iovecs, count);
+    return ret < 0 ? -errno : ret;
+}
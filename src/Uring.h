@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper, straight on top of the syscalls so there's no
+// extra library dependency
+// Not thread safe, each ring is meant to be owned by a single thread.
+class Uring
+{
+public:
+    Uring() { }
+    ~Uring();
+
+    // flags are io_uring_setup flags, e.g IORING_SETUP_SQPOLL
+    bool Initialize(unsigned entries, unsigned flags = 0);
+    void Close();
+    bool IsInitialized() const { return _ringFd >= 0; }
+
+    // returns a zeroed sqe, nullptr if submission queue is full
+    io_uring_sqe* GetSqe();
+    // submits queued sqes, optionally waiting for completions
+    // returns number of sqes submitted, negative errno on failure
+    int Submit(unsigned waitCount = 0);
+
+    // copies and consumes next completion, false if none are ready
+    bool PeekCqe(io_uring_cqe& cqe);
+    // blocks until a completion is ready
+    bool WaitCqe(io_uring_cqe& cqe);
+
+    int RegisterBuffers(iovec const* iovecs, unsigned count);
+    unsigned GetPendingCount() const { return _sqeTail - _sqeHead; }
+    // io_uring_enter calls made so far
+    uint64_t GetEnterCount() const { return _enterCount; }
+    bool IsSqPoll() const { return (_flags & IORING_SETUP_SQPOLL) != 0; }
+
+private:
+    int _ringFd = -1;
+    unsigned _flags = 0;
+    uint64_t _enterCount = 0;
+
+    // submission queue
+    void* _sqMap = nullptr;
+    size_t _sqMapSize = 0;
+    unsigned* _sqHead = nullptr;
+    unsigned* _sqTail = nullptr;
+    unsigned* _sqMask = nullptr;
+    unsigned* _sqFlags = nullptr;
+    unsigned* _sqArray = nullptr;
+    io_uring_sqe* _sqes = nullptr;
+    size_t _sqesSize = 0;
+    unsigned _sqEntries = 0;
+    // sqes handed out but not yet submitted
+    unsigned _sqeHead = 0;
+    unsigned _sqeTail = 0;
+
+    // completion queue
+    void* _cqMap = nullptr;
+    size_t _cqMapSize = 0;
+    unsigned* _cqHead = nullptr;
+    unsigned* _cqTail = nullptr;
+    unsigned* _cqMask = nullptr;
+    io_uring_cqe* _cqes = nullptr;
+};
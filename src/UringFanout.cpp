@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/socket.h>
+
+#include "UringFanout.h"
+#include "ClientTable.h"
+#include "Util.h"
+
+// user_data of the accept request, writes carry their client's slot, control
+// recvs too, with this bit set
+#define FANOUT_ACCEPT_DATA UINT64_MAX
+#define FANOUT_CONTROL_DATA (1ULL << 32)
+
+UringFanout::~UringFanout()
+{
+    Close();
+}
+
+bool UringFanout::Initialize(BroadcastRing const& ring, int listenSocketFd, bool sqPoll)
+{
+    if (sqPoll && !_uring.Initialize(FANOUT_QUEUE_SIZE, IORING_SETUP_SQPOLL))
+        LOG_INFO("io_uring SQPOLL unavailable, submitting from Streamer");
+
+    if (!_uring.IsInitialized() && !_uring.Initialize(FANOUT_QUEUE_SIZE))
+        return false;
+
+    _ring = &ring;
+    _listenSocketFd = listenSocketFd;
+
+    // a ring attached from another process is read only, which can't be registered
+    iovec iov;
+    iov.iov_base = (void*)ring.GetChunkMemory();
+    iov.iov_len = ring.GetChunkMemorySize();
+    int ret = _uring.RegisterBuffers(&iov, 1);
+    _isFixed = ret >= 0;
+    if (!_isFixed)
+        LOG_INFO("Can't register ring with io_uring (%s), sending without fixed buffers",
+            strerror(-ret));
+
+    QueueAccept();
+    _uring.Submit();
+    return true;
+}
+
+void UringFanout::Close()
+{
+    // pending requests are cancelled along with the ring
+    _uring.Close();
+
+    for (FanoutClient& client : _clients)
+    {
+        if (client.fd >= 0)
+            close(client.fd);
+    }
+
+    _clients.clear();
+    _clientCount = 0;
+}
+
+void UringFanout::Update()
+{
+    io_uring_cqe cqe;
+    while (_uring.PeekCqe(cqe))
+    {
+        if (cqe.user_data != FANOUT_ACCEPT_DATA)
+        {
+            if (cqe.user_data & FANOUT_CONTROL_DATA)
+                OnControl((uint32_t)cqe.user_data, cqe.res);
+            else
+                OnWritten((uint32_t)cqe.user_data, cqe.res);
+            continue;
+        }
+
+        if (cqe.res >= 0)
+            AddClient(cqe.res);
+        else if (cqe.res == -EINVAL && _isMultishot)
+        {
+            LOG_INFO("Multishot accept unavailable, accepting one client at a time");
+            _isMultishot = false;
+        }
+
+        // multishot accept stays armed until it says otherwise
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+            QueueAccept();
+    }
+
+    for (uint32_t slot = 0; slot < _clients.size(); ++slot)
+    {
+        FanoutClient const& client = _clients[slot];
+        if (client.fd < 0 || client.closing)
+            continue;
+
+        if (!client.isReceiving)
+            QueueControl(slot);
+        if (client.inFlight == 0)
+            QueueClient(slot);
+    }
+
+    _uring.Submit();
+}
+
+void UringFanout::QueueAccept()
+{
+    io_uring_sqe* sqe = _uring.GetSqe();
+    if (!sqe)
+    {
+        _uring.Submit();
+        sqe = _uring.GetSqe();
+    }
+
+    if (!sqe)
+    {
+        LOG_ERROR("Failed to queue accept, io_uring submission queue full");
+        return;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = _listenSocketFd;
+    sqe->user_data = FANOUT_ACCEPT_DATA;
+    if (_isMultishot)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    // clients are left blocking, io_uring polls them when they're full
+    // with O_NONBLOCK, fixed writes would just fail with EAGAIN instead
+    sqe->accept_flags = SOCK_CLOEXEC;
+}
+
+void UringFanout::QueueClient(uint32_t slot)
+{
+    FanoutClient& client = _clients[slot];
+
+    // both only take hold between chunks, same as the regular backend
+    if (client.offset == 0 && client.isStandby)
+        return;
+
+    if (client.offset == 0 && client.isActivated)
+    {
+        client.isActivated = false;
+        client.seq = _ring->FindKeyframe(UINT64_MAX);
+        if (client.seq == UINT64_MAX)
+            client.seq = _ring->GetWriteSeq();
+        ++_zapActivations;
+    }
+
+    RingChunk const* first = _ring->GetChunk(client.seq);
+    if (_ring->IsOverrun(client.seq) ||
+        (client.seq < _ring->GetWriteSeq() &&
+         first->seq.load(std::memory_order_acquire) != client.seq))
+    {
+        LOG_INFO("Client fd %d fell a full ring behind, removing", client.fd);
+        RemoveClient(client);
+        return;
+    }
+
+    uint64_t writeSeq = _ring->GetWriteSeq();
+    uint64_t endSeq = std::min(writeSeq, client.seq + FANOUT_MAX_CHAIN);
+    io_uring_sqe* last = nullptr;
+    for (uint64_t seq = client.seq; seq < endSeq; ++seq)
+    {
+        io_uring_sqe* sqe = _uring.GetSqe();
+        if (!sqe)
+            break; // rest goes in the next chain
+
+        // committed chunks don't change until overwritten, which OnWritten() catches
+        // one a bus publisher already started overwriting isn't sent at all
+        RingChunk const* chunk = _ring->GetChunk(seq);
+        if (chunk->seq.load(std::memory_order_acquire) != seq)
+            break; // a chain cut short here is queued again, and removed then
+        uint32_t offset = (seq == client.seq) ? client.offset : 0;
+        uint32_t size = std::min(chunk->size, (uint32_t)RING_CHUNK_SIZE);
+
+        if (_isFixed)
+        {
+            sqe->opcode = IORING_OP_WRITE_FIXED;
+            sqe->buf_index = 0;
+        }
+        else
+        {
+            sqe->opcode = IORING_OP_SEND;
+            sqe->msg_flags = MSG_NOSIGNAL;
+        }
+
+        sqe->fd = client.fd;
+        sqe->addr = (uint64_t)(chunk->data + offset);
+        sqe->len = size - offset;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = slot;
+
+        last = sqe;
+        ++client.inFlight;
+    }
+
+    // chain ends here, the next one is only queued once it's all done
+    if (last)
+        last->flags &= ~IOSQE_IO_LINK;
+}
+
+void UringFanout::QueueControl(uint32_t slot)
+{
+    io_uring_sqe* sqe = _uring.GetSqe();
+    if (!sqe)
+        return; // queued next time round
+
+    FanoutClient& client = _clients[slot];
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client.fd;
+    sqe->addr = (uint64_t)client.control;
+    sqe->len = sizeof(client.control);
+    sqe->user_data = FANOUT_CONTROL_DATA | slot;
+    client.isReceiving = true;
+}
+
+void UringFanout::AddClient(int fd)
+{
+    size_t slot = 0;
+    while (slot < _clients.size() && _clients[slot].fd >= 0)
+        ++slot;
+
+    if (slot == _clients.size())
+        _clients.push_back(FanoutClient());
+
+    // same as regular backend, new clients start from the newest keyframe
+    if (_pacingRate > 0 &&
+        setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE, &_pacingRate, sizeof(_pacingRate)) < 0)
+        LOG_INFO("Can't pace client fd %d: %s", fd, strerror(errno));
+
+    FanoutClient& client = _clients[slot];
+    client = FanoutClient();
+    client.fd = fd;
+    client.seq = _ring->FindKeyframe(UINT64_MAX);
+    if (client.seq == UINT64_MAX)
+        client.seq = _ring->GetWriteSeq();
+    ++_clientCount;
+
+    LOG_INFO("Accepted new client, fd %d", fd);
+}
+
+void UringFanout::OnWritten(uint32_t slot, int res)
+{
+    FanoutClient& client = _clients[slot];
+    --client.inFlight;
+
+    if (client.closing)
+    {
+        CloseIfIdle(client);
+        return;
+    }
+
+    // rest of a chain cut short by a short write, queued again from client.seq
+    if (res == -ECANCELED)
+        return;
+
+    if (res < 0)
+    {
+        LOG_INFO("Removing client fd %d from client list", client.fd);
+        RemoveClient(client);
+        return;
+    }
+
+    // chunk must not have been reused while it was being sent
+    RingChunk const* chunk = _ring->GetChunk(client.seq);
+    if (chunk->seq.load(std::memory_order_acquire) != client.seq)
+    {
+        LOG_INFO("Client fd %d fell a full ring behind, removing", client.fd);
+        RemoveClient(client);
+        return;
+    }
+
+    client.offset += res;
+    if (client.offset >= chunk->size)
+    {
+        ++client.seq;
+        client.offset = 0;
+    }
+}
+
+void UringFanout::OnControl(uint32_t slot, int res)
+{
+    FanoutClient& client = _clients[slot];
+    client.isReceiving = false;
+
+    if (client.closing)
+    {
+        CloseIfIdle(client);
+        return;
+    }
+
+    // nothing else is ever sent by viewers, 0 means they're gone
+    if (res <= 0)
+    {
+        if (res != -EINTR && res != -EAGAIN)
+            RemoveClient(client);
+        return;
+    }
+
+    for (int i = 0; i < res; ++i)
+    {
+        if (client.control[i] == CLIENT_CONTROL_STANDBY)
+            client.isStandby = true;
+        else if (client.control[i] == CLIENT_CONTROL_ACTIVATE)
+        {
+            client.isStandby = false;
+            client.isActivated = true;
+        }
+    }
+}
+
+void UringFanout::RemoveClient(FanoutClient& client)
+{
+    client.closing = true;
+    --_clientCount;
+
+    // pending writes and recvs fail right away once the socket is shut down
+    if (client.inFlight > 0 || client.isReceiving)
+        shutdown(client.fd, SHUT_RDWR);
+    CloseIfIdle(client);
+}
+
+void UringFanout::CloseIfIdle(FanoutClient& client)
+{
+    if (client.inFlight > 0 || client.isReceiving)
+        return;
+
+    close(client.fd);
+    client.fd = -1;
+}
+
+size_t UringFanout::GetStandbyCount() const
+{
+    size_t count = 0;
+    for (FanoutClient const& client : _clients)
+    {
+        if (client.fd >= 0 && !client.closing && client.isStandby)
+            ++count;
+    }
+
+    return count;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+
+#include "BroadcastRing.h"
+#include "Uring.h"
+
+// submission queue size, completion queue gets twice as many
+#define FANOUT_QUEUE_SIZE 1024
+// most chunks queued per client at once, as one linked chain
+#define FANOUT_MAX_CHAIN 16
+// control bytes read at once, see ClientTable.h
+#define FANOUT_CONTROL_SIZE 16
+
+struct FanoutClient
+{
+    int fd = -1;
+    uint64_t seq = 0;       // next chunk to send
+    uint32_t offset = 0;    // into chunk seq, after a short write
+    unsigned inFlight = 0;  // writes
+    bool closing = false;   // fd is closed once nothing is in flight anymore
+    // control bytes of zapping clients, a recv is kept queued for them
+    char control[FANOUT_CONTROL_SIZE];
+    bool isReceiving = false;
+    bool isStandby = false;     // gets nothing until activated
+    bool isActivated = false;   // starts over from the newest keyframe
+};
+
+// io_uring backend for TCP fan-out, instead of one accept4 and one write per
+// client per chunk
+// Each client follows the broadcast ring with its own cursor. Whenever it has
+// nothing in flight, everything it's missing (up to FANOUT_MAX_CHAIN chunks)
+// is queued as a chain of linked writes, so they go out in order, straight
+// from the ring, which is registered as a fixed buffer where possible. New
+// clients come from a multishot accept on the listen socket, and Update()
+// submits all of it with a single io_uring_enter, or none with SQPOLL.
+// Like the regular backend, a client that falls a full ring behind is dropped,
+// and zapping clients' control bytes (standby and activate) are read with a
+// recv kept queued per client, which also tells when a client goes away.
+class UringFanout
+{
+public:
+    UringFanout() { }
+    ~UringFanout();
+
+    bool Initialize(BroadcastRing const& ring, int listenSocketFd, bool sqPoll);
+    // kernel paces each new client at rate bytes/s, 0 doesn't
+    void SetPacingRate(uint32_t rate) { _pacingRate = rate; }
+    void Close();
+    bool IsInitialized() const { return _uring.IsInitialized(); }
+
+    // takes new clients and completions, queues what clients are missing
+    void Update();
+
+    size_t GetClientCount() const { return _clientCount; }
+    size_t GetStandbyCount() const;
+    uint64_t GetZapActivations() const { return _zapActivations; }
+    uint64_t GetSyscallCount() const { return _uring.GetEnterCount(); }
+
+private:
+    void QueueAccept();
+    void QueueClient(uint32_t slot);
+    void QueueControl(uint32_t slot);
+    void AddClient(int fd);
+    void OnWritten(uint32_t slot, int res);
+    void OnControl(uint32_t slot, int res);
+    void RemoveClient(FanoutClient& client);
+    // closes fd of a removed client once the kernel is done with it
+    void CloseIfIdle(FanoutClient& client);
+
+private:
+    Uring _uring;
+    BroadcastRing const* _ring = nullptr;
+    int _listenSocketFd = -1;
+    bool _isFixed = false;      // ring registered as fixed buffer
+    bool _isMultishot = true;   // falls back to rearming accept each time
+    uint32_t _pacingRate = 0;
+
+    // slots are reused, completions refer to clients by slot
+    // a deque, so control buffers stay put as clients are added
+    std::deque<FanoutClient> _clients;
+    size_t _clientCount = 0;
+    uint64_t _zapActivations = 0;
+};
@@ -1,5 +1,7 @@
 
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #define LOG_ERROR(fmt, ...)                                 \
     do {                                                    \
@@ -18,3 +20,13 @@ inline long getMSTime()
     gettimeofday(&t, NULL);
     return t.tv_sec * 1e3 + t.tv_usec / 1e3;
 }
+
+// true if the process at the other end of a unix socket runs as our user,
+// abstract sockets have no file permissions to keep others out
+inline bool isPeerOurs(int fd)
+{
+    ucred cred;
+    socklen_t credLen = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == 0 &&
+        cred.uid == geteuid();
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "VodServer.h"
+#include "Http.h"
+#include "TSPacket.h"
+#include "Util.h"
+
+#define VOD_MAX_SEND_SIZE (64 * 1024)
+// whole TS packets, indexer expects batches to start on a packet boundary
+#define VOD_INDEX_BATCH_SIZE (TS_PACKET_SIZE * 4096)
+
+VodServer::~VodServer()
+{
+    for (VodClient& client : _clients)
+        close(client.fd);
+
+    if (_map)
+        munmap(_map, _size);
+
+    if (_cacheFd >= 0)
+        close(_cacheFd);
+}
+
+bool VodServer::Initialize(std::string const& videoFilePath, std::string const& cachePath,
+    std::string const& videoSize, std::string const& bitRate, int listenSocketFd)
+{
+    _cachePath = cachePath;
+    _indexPath = cachePath + ".idx";
+    _profilePath = cachePath + ".profile";
+    _listenSocketFd = listenSocketFd;
+
+    std::string profile = GetProfile(videoFilePath, videoSize, bitRate);
+    if (IsCacheValid(videoFilePath, profile))
+        LOG_INFO("Using cached VOD file %s", _cachePath.c_str());
+    else
+    {
+        LOG_INFO("Transcoding %s to %s...", videoFilePath.c_str(), _cachePath.c_str());
+        if (!Transcode(videoFilePath, videoSize, bitRate))
+            return false;
+
+        // written last, a cache without one is never reused
+        std::ofstream profileFile(_profilePath, std::ios::trunc);
+        profileFile << profile;
+        if (!profileFile)
+            LOG_ERROR("Failed to write VOD profile %s", _profilePath.c_str());
+    }
+
+    if (!MapCache())
+        return false;
+
+    // index is rebuilt if missing or older than the cache
+    struct stat cache;
+    struct stat index;
+    fstat(_cacheFd, &cache);
+    if ((stat(_indexPath.c_str(), &index) < 0 || index.st_mtime < cache.st_mtime) &&
+        !BuildIndex())
+        return false;
+
+    if (!_index.Open(_indexPath))
+        return false;
+
+    LOG_INFO("VOD file ready, %lu bytes, %zu frames indexed",
+        (unsigned long)_size, _index.GetEntryCount());
+    return true;
+}
+
+std::string VodServer::GetProfile(std::string const& videoFilePath,
+    std::string const& videoSize, std::string const& bitRate)
+{
+    return "source=" + videoFilePath + "\nvideo_size=" + videoSize +
+        "\nbit_rate=" + bitRate + "\n";
+}
+
+bool VodServer::IsCacheValid(std::string const& videoFilePath, std::string const& profile) const
+{
+    struct stat video;
+    struct stat cache;
+    if (stat(videoFilePath.c_str(), &video) < 0 ||
+        stat(_cachePath.c_str(), &cache) < 0 || cache.st_mtime < video.st_mtime)
+        return false;
+
+    // same file transcoded to another size or bit rate is no use
+    std::ifstream profileFile(_profilePath);
+    std::stringstream cached;
+    cached << profileFile.rdbuf();
+    return profileFile && cached.str() == profile;
+}
+
+bool VodServer::Transcode(std::string const& videoFilePath, std::string const& videoSize,
+    std::string const& bitRate)
+{
+    // transcode to a temporary file, a half written cache must never be used
+    std::string partPath = _cachePath + ".part";
+    unlink(_indexPath.c_str());
+    unlink(_profilePath.c_str());
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // arguments used:
+        // $1 = video file path
+        // $2 = output TS file path
+        // $3 = video size (e.g 420x320)
+        // $4 = video bitrate (e.g 400k or 400000)
+        execlp("./streamer_ffmpeg_vod.sh", "streamer_ffmpeg_vod.sh",
+            videoFilePath.c_str(),  // $1
+            partPath.c_str(),       // $2
+            videoSize.c_str(),      // $3
+            bitRate.c_str(),        // $4
+            nullptr);
+        _exit(1);
+    }
+
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        LOG_ERROR("Failed to transcode %s", videoFilePath.c_str());
+        unlink(partPath.c_str());
+        return false;
+    }
+
+    if (rename(partPath.c_str(), _cachePath.c_str()) < 0)
+    {
+        LOG_ERROR("Failed to move transcoded file to %s", _cachePath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool VodServer::MapCache()
+{
+    _cacheFd = open(_cachePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (_cacheFd < 0)
+    {
+        LOG_ERROR("Failed to open VOD file %s", _cachePath.c_str());
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(_cacheFd, &st) < 0 || st.st_size == 0)
+    {
+        LOG_ERROR("VOD file %s is empty", _cachePath.c_str());
+        return false;
+    }
+
+    _size = st.st_size;
+    void* map = mmap(NULL, _size, PROT_READ, MAP_SHARED, _cacheFd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG_ERROR("Failed to map VOD file");
+        return false;
+    }
+
+    _map = (char*)map;
+    return true;
+}
+
+bool VodServer::BuildIndex()
+{
+    LOG_INFO("Indexing %s...", _cachePath.c_str());
+
+    // one sequential pass over the file, never needs doing again
+    madvise(_map, _size, MADV_SEQUENTIAL);
+
+    StreamIndexWriter writer;
+    if (!writer.Open(_indexPath))
+        return false;
+
+    StreamIndexer indexer;
+    std::vector<StreamIndexEntry> entries;
+    for (uint64_t offset = 0; offset < _size; offset += VOD_INDEX_BATCH_SIZE)
+    {
+        size_t size = std::min((uint64_t)VOD_INDEX_BATCH_SIZE, _size - offset);
+        entries.clear();
+        indexer.Feed((uint8_t const*)_map + offset, size, entries);
+        writer.Append(entries);
+    }
+
+    writer.Close();
+    madvise(_map, _size, MADV_RANDOM);
+    return true;
+}
+
+void VodServer::Serve()
+{
+    AcceptClients();
+
+    _clients.remove_if([this](VodClient& client)
+                       {
+                           bool keep = client.streaming ?
+                               ServeClient(client) : HandleRequest(client);
+                           if (!keep)
+                           {
+                               LOG_INFO("Removing VOD client fd %d", client.fd);
+                               close(client.fd);
+                           }
+
+                           return !keep;
+                       });
+}
+
+void VodServer::AcceptClients()
+{
+    while (true)
+    {
+        int clientSocket = accept4(_listenSocketFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket < 0)
+            break;
+
+        VodClient client;
+        client.fd = clientSocket;
+        _clients.push_back(client);
+        LOG_INFO("Accepted new VOD client, fd %d", clientSocket);
+    }
+}
+
+bool VodServer::HandleRequest(VodClient& client)
+{
+    char buffer[HTTP_MAX_REQUEST_SIZE];
+    ssize_t n = read(client.fd, buffer, sizeof(buffer));
+    if (n == 0 || (n < 0 && errno != EAGAIN))
+        return false;
+
+    if (n > 0)
+        client.request.append(buffer, n);
+
+    HttpRequest request;
+    int parsed = httpParseRequest(client.request, request);
+    if (parsed == 0)
+        return true; // wait for full header
+
+    std::string response;
+    if (parsed < 0)
+        response = httpResponse(400);
+    else if (request.method != "GET" && request.method != "HEAD")
+        response = httpResponse(405);
+
+    if (!response.empty())
+    {
+        write(client.fd, response.data(), response.size());
+        return false;
+    }
+
+    int status = 200;
+    client.pos = 0;
+    client.end = _size;
+
+    if (request.query.count("t"))
+    {
+        // seek command, start at keyframe for given media time
+        StreamIndexEntry const* first = _index.GetEntryCount() ? _index.GetEntry(0) : nullptr;
+        double seconds = atof(request.query["t"].c_str());
+        StreamIndexEntry const* entry = first ?
+            _index.FindKeyframe(first->pts + (int64_t)(seconds * 90000)) : nullptr;
+        if (entry)
+            client.pos = entry->offset;
+    }
+    else if (request.hasRange)
+    {
+        if (request.rangeSuffix >= 0)
+            client.pos = _size - std::min((uint64_t)request.rangeSuffix, _size);
+        else
+        {
+            client.pos = request.rangeStart;
+            if (request.rangeEnd >= 0)
+                client.end = std::min((uint64_t)request.rangeEnd + 1, _size);
+        }
+
+        if (client.pos >= _size)
+        {
+            response = httpResponse(416, "Content-Range: bytes */" + std::to_string(_size) + "\r\n");
+            write(client.fd, response.data(), response.size());
+            return false;
+        }
+
+        status = 206;
+    }
+
+    std::string headers =
+        "Content-Type: video/mp2t\r\n"
+        "Content-Length: " + std::to_string(client.end - client.pos) + "\r\n";
+    // seeked responses start mid file, byte ranges wouldn't line up with them
+    if (!request.query.count("t"))
+        headers += "Accept-Ranges: bytes\r\n";
+    if (status == 206)
+    {
+        headers += "Content-Range: bytes " + std::to_string(client.pos) + "-" +
+            std::to_string(client.end - 1) + "/" + std::to_string(_size) + "\r\n";
+    }
+
+    response = httpResponse(status, headers);
+    if (write(client.fd, response.data(), response.size()) < 0)
+        return false;
+
+    if (request.method == "HEAD")
+        return false;
+
+    client.streaming = true;
+    return true;
+}
+
+bool VodServer::ServeClient(VodClient& client)
+{
+    // players read ahead as fast as they can, no pacing needed
+    while (client.pos < client.end)
+    {
+        size_t size = std::min(client.end - client.pos, (uint64_t)VOD_MAX_SEND_SIZE);
+        ssize_t n = write(client.fd, _map + client.pos, size);
+        if (n < 0)
+            return errno == EAGAIN;
+
+        client.pos += n;
+    }
+
+    // done, let client close or reconnect with a new range
+    return false;
+}
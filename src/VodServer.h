@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <list>
+
+#include "StreamIndex.h"
+
+struct VodClient
+{
+    int fd = -1;
+    std::string request;    // HTTP request received so far
+    bool streaming = false; // request handled, sending data
+    uint64_t pos = 0;       // next byte to send
+    uint64_t end = 0;       // one past last byte to send
+};
+
+// Seekable VOD mode
+// The source file is transcoded to TS once (without -re, so as fast as the
+// machine allows) and cached along with a side index. Viewers are then served
+// straight out of the memory mapped cache over HTTP, which costs no
+// transcoding at all. The cache is only reused for the same source, video size
+// and bit rate, as recorded in a profile file next to it:
+// - Range requests, so players can seek on their own
+// - "?t=$seconds", starts playback at the keyframe for that media time
+class VodServer
+{
+public:
+    VodServer() { }
+    ~VodServer();
+
+    bool Initialize(std::string const& videoFilePath, std::string const& cachePath,
+        std::string const& videoSize, std::string const& bitRate, int listenSocketFd);
+
+    // accepts and serves clients, meant to be called periodically
+    void Serve();
+
+private:
+    // what the cache was transcoded from and to
+    static std::string GetProfile(std::string const& videoFilePath,
+        std::string const& videoSize, std::string const& bitRate);
+    bool IsCacheValid(std::string const& videoFilePath, std::string const& profile) const;
+    bool Transcode(std::string const& videoFilePath, std::string const& videoSize,
+        std::string const& bitRate);
+    bool BuildIndex();
+    bool MapCache();
+
+    void AcceptClients();
+    bool HandleRequest(VodClient& client);
+    bool ServeClient(VodClient& client);
+
+private:
+    std::string _cachePath;
+    std::string _indexPath;
+    std::string _profilePath;
+    int _cacheFd = -1;
+    char* _map = nullptr;
+    uint64_t _size = 0;
+
+    StreamIndexReader _index;
+
+    int _listenSocketFd = -1;
+    std::list<VodClient> _clients;
+};
@@ -7,12 +7,17 @@
 # and it's better than passing everything as an environment variable
 
 # $1 = video file path
-# $2 = end point info in "transport://ip:port" format (e.g tcp://127.0.0.1:9999)
+# $2 = output url, Streamer passes pipe:3, an fd it reads TS data from
 # $3 = video size (e.g 420x320)
 # $4 = video bitrate (e.g 400k or 400000)
-ffmpeg -re -i $1 -loglevel warning \
+# $5 = extra input options (e.g "-f concat -safe 0" for playlists, "-stream_loop -1")
+# $6 = encoder options, set by the host encoder scheduler (e.g "-preset ultrafast -threads 2")
+# $7 = position to start at in seconds, only set when an encoder is restarted
+# progress goes to stderr as key=value lines, Streamer reads the realtime factor from it
+# exec, so Streamer supervises and signals ffmpeg itself rather than this shell
+exec ffmpeg -re $5 ${7:+-ss $7} -i $1 -loglevel warning -nostats -progress pipe:2 \
     -analyzeduration 500k -probesize 500k -framerate 30 -video_size $3 \
-    -codec:v libx264 -preset ultrafast -pix_fmt yuv420p \
-    -tune zerolatency -preset ultrafast -b:v $4 -g 30 \
+    -codec:v libx264 ${6:--preset ultrafast} -pix_fmt yuv420p \
+    -tune zerolatency -b:v $4 -g 30 \
     -codec:a flac -b:a 32k \
-    -f mpegts ${2}?listen=1
+    -f mpegts $2
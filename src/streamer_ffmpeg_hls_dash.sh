@@ -9,6 +9,8 @@
 # $1 = video file path
 # $2 = HLS/DASH end point info in "transport://ip:port/path" format
 #    (e.g rtmp://127.0.0.1:8080/hls_app/stream)
-ffmpeg -re -i $1 -codec:v libx264 -vprofile baseline -g 30 \
+# $3 = extra input options (e.g "-f concat -safe 0" for playlists, "-stream_loop -1")
+# exec, so Streamer supervises and signals ffmpeg itself rather than this shell
+exec ffmpeg -re $3 -i $1 -codec:v libx264 -vprofile baseline -g 30 \
     -codec:a aac -strict -2 \
     -f flv $2
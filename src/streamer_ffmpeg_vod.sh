@@ -0,0 +1,19 @@
+#!/bin/bash
+
+# Streamer needs to start an ffmpeg instance
+# for the sake of flexibility, it executes this shell script, and
+# this shell script starts ffmpeg with user arguments
+# it's somewhat ugly, but it beats having to parse ffmpeg options in code
+# and it's better than passing everything as an environment variable
+
+# VOD mode transcodes the whole file once, so no -re here, as fast as possible
+# $1 = video file path
+# $2 = output TS file path
+# $3 = video size (e.g 420x320)
+# $4 = video bitrate (e.g 400k or 400000)
+ffmpeg -i $1 -loglevel warning \
+    -framerate 30 -video_size $3 \
+    -codec:v libx264 -preset veryfast -pix_fmt yuv420p \
+    -b:v $4 -g 30 \
+    -codec:a flac -b:a 32k \
+    -f mpegts -y $2